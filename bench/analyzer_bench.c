@@ -0,0 +1,452 @@
+// End-to-end throughput of the shipped pipeline (./build.sh bench): generates input in memory, pushes it
+// through libpipeline for every chain length and queue size asked for and reports lines/s, MB/s and peak
+// RSS of the uninstrumented pipeline, and the time from pipeline_create to the first result (first_line_ms:
+// what a short batch run waits for before any output). --latency adds end-to-end / per-stage latency percentiles, which
+// turns on per-message timing and stage statistics, so those runs measure the instrumented pipeline.
+// Every configuration runs in its own child process, so the peak RSS is its own and the process-wide
+// pipeline settings start over
+// Writes JSON (see bench_util.h), a one-line summary per result goes to stderr
+#include "bench_util.h"
+#include "pipeline.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DEFAULT_DIR "./output"
+#define DEFAULT_LINES 200000ULL
+#define DEFAULT_LENGTH 64ULL
+#define DEFAULT_CHAIN "uppercaser,rotator,flipper,expander"
+#define DEFAULT_STAGES "1,2,4"
+#define DEFAULT_QUEUE_SIZES "1,16,256"
+#define MAX_LIST 16
+#define MAX_LINE (1024 * 1024)
+
+typedef enum
+{
+    DIST_FIXED,   // every line is --length long
+    DIST_UNIFORM, // 1 .. 2 * length - 1
+    DIST_EXP,     // exponential with mean --length (capped at MAX_LINE)
+} length_dist_t;
+
+static const char *const k_dist_names[] = {"fixed", "uniform", "exp"};
+
+typedef struct
+{
+    const char *dir;
+    unsigned long long lines;
+    unsigned long long length;
+    length_dist_t dist;
+    int utf8_percent;
+    const char *chain[MAX_LIST]; // cycled to every stage count
+    int chain_count;
+    int stages[MAX_LIST];
+    int stages_count;
+    int queue_sizes[MAX_LIST];
+    int queue_sizes_count;
+    int optimize;
+    int latency;
+} options_t;
+
+// the generated input: every line NUL-terminated one after the other
+typedef struct
+{
+    char *data;
+    size_t *offsets;
+    size_t *lengths;
+    unsigned long long count;
+    unsigned long long bytes;
+} input_t;
+
+// ---------------------------------------------- input ----------------------------------------------
+
+static size_t line_length(const options_t *o, unsigned int *state)
+{
+    double len = (double)o->length;
+    if (o->dist == DIST_UNIFORM)
+    {
+        unsigned long long r = (unsigned long long)bench_random(state) << 15 | bench_random(state);
+        len = 1.0 + (double)(r % (2 * o->length - 1));
+    }
+    else if (o->dist == DIST_EXP)
+        len = -(double)o->length * log(((double)bench_random(state) + 1.0) / 32768.0); // u in (0, 1]
+    if (len < 1.0)
+        len = 1.0;
+    if (len > MAX_LINE)
+        len = MAX_LINE;
+    return (size_t)len;
+}
+
+static const char *generate_input(input_t *in, const options_t *o)
+{
+    *in = (input_t){.count = o->lines};
+    in->offsets = malloc(o->lines * sizeof(*in->offsets));
+    in->lengths = malloc(o->lines * sizeof(*in->lengths));
+    if (!in->offsets || !in->lengths)
+        return "out of memory";
+
+    unsigned int state = 1;
+    size_t total = 0;
+    for (unsigned long long i = 0; i < o->lines; ++i)
+    {
+        in->lengths[i] = line_length(o, &state);
+        in->offsets[i] = total;
+        total += in->lengths[i] + 1;
+    }
+    in->data = malloc(total);
+    if (!in->data)
+        return "out of memory";
+    for (unsigned long long i = 0; i < o->lines; ++i)
+    {
+        bench_fill_line(in->data + in->offsets[i], in->lengths[i], o->utf8_percent, &state);
+        in->bytes += in->lengths[i];
+    }
+    return NULL;
+}
+
+static void free_input(input_t *in)
+{
+    free(in->data);
+    free(in->offsets);
+    free(in->lengths);
+}
+
+// ---------------------------------------------- one configuration (child process) ----------------------------------------------
+
+typedef struct
+{
+    atomic_ullong lines;
+    atomic_ullong bytes;
+    atomic_ullong first_ns; // when the first result came
+} counter_t;
+
+static void count_result(void *ctx, const char *data, size_t len)
+{
+    counter_t *c = ctx;
+    if (!data)
+        return;
+    if (atomic_fetch_add(&c->lines, 1) == 0)
+        atomic_store(&c->first_ns, bench_now_ns());
+    atomic_fetch_add(&c->bytes, len);
+}
+
+static const double k_quantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+
+static bench_percentiles_t latency_of(pipeline_t *p, int stage)
+{
+    unsigned long long ns[5] = {0};
+    for (int q = 0; q < 5; ++q)
+        pipeline_stage_latency(p, stage, k_quantiles[q], &ns[q]);
+    return (bench_percentiles_t){(double)ns[0], (double)ns[1], (double)ns[2], (double)ns[3], (double)ns[4]};
+}
+
+// run one chain / queue size, the result object goes to out
+static const char *run_config(FILE *out, const input_t *in, const options_t *o, int stages, int queue_size)
+{
+    const char *chain[MAX_LIST * MAX_LIST];
+    char id[1024];
+    int at = snprintf(id, sizeof(id), "pipeline/");
+    for (int i = 0; i < stages; ++i)
+    {
+        chain[i] = o->chain[i % o->chain_count];
+        at += snprintf(id + at, at < (int)sizeof(id) ? sizeof(id) - (size_t)at : 0, "%s%s", i ? "+" : "", chain[i]);
+    }
+    if (at < (int)sizeof(id))
+        snprintf(id + at, sizeof(id) - (size_t)at, "/q%d", queue_size);
+
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0)
+        return "cannot open /dev/null";
+
+    counter_t counter = {0};
+    pipeline_options_t options = {
+        .queue_size = queue_size,
+        .plugin_dir = o->dir,
+        .no_optimize = !o->optimize,
+        .stage_output_fd = null_fd,
+        .on_result = count_result,
+        .result_ctx = &counter,
+        .metrics = o->latency,
+    };
+    pipeline_t *p = NULL;
+    unsigned long long created = bench_now_ns(); // this process loads the chain for the first time
+    const char *err = pipeline_create(&p, chain, stages, &options);
+    if (err)
+    {
+        close(null_fd);
+        return err;
+    }
+
+    unsigned long long start = bench_now_ns();
+    for (unsigned long long i = 0; !err && i < in->count; ++i)
+        err = pipeline_push(p, in->data + in->offsets[i], in->lengths[i]);
+    if (!err)
+        err = pipeline_flush(p);
+    unsigned long long elapsed = bench_now_ns() - start;
+
+    if (!err && atomic_load(&counter.lines) != in->count)
+        err = "results went missing";
+    if (!err)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        double seconds = (double)elapsed / 1e9;
+        double lines_per_sec = seconds > 0 ? (double)in->count / seconds : 0.0;
+        double mb_per_sec = seconds > 0 ? (double)in->bytes / seconds / 1e6 : 0.0;
+        bench_percentiles_t e2e = o->latency ? latency_of(p, -1) : (bench_percentiles_t){0};
+        double first_line_ms = (double)(atomic_load(&counter.first_ns) - created) / 1e6;
+
+        fprintf(out, "\n    {\"id\": \"%s\", \"name\": \"pipeline\", \"stages\": %d, \"queue_size\": %d, "
+                     "\"lines\": %llu, \"bytes\": %llu, \"bytes_out\": %llu, \"seconds\": %.6f, "
+                     "\"lines_per_sec\": %.1f, \"mb_per_sec\": %.3f, \"peak_rss_kb\": %ld, \"first_line_ms\": %.3f, "
+                     "\"instrumented\": %s",
+                id, pipeline_stage_count(p), queue_size, in->count, in->bytes, (unsigned long long)atomic_load(&counter.bytes),
+                seconds, lines_per_sec, mb_per_sec, usage.ru_maxrss, first_line_ms, o->latency ? "true" : "false");
+        if (o->latency)
+        {
+            fputs(", ", out);
+            bench_json_percentiles(out, "latency_ns", &e2e);
+            fputs(", \"stage_latency_ns\": [", out);
+            for (int i = 0; i < pipeline_stage_count(p); ++i)
+            {
+                pipeline_stage_stats_t stats = {0};
+                pipeline_stage_stats(p, i, &stats);
+                bench_percentiles_t stage = latency_of(p, i);
+                fprintf(out, "%s{\"stage\": \"%s\", ", i ? ", " : "", stats.name ? stats.name : "");
+                bench_json_percentiles(out, "ns", &stage);
+                fputc('}', out);
+            }
+            fputc(']', out);
+        }
+        fputc('}', out);
+        if (o->latency)
+            fprintf(stderr, "[bench] %-48s %10.0f lines/s %8.1f MB/s %8ld KB rss %7.2f ms first  p50 %8.0f ns p99 %10.0f ns\n",
+                    id, lines_per_sec, mb_per_sec, usage.ru_maxrss, first_line_ms, e2e.p50, e2e.p99);
+        else
+            fprintf(stderr, "[bench] %-48s %10.0f lines/s %8.1f MB/s %8ld KB rss %7.2f ms first\n",
+                    id, lines_per_sec, mb_per_sec, usage.ru_maxrss, first_line_ms);
+    }
+
+    const char *destroy_err = pipeline_destroy(p);
+    close(null_fd);
+    return err ? err : destroy_err;
+}
+
+// fork, run the configuration in the child, append what it printed to out
+static const char *run_isolated(FILE *out, int *first, const input_t *in, const options_t *o, int stages, int queue_size)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return "pipe failed";
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return "fork failed";
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        FILE *result = fdopen(fds[1], "w");
+        const char *err = result ? run_config(result, in, o, stages, queue_size) : "fdopen failed";
+        if (err)
+            fprintf(stderr, "analyzer_bench: %d stages, queue %d: %s\n", stages, queue_size, err);
+        if (result)
+            fclose(result);
+        _exit(err ? 1 : 0);
+    }
+
+    close(fds[1]);
+    char *text = NULL;
+    size_t len = 0, cap = 0;
+    for (;;)
+    {
+        if (len + 4096 > cap)
+        {
+            char *grown = realloc(text, cap = cap ? cap * 2 : 8192);
+            if (!grown)
+                break;
+            text = grown;
+        }
+        ssize_t n = read(fds[0], text + len, cap - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+    }
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    const char *err = NULL;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        err = "configuration failed";
+    else if (!text)
+        err = "out of memory";
+    else
+    {
+        fprintf(out, "%s%.*s", *first ? "" : ",", (int)len, text);
+        *first = 0;
+    }
+    free(text);
+    return err;
+}
+
+// ---------------------------------------------- options ----------------------------------------------
+
+// "1,2,4" -> values, every one in 1 .. max
+static int parse_int_list(const char *text, int *values, int max)
+{
+    int count = 0;
+    const char *at = text;
+    while (*at)
+    {
+        char *end = NULL;
+        long v = strtol(at, &end, 10);
+        if (end == at || v < 1 || v > max || count == MAX_LIST || (*end != ',' && *end != '\0'))
+            return -1;
+        values[count++] = (int)v;
+        at = *end ? end + 1 : end;
+    }
+    return count ? count : -1;
+}
+
+// "a,b,c" -> names (the string is split in place)
+static int parse_name_list(char *text, const char **names)
+{
+    int count = 0;
+    for (char *save = NULL, *name = strtok_r(text, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        if (count == MAX_LIST)
+            return -1;
+        names[count++] = name;
+    }
+    return count ? count : -1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --dir DIR            Where the plugin .so files are (default: %s)\n"
+            "  --lines N            Lines of generated input (default: %llu)\n"
+            "  --length N           Mean line length in bytes (default: %llu)\n"
+            "  --dist D             Line lengths: fixed, uniform (1 .. 2N-1) or exp (default: uniform)\n"
+            "  --utf8 PCT           Percent of the characters that are multi-byte UTF-8 (default: 0)\n"
+            "  --chain A,B,...      Plugins, repeated to fill every stage count (default: %s)\n"
+            "  --stages N,...       Chain lengths to run (default: %s)\n"
+            "  --queue-sizes N,...  Queue sizes to run (default: %s)\n"
+            "  --optimize           Let the chain optimizer merge stages (default: run the chain as written)\n"
+            "  --latency            Also report latency percentiles (instruments the pipeline: lower lines/s)\n"
+            "  --out FILE           Write the JSON results to FILE instead of stdout\n",
+            prog, DEFAULT_DIR, DEFAULT_LINES, DEFAULT_LENGTH, DEFAULT_CHAIN, DEFAULT_STAGES, DEFAULT_QUEUE_SIZES);
+}
+
+int main(int argc, char **argv)
+{
+    static char default_chain[] = DEFAULT_CHAIN;
+    options_t o = {.dir = DEFAULT_DIR, .lines = DEFAULT_LINES, .length = DEFAULT_LENGTH, .dist = DIST_UNIFORM};
+    o.chain_count = parse_name_list(default_chain, o.chain);
+    o.stages_count = parse_int_list(DEFAULT_STAGES, o.stages, MAX_LIST * MAX_LIST);
+    o.queue_sizes_count = parse_int_list(DEFAULT_QUEUE_SIZES, o.queue_sizes, 1 << 20);
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int ok = 1;
+        if (strcmp(argv[i], "--optimize") == 0)
+            o.optimize = 1;
+        else if (strcmp(argv[i], "--latency") == 0)
+            o.latency = 1;
+        else if (!value)
+            ok = 0;
+        else
+        {
+            ++i;
+            if (strcmp(argv[i - 1], "--dir") == 0)
+                o.dir = value;
+            else if (strcmp(argv[i - 1], "--out") == 0)
+                out_path = value;
+            else if (strcmp(argv[i - 1], "--lines") == 0)
+                ok = bench_parse_count(value, &o.lines) == 0;
+            else if (strcmp(argv[i - 1], "--length") == 0)
+                ok = bench_parse_count(value, &o.length) == 0 && o.length <= MAX_LINE;
+            else if (strcmp(argv[i - 1], "--utf8") == 0)
+            {
+                char *end = NULL;
+                long percent = strtol(value, &end, 10);
+                ok = *value && *end == '\0' && percent >= 0 && percent <= 100;
+                o.utf8_percent = (int)percent;
+            }
+            else if (strcmp(argv[i - 1], "--dist") == 0)
+            {
+                ok = 0;
+                for (int d = 0; d < 3; ++d)
+                    if (strcmp(value, k_dist_names[d]) == 0)
+                    {
+                        o.dist = (length_dist_t)d;
+                        ok = 1;
+                    }
+            }
+            else if (strcmp(argv[i - 1], "--chain") == 0)
+                ok = (o.chain_count = parse_name_list(argv[i], o.chain)) > 0;
+            else if (strcmp(argv[i - 1], "--stages") == 0)
+                ok = (o.stages_count = parse_int_list(value, o.stages, MAX_LIST * MAX_LIST)) > 0;
+            else if (strcmp(argv[i - 1], "--queue-sizes") == 0)
+                ok = (o.queue_sizes_count = parse_int_list(value, o.queue_sizes, 1 << 20)) > 0;
+            else
+                ok = 0;
+        }
+        if (!ok)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    input_t in;
+    const char *err = generate_input(&in, &o);
+    if (err)
+    {
+        fprintf(stderr, "analyzer_bench: %s\n", err);
+        free_input(&in);
+        return 1;
+    }
+    FILE *out = bench_open_output(out_path);
+    if (!out)
+    {
+        fprintf(stderr, "cannot open '%s': %s\n", out_path, strerror(errno));
+        free_input(&in);
+        return 1;
+    }
+
+    fprintf(out, "{\"suite\": \"pipeline\", \"lines\": %llu, \"input_bytes\": %llu, \"length\": %llu, "
+                 "\"dist\": \"%s\", \"utf8_percent\": %d, \"results\": [",
+            in.count, in.bytes, o.length, k_dist_names[o.dist], o.utf8_percent);
+    int first = 1;
+    for (int s = 0; !err && s < o.stages_count; ++s)
+        for (int q = 0; !err && q < o.queue_sizes_count; ++q)
+            err = run_isolated(out, &first, &in, &o, o.stages[s], o.queue_sizes[q]);
+    fputs("\n]}\n", out);
+    if (out != stdout)
+        fclose(out);
+    free_input(&in);
+
+    if (err)
+    {
+        fprintf(stderr, "analyzer_bench: %s\n", err);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+unsigned long long bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank: the smallest sample with at least q of all samples at or below it
+static double rank(const unsigned long long *sorted, size_t count, double q)
+{
+    size_t index = (size_t)(q * (double)count + 0.999999);
+    return (double)sorted[index == 0 ? 0 : (index > count ? count : index) - 1];
+}
+
+bench_percentiles_t bench_percentiles(unsigned long long *samples, size_t count)
+{
+    bench_percentiles_t p = {0};
+    if (count == 0)
+        return p;
+    qsort(samples, count, sizeof(samples[0]), compare_samples);
+    p.p50 = rank(samples, count, 0.50);
+    p.p90 = rank(samples, count, 0.90);
+    p.p99 = rank(samples, count, 0.99);
+    p.p999 = rank(samples, count, 0.999);
+    p.max = (double)samples[count - 1];
+    return p;
+}
+
+void bench_json_percentiles(FILE *out, const char *key, const bench_percentiles_t *p)
+{
+    fprintf(out, "\"%s\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+            key, p->p50, p->p90, p->p99, p->p999, p->max);
+}
+
+unsigned int bench_random(unsigned int *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 16) & 0x7fffu;
+}
+
+void bench_fill_line(char *line, size_t len, int utf8_percent, unsigned int *state)
+{
+    static const char ascii[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,;:!?-";
+    static const char *const multibyte[] = {"\xc3\xa9", "\xc3\x9f", "\xe2\x82\xac", "\xe4\xb8\xad", "\xf0\x9f\x98\x80"};
+    size_t at = 0;
+    while (at < len)
+    {
+        unsigned int r = bench_random(state);
+        if ((int)(r % 100) < utf8_percent)
+        {
+            const char *c = multibyte[bench_random(state) % (sizeof(multibyte) / sizeof(multibyte[0]))];
+            size_t n = strlen(c);
+            if (at + n <= len)
+            {
+                memcpy(line + at, c, n);
+                at += n;
+                continue;
+            }
+        }
+        line[at++] = ascii[bench_random(state) % (sizeof(ascii) - 1)];
+    }
+    line[len] = '\0';
+}
+
+int bench_parse_count(const char *text, unsigned long long *value)
+{
+    char *end = NULL;
+    unsigned long long v = text ? strtoull(text, &end, 10) : 0;
+    if (!text || !*text || *text == '-' || *end != '\0' || v == 0)
+        return -1;
+    *value = v;
+    return 0;
+}
+
+FILE *bench_open_output(const char *path)
+{
+    if (!path || strcmp(path, "-") == 0)
+        return stdout;
+    return fopen(path, "w");
+}
@@ -0,0 +1,75 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h> // size_t
+#include <stdio.h>  // FILE
+
+// Shared pieces of the benchmark tools (./build.sh bench): a clock, percentiles over raw samples and
+// the JSON they all write. Every tool prints one object {"suite": ..., "results": [...]} where each
+// result has a unique "id", so runs can be compared result by result
+
+/** Percentiles of a set of samples, in the samples' unit */
+typedef struct
+{
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+} bench_percentiles_t;
+
+/**
+ * Current time on CLOCK_MONOTONIC
+ * @return Time in ns
+ */
+unsigned long long bench_now_ns(void);
+
+/**
+ * Percentiles of samples (nearest rank), sorts them in place
+ * @param samples The samples
+ * @param count Number of samples, 0 gives all zeros
+ * @return The percentiles
+ */
+bench_percentiles_t bench_percentiles(unsigned long long *samples, size_t count);
+
+/**
+ * Write "key": {"p50": ..., "p90": ..., "p99": ..., "p999": ..., "max": ...}
+ * @param out Where to write
+ * @param key Member name
+ * @param p The percentiles
+ */
+void bench_json_percentiles(FILE *out, const char *key, const bench_percentiles_t *p);
+
+/**
+ * Next value of a small deterministic generator (same seed, same input on every run)
+ * @param state Generator state, seeded by the caller
+ * @return 0 .. 32767
+ */
+unsigned int bench_random(unsigned int *state);
+
+/**
+ * Fill a line of exactly len bytes plus NUL: ASCII letters of both cases, digits, spaces and punctuation,
+ * with utf8_percent of the characters 2, 3 and 4 byte UTF-8 (é ß € 中 😀) where they still fit
+ * @param line Receives the line, len + 1 bytes
+ * @param len Length without the NUL
+ * @param utf8_percent 0 .. 100
+ * @param state Generator state, see bench_random
+ */
+void bench_fill_line(char *line, size_t len, int utf8_percent, unsigned int *state);
+
+/**
+ * Parse a positive count option value (e.g. --ops 1000)
+ * @param text The value
+ * @param value Receives the count
+ * @return 0 on success, -1 when text is not a number greater than 0
+ */
+int bench_parse_count(const char *text, unsigned long long *value);
+
+/**
+ * Open --out FILE, or stdout for NULL or "-"
+ * @param path The path
+ * @return The stream, NULL on failure (errno set)
+ */
+FILE *bench_open_output(const char *path);
+
+#endif // BENCH_UTIL_H
@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+"""Benchmark regression gate (needs ./build.sh bench).
+
+Runs the benchmark tools in output/bench with fixed arguments --runs times and compares every tracked
+metric with bench/baseline.json. Both sides are the median of their runs. A metric regresses when its
+median is worse than the baseline's by more than its tolerance, or by more than the run-to-run spread
+(max - min of the runs, relative to their median) of either side when that is larger: some cases land in
+one of two speeds per process, their median can only be trusted to move within that range. Suites with a regression run --runs times more
+and only what still regresses over all their runs counts; the exit status is then 1.
+
+--update records the medians, their spread, the hot-path sources they were measured with and the
+host as the new baseline, keeping the metric settings. Numbers from another host say nothing about
+this one, so a baseline recorded elsewhere is not compared against (exit 2, --any-host overrides).
+
+--if-changed only runs when a watched source (consumer_producer.c, plugin_common.c) differs from the
+one the baseline was recorded with and the baseline is from this host, so test.sh can call it on
+every run.
+"""
+import argparse
+import hashlib
+import json
+import os
+import platform
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BENCH_DIR = os.path.join(ROOT, "output", "bench")
+DEFAULT_BASELINE = os.path.join(ROOT, "bench", "baseline.json")
+
+# the suite: fixed arguments, so the numbers stay comparable with the baseline. The pipeline runs
+# uninstrumented (no --latency): the gate is about the throughput of the shipped pipeline
+SUITES = {
+    "queue": ["queue_bench", "--ops", "20000"],
+    "transform": ["transform_bench", "--dir", os.path.join(ROOT, "output"), "--bytes", "1048576", "--rounds", "7"],
+    "pipeline": ["analyzer_bench", "--dir", os.path.join(ROOT, "output"), "--lines", "50000",
+                 "--stages", "1,4", "--queue-sizes", "1,64"],
+}
+
+# used when there is no baseline yet, afterwards the baseline's own settings apply
+DEFAULT_METRICS = {
+    "ops_per_sec": {"better": "higher", "tolerance": 0.15},
+    "round_trip_ns.p50": {"better": "lower", "tolerance": 0.15},
+    "gb_per_sec": {"better": "higher", "tolerance": 0.20},
+    "lines_per_sec": {"better": "higher", "tolerance": 0.10},
+    "peak_rss_kb": {"better": "lower", "tolerance": 0.10},
+}
+DEFAULT_WATCH = ["plugins/sync/consumer_producer.c", "plugins/plugin_common.c"]
+
+
+def metric_value(result, name):
+    """'a.b' reads result['a']['b'], None when the result has no such metric"""
+    value = result
+    for part in name.split("."):
+        if not isinstance(value, dict) or part not in value:
+            return None
+        value = value[part]
+    return value if isinstance(value, (int, float)) and not isinstance(value, bool) else None
+
+
+def source_hashes(watch):
+    hashes = {}
+    for path in watch:
+        try:
+            with open(os.path.join(ROOT, path), "rb") as f:
+                hashes[path] = hashlib.sha256(f.read()).hexdigest()
+        except OSError:
+            hashes[path] = None
+    return hashes
+
+
+def host_fingerprint():
+    """what the numbers depend on: CPU model and count, architecture and OS"""
+    cpu = ""
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    cpu = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {"system": platform.system(), "machine": platform.machine(), "cpus": os.cpu_count(), "cpu": cpu}
+
+
+def run_suite(name):
+    args = list(SUITES[name])
+    tool = os.path.join(BENCH_DIR, args[0])
+    if not os.access(tool, os.X_OK):
+        sys.exit("compare.py: %s not found, run ./build.sh bench first" % tool)
+    proc = subprocess.run([tool] + args[1:], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, cwd=ROOT)
+    if proc.returncode != 0:
+        sys.exit("compare.py: %s failed (exit %d)" % (args[0], proc.returncode))
+    return json.loads(proc.stdout)
+
+
+def median(values):
+    values = sorted(values)
+    mid = len(values) // 2
+    return values[mid] if len(values) % 2 else (values[mid - 1] + values[mid]) / 2.0
+
+
+def collect(docs, metrics):
+    """{suite: {id: {metric: {"median": m, "spread": s}}}} over several runs, s is (max - min) / m"""
+    samples = {}
+    for doc in docs:
+        suite = samples.setdefault(doc["suite"], {})
+        for result in doc["results"]:
+            values = suite.setdefault(result["id"], {})
+            for name in metrics:
+                value = metric_value(result, name)
+                if value is not None:
+                    values.setdefault(name, []).append(value)
+
+    collected = {}
+    for suite, results in samples.items():
+        for result_id, values in results.items():
+            for name, runs in values.items():
+                m = median(runs)
+                spread = (max(runs) - min(runs)) / m if m else 0.0
+                collected.setdefault(suite, {}).setdefault(result_id, {})[name] = {"median": m, "spread": round(spread, 4)}
+    return collected
+
+
+def compare(current, baseline, metrics, report=True):
+    """Print one line per regression (and per result missing from this run) when report is set, return the
+    suites they are in"""
+    regressions = []
+    for suite, results in sorted(baseline.items()):
+        for result_id, values in sorted(results.items()):
+            now = current.get(suite, {}).get(result_id)
+            if now is None:
+                if suite in current:
+                    if report:
+                        print("MISSING    %s" % result_id)
+                    regressions.append(suite)
+                continue
+            for name, base in sorted(values.items()):
+                setting = metrics.get(name)
+                if setting is None or name not in now or not base["median"]:
+                    continue
+                value = now[name]["median"]
+                change = (value - base["median"]) / base["median"]
+                worse = -change if setting["better"] == "higher" else change
+                allowed = max(setting["tolerance"], max(base["spread"], now[name]["spread"]))
+                if worse > allowed:
+                    regressions.append(suite)
+                    if report:
+                        print("REGRESSION %-52s %-18s %14.1f -> %14.1f (%+.0f%%, allowed %.0f%%)"
+                              % (result_id, name, base["median"], value, change * 100, allowed * 100))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the benchmarks and compare them with a stored baseline")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE, help="baseline file (default: bench/baseline.json)")
+    parser.add_argument("--update", action="store_true", help="store this run as the new baseline")
+    parser.add_argument("--runs", type=int, default=5, help="runs per suite, the median of each metric counts")
+    parser.add_argument("--suite", action="append", choices=sorted(SUITES), help="only this suite (repeatable)")
+    parser.add_argument("--results", nargs="+", metavar="FILE",
+                        help="compare these benchmark JSON files (one per run) instead of running the suite")
+    parser.add_argument("--if-changed", action="store_true",
+                        help="do nothing unless a watched hot-path source differs from the baseline's")
+    parser.add_argument("--any-host", action="store_true", help="compare even with a baseline from another host")
+    args = parser.parse_args()
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    metrics = baseline.get("metrics", DEFAULT_METRICS)
+    watch = baseline.get("watch", DEFAULT_WATCH)
+
+    if not args.update:
+        if not baseline.get("results"):
+            sys.exit("compare.py: no baseline in %s, create one with --update" % args.baseline)
+        if baseline.get("host") != host_fingerprint() and not args.any_host:
+            print("compare.py: the baseline was recorded on another host (%s), record one here with --update"
+                  % baseline.get("host"))
+            return 0 if args.if_changed else 2
+        if args.if_changed:
+            changed = [p for p, h in source_hashes(watch).items() if baseline.get("sources", {}).get(p) != h]
+            if not changed:
+                print("compare.py: hot path unchanged since the baseline, nothing to check")
+                return 0
+            print("compare.py: changed since the baseline: %s" % ", ".join(changed))
+
+    if args.results:
+        docs = []
+        for path in args.results:
+            with open(path) as f:
+                docs.append(json.load(f))
+    else:
+        suites = args.suite or sorted(SUITES)
+        docs = [run_suite(name) for _ in range(max(args.runs, 1)) for name in suites]
+    current = collect(docs, metrics)
+
+    if args.update:
+        results = dict(baseline.get("results", {}))
+        results.update(current)
+        stored = {"metrics": metrics, "watch": watch, "sources": source_hashes(watch), "host": host_fingerprint(),
+                  "results": results}
+        with open(args.baseline, "w") as f:
+            json.dump(stored, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("compare.py: baseline %s updated (%s)" % (args.baseline, ", ".join(sorted(current))))
+        return 0
+
+    regressions = compare(current, baseline["results"], metrics, report=bool(args.results))
+    if regressions and not args.results:
+        # a regression has to show again in as many runs more, against the median of all of them: a single
+        # slow set of runs on a busy host does not fail the gate
+        suites = sorted(set(regressions))
+        print("compare.py: confirming %s" % ", ".join(suites))
+        docs += [run_suite(name) for _ in range(max(args.runs, 1)) for name in suites]
+        current = collect(docs, metrics)
+        regressions = compare(current, baseline["results"], metrics)
+    regressions = len(regressions)
+    checked = sum(len(v) for s in current.values() for v in s.values())
+    print("compare.py: %d metrics checked, %d regressions" % (checked, regressions))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
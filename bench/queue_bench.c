@@ -0,0 +1,334 @@
+// Microbenchmarks of the queue and monitor primitives every stage runs on (./build.sh bench):
+//   put_get    - P producers and C consumers moving items through one consumer_producer_t, for several
+//                thread mixes, capacities and item sizes. ops/s is items through per second, the ns
+//                percentiles are single put / get calls (clock reads included, ~20 ns)
+//   ping_pong  - two threads bouncing through two monitors (signal, wait, reset): the round trip
+// Writes JSON (see bench_util.h), a one-line summary per result goes to stderr
+#include "bench_util.h"
+#include "consumer_producer.h"
+#include "monitor.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define DEFAULT_OPS 100000ULL
+#define MAX_THREADS 8
+
+typedef struct
+{
+    int producers;
+    int consumers;
+    int capacity;
+    size_t item_bytes;
+} put_get_config_t;
+
+// the mixes asked for: 1:1, N:1, 1:N and N:M
+static const int k_mixes[][2] = {{1, 1}, {4, 1}, {1, 4}, {4, 4}};
+static const int k_capacities[] = {1, 64, 1024};
+static const size_t k_item_bytes[] = {16, 4096};
+
+// ---------------------------------------------- put / get ----------------------------------------------
+
+typedef struct
+{
+    consumer_producer_t *queue;
+    const char *item;            // what producers put
+    unsigned long long ops;      // this producer's share
+    atomic_ullong *taken;        // consumers claim an item before getting it, so exactly total gets happen
+    unsigned long long total;    // items over all producers
+    unsigned long long *samples; // ns per call
+    size_t count;                // samples taken
+    const char *error;
+} worker_t;
+
+static void *producer_thread(void *arg)
+{
+    worker_t *w = arg;
+    for (unsigned long long i = 0; i < w->ops; ++i)
+    {
+        unsigned long long start = bench_now_ns();
+        const char *err = consumer_producer_put(w->queue, w->item);
+        w->samples[w->count++] = bench_now_ns() - start;
+        if (err)
+        {
+            w->error = err;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void *consumer_thread(void *arg)
+{
+    worker_t *w = arg;
+    while (atomic_fetch_add(w->taken, 1) < w->total)
+    {
+        unsigned long long start = bench_now_ns();
+        char *item = consumer_producer_get(w->queue);
+        w->samples[w->count++] = bench_now_ns() - start;
+        if (!item)
+        {
+            w->error = "get failed";
+            break;
+        }
+        free(item);
+    }
+    return NULL;
+}
+
+// every worker's samples in one array (the workers' arrays are freed)
+static unsigned long long *gather_samples(worker_t *workers, int n, size_t *count)
+{
+    size_t total = 0;
+    for (int i = 0; i < n; ++i)
+        total += workers[i].count;
+    unsigned long long *all = malloc((total ? total : 1) * sizeof(*all));
+    size_t at = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if (all)
+            memcpy(all + at, workers[i].samples, workers[i].count * sizeof(*all));
+        at += workers[i].count;
+        free(workers[i].samples);
+    }
+    *count = total;
+    return all;
+}
+
+static const char *run_put_get(FILE *out, int *first, const put_get_config_t *cfg, unsigned long long ops)
+{
+    consumer_producer_t queue;
+    const char *err = consumer_producer_init(&queue, cfg->capacity);
+    if (err)
+        return err;
+
+    char *item = malloc(cfg->item_bytes + 1);
+    if (!item)
+    {
+        consumer_producer_destroy(&queue);
+        return "out of memory";
+    }
+    memset(item, 'x', cfg->item_bytes);
+    item[cfg->item_bytes] = '\0';
+
+    // every producer puts the same share, the total is what they put together
+    unsigned long long per_producer = ops >= (unsigned long long)cfg->producers ? ops / (unsigned long long)cfg->producers : 1;
+    unsigned long long total = per_producer * (unsigned long long)cfg->producers;
+    atomic_ullong taken = 0;
+    worker_t producers[MAX_THREADS] = {0}, consumers[MAX_THREADS] = {0};
+    pthread_t threads[2 * MAX_THREADS];
+    int started = 0;
+
+    for (int i = 0; i < cfg->producers; ++i)
+        producers[i] = (worker_t){.queue = &queue, .item = item, .ops = per_producer, .samples = malloc(per_producer * sizeof(unsigned long long))};
+    for (int i = 0; i < cfg->consumers; ++i)
+        consumers[i] = (worker_t){.queue = &queue, .taken = &taken, .total = total, .samples = malloc(total * sizeof(unsigned long long))};
+    for (int i = 0; i < cfg->producers; ++i)
+        if (!producers[i].samples)
+            err = "out of memory";
+    for (int i = 0; i < cfg->consumers; ++i)
+        if (!consumers[i].samples)
+            err = "out of memory";
+
+    unsigned long long start = bench_now_ns();
+    for (int i = 0; !err && i < cfg->consumers; ++i)
+        if (pthread_create(&threads[started], NULL, consumer_thread, &consumers[i]) == 0)
+            ++started;
+        else
+            err = "pthread_create failed";
+    for (int i = 0; !err && i < cfg->producers; ++i)
+        if (pthread_create(&threads[started], NULL, producer_thread, &producers[i]) == 0)
+            ++started;
+        else
+            err = "pthread_create failed";
+    // consumers that started wait for items nobody will put: one more get each, then they stop
+    if (err)
+    {
+        atomic_store(&taken, total);
+        for (int i = 0; i < cfg->consumers; ++i)
+            consumer_producer_put(&queue, item);
+    }
+    for (int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    unsigned long long elapsed = bench_now_ns() - start;
+
+    for (int i = 0; !err && i < cfg->producers; ++i)
+        err = producers[i].error;
+    for (int i = 0; !err && i < cfg->consumers; ++i)
+        err = consumers[i].error;
+
+    size_t put_count, get_count;
+    unsigned long long *put_samples = gather_samples(producers, cfg->producers, &put_count);
+    unsigned long long *get_samples = gather_samples(consumers, cfg->consumers, &get_count);
+    if (!err && (!put_samples || !get_samples))
+        err = "out of memory";
+
+    if (!err)
+    {
+        char id[96];
+        snprintf(id, sizeof(id), "put_get/%dp%dc/cap%d/%zuB", cfg->producers, cfg->consumers, cfg->capacity, cfg->item_bytes);
+        double seconds = (double)elapsed / 1e9;
+        double ops_per_sec = seconds > 0 ? (double)total / seconds : 0.0;
+        bench_percentiles_t put = bench_percentiles(put_samples, put_count);
+        bench_percentiles_t get = bench_percentiles(get_samples, get_count);
+
+        fprintf(out, "%s\n    {\"id\": \"%s\", \"name\": \"put_get\", \"producers\": %d, \"consumers\": %d, \"capacity\": %d, "
+                     "\"item_bytes\": %zu, \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, ",
+                *first ? "" : ",", id, cfg->producers, cfg->consumers, cfg->capacity, cfg->item_bytes, total, seconds, ops_per_sec);
+        bench_json_percentiles(out, "put_ns", &put);
+        fputs(", ", out);
+        bench_json_percentiles(out, "get_ns", &get);
+        fputc('}', out);
+        *first = 0;
+        fprintf(stderr, "[bench] %-28s %12.0f ops/s  put p50 %8.0f ns p99 %8.0f ns  get p50 %8.0f ns p99 %8.0f ns\n",
+                id, ops_per_sec, put.p50, put.p99, get.p50, get.p99);
+    }
+
+    free(put_samples);
+    free(get_samples);
+    free(item);
+    consumer_producer_destroy(&queue);
+    return err;
+}
+
+// ---------------------------------------------- monitor ping-pong ----------------------------------------------
+
+typedef struct
+{
+    monitor_t ping;
+    monitor_t pong;
+    unsigned long long rounds;
+} ping_pong_t;
+
+// the far side: wait for ping, re-arm it, answer with pong
+static void *pong_thread(void *arg)
+{
+    ping_pong_t *pp = arg;
+    for (unsigned long long i = 0; i < pp->rounds; ++i)
+    {
+        if (monitor_wait(&pp->ping) != 0)
+            break;
+        monitor_reset(&pp->ping);
+        monitor_signal(&pp->pong);
+    }
+    return NULL;
+}
+
+static const char *run_ping_pong(FILE *out, int *first, unsigned long long rounds)
+{
+    ping_pong_t pp = {.rounds = rounds};
+    if (monitor_init(&pp.ping) != 0)
+        return "monitor_init failed";
+    if (monitor_init(&pp.pong) != 0)
+    {
+        monitor_destroy(&pp.ping);
+        return "monitor_init failed";
+    }
+    unsigned long long *samples = malloc(rounds * sizeof(*samples));
+    pthread_t thread;
+    const char *err = NULL;
+    if (!samples)
+        err = "out of memory";
+    else if (pthread_create(&thread, NULL, pong_thread, &pp) != 0)
+        err = "pthread_create failed";
+
+    if (!err)
+    {
+        unsigned long long start = bench_now_ns();
+        for (unsigned long long i = 0; i < rounds; ++i)
+        {
+            unsigned long long t0 = bench_now_ns();
+            monitor_signal(&pp.ping);
+            if (monitor_wait(&pp.pong) != 0)
+            {
+                err = "monitor_wait failed";
+                break;
+            }
+            monitor_reset(&pp.pong); // before the next ping, the answer to it can only come after
+            samples[i] = bench_now_ns() - t0;
+        }
+        unsigned long long elapsed = bench_now_ns() - start;
+        if (err) // let the other side finish its rounds
+            for (unsigned long long i = 0; i < rounds; ++i)
+                monitor_signal(&pp.ping);
+        pthread_join(thread, NULL);
+
+        if (!err)
+        {
+            double seconds = (double)elapsed / 1e9;
+            double ops_per_sec = seconds > 0 ? (double)rounds / seconds : 0.0;
+            bench_percentiles_t rt = bench_percentiles(samples, rounds);
+            fprintf(out, "%s\n    {\"id\": \"ping_pong\", \"name\": \"ping_pong\", \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, ",
+                    *first ? "" : ",", rounds, seconds, ops_per_sec);
+            bench_json_percentiles(out, "round_trip_ns", &rt);
+            fputc('}', out);
+            *first = 0;
+            fprintf(stderr, "[bench] %-28s %12.0f ops/s  round trip p50 %8.0f ns p99 %8.0f ns\n", "ping_pong", ops_per_sec, rt.p50, rt.p99);
+        }
+    }
+
+    free(samples);
+    monitor_destroy(&pp.ping);
+    monitor_destroy(&pp.pong);
+    return err;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--ops N] [--out FILE]\n"
+            "  --ops N     Items per put_get run and round trips of ping_pong (default: %llu)\n"
+            "  --out FILE  Write the JSON results to FILE instead of stdout\n",
+            prog, DEFAULT_OPS);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long ops = DEFAULT_OPS;
+    const char *out_path = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc && bench_parse_count(argv[i + 1], &ops) == 0)
+            ++i;
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *out = bench_open_output(out_path);
+    if (!out)
+    {
+        fprintf(stderr, "cannot open '%s': %s\n", out_path, strerror(errno));
+        return 1;
+    }
+
+    int first = 1;
+    const char *err = NULL;
+    fprintf(out, "{\"suite\": \"queue\", \"ops\": %llu, \"results\": [", ops);
+    for (size_t m = 0; !err && m < sizeof(k_mixes) / sizeof(k_mixes[0]); ++m)
+        for (size_t c = 0; !err && c < sizeof(k_capacities) / sizeof(k_capacities[0]); ++c)
+            for (size_t b = 0; !err && b < sizeof(k_item_bytes) / sizeof(k_item_bytes[0]); ++b)
+            {
+                put_get_config_t cfg = {k_mixes[m][0], k_mixes[m][1], k_capacities[c], k_item_bytes[b]};
+                err = run_put_get(out, &first, &cfg, ops);
+            }
+    if (!err)
+        err = run_ping_pong(out, &first, ops);
+    fputs("\n]}\n", out);
+    if (out != stdout)
+        fclose(out);
+
+    if (err)
+    {
+        fprintf(stderr, "queue_bench: %s\n", err);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,251 @@
+// Transform throughput of each plugin alone (./build.sh bench): loads <dir>/<name>.so, starts it like the
+// analyzer does and calls plugin_process on this thread, so no queue, no thread hand-off and no copy into
+// the next stage is measured. Together with queue_bench this tells transform cost from plumbing cost.
+// Every plugin runs over lines of 8 B .. 64 KB, ASCII and UTF-8 (half the characters multi-byte).
+// The logger's output goes to /dev/null through the host output service
+// Writes JSON (see bench_util.h), a one-line summary per result goes to stderr
+#include "bench_util.h"
+#include "plugin_sdk.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_DIR "./output"
+#define DEFAULT_BYTES (4ULL * 1024 * 1024) // input per round and case
+#define DEFAULT_ROUNDS 5ULL
+#define POOL_LINES 64 // distinct lines per case, cycled through
+
+static const char *const k_plugins[] = {"uppercaser", "flipper", "rotator", "expander", "logger"};
+static const size_t k_line_bytes[] = {8, 64, 512, 4096, 65536};
+static const char *const k_charsets[] = {"ascii", "utf8"};
+
+typedef const char *(*plugin_init_func_t)(int queue_size);
+typedef const char *(*plugin_fini_func_t)(void);
+typedef const char *(*plugin_place_work_func_t)(const char *str);
+typedef const char *(*plugin_wait_finished_func_t)(void);
+typedef const char *(*plugin_set_host_func_t)(const plugin_host_t *host);
+typedef const char *(*plugin_process_func_t)(const char *str, const char **out);
+
+typedef struct
+{
+    void *handle;
+    plugin_init_func_t init;
+    plugin_fini_func_t fini;
+    plugin_place_work_func_t place_work;
+    plugin_wait_finished_func_t wait_finished;
+    plugin_set_host_func_t set_host; // optional
+    plugin_process_func_t process;
+} plugin_t;
+
+// ---------------------------------------------- host: stage output to /dev/null ----------------------------------------------
+
+static int g_null_fd = -1;
+
+static void null_writev(const void *source, const struct iovec *iov, int iovcnt)
+{
+    (void)source;
+    while (writev(g_null_fd, iov, iovcnt) < 0 && errno == EINTR)
+        ;
+}
+
+static const plugin_host_t k_host = {.size = sizeof(plugin_host_t), .output_writev = null_writev};
+
+// ---------------------------------------------- plugins ----------------------------------------------
+
+static const char *load_plugin(plugin_t *plugin, const char *dir, const char *name)
+{
+    static char error[4096 + 512];
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.so", dir, name);
+
+    *plugin = (plugin_t){0};
+    plugin->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!plugin->handle)
+    {
+        snprintf(error, sizeof(error), "dlopen(%s): %s", path, dlerror());
+        return error;
+    }
+    *(void **)(&plugin->init) = dlsym(plugin->handle, "plugin_init");
+    *(void **)(&plugin->fini) = dlsym(plugin->handle, "plugin_fini");
+    *(void **)(&plugin->place_work) = dlsym(plugin->handle, "plugin_place_work");
+    *(void **)(&plugin->wait_finished) = dlsym(plugin->handle, "plugin_wait_finished");
+    *(void **)(&plugin->set_host) = dlsym(plugin->handle, "plugin_set_host");
+    *(void **)(&plugin->process) = dlsym(plugin->handle, "plugin_process");
+    if (!plugin->init || !plugin->fini || !plugin->place_work || !plugin->wait_finished || !plugin->process)
+    {
+        snprintf(error, sizeof(error), "%s lacks a required symbol (plugin_process needs a current build)", path);
+        dlclose(plugin->handle);
+        plugin->handle = NULL;
+        return error;
+    }
+
+    const char *err = plugin->set_host ? plugin->set_host(&k_host) : NULL;
+    if (!err)
+        err = plugin->init(POOL_LINES);
+    if (err)
+    {
+        dlclose(plugin->handle);
+        plugin->handle = NULL;
+    }
+    return err;
+}
+
+// shut down like the analyzer: <END> through the (idle) stage thread, then fini
+static const char *unload_plugin(plugin_t *plugin)
+{
+    const char *err = plugin->place_work("<END>");
+    if (!err)
+        err = plugin->wait_finished();
+    const char *fini_err = plugin->fini();
+    dlclose(plugin->handle);
+    plugin->handle = NULL;
+    return err ? err : fini_err;
+}
+
+// ---------------------------------------------- one case ----------------------------------------------
+
+static int compare_ns(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+static const char *run_case(FILE *out, int *first, plugin_t *plugin, const char *name, size_t line_bytes, int utf8,
+                            unsigned long long budget, unsigned long long rounds)
+{
+    char *pool = malloc(POOL_LINES * (line_bytes + 1));
+    unsigned long long *round_ns = malloc(rounds * sizeof(*round_ns));
+    if (!pool || !round_ns)
+    {
+        free(pool);
+        free(round_ns);
+        return "out of memory";
+    }
+    unsigned int state = (unsigned int)line_bytes * 2u + (unsigned int)utf8;
+    for (int i = 0; i < POOL_LINES; ++i)
+        bench_fill_line(pool + (size_t)i * (line_bytes + 1), line_bytes, utf8 ? 50 : 0, &state);
+
+    // every round pushes budget bytes (at least one line), the output is freed like the stage does
+    unsigned long long lines = budget / line_bytes ? budget / line_bytes : 1;
+    const char *err = NULL;
+    for (unsigned long long r = 0; !err && r < rounds; ++r)
+    {
+        unsigned long long start = bench_now_ns();
+        for (unsigned long long i = 0; i < lines; ++i)
+        {
+            const char *result = NULL;
+            err = plugin->process(pool + (size_t)(i % POOL_LINES) * (line_bytes + 1), &result);
+            if (err)
+                break;
+            free((void *)result);
+        }
+        round_ns[r] = bench_now_ns() - start;
+    }
+
+    if (!err)
+    {
+        // the median round, the others show how steady it was
+        qsort(round_ns, rounds, sizeof(round_ns[0]), compare_ns);
+        double seconds = (double)round_ns[rounds / 2] / 1e9;
+        double bytes = (double)lines * (double)line_bytes;
+        double gb_per_sec = seconds > 0 ? bytes / seconds / 1e9 : 0.0;
+        double ns_per_line = (double)round_ns[rounds / 2] / (double)lines;
+        double best_gb_per_sec = round_ns[0] ? bytes / ((double)round_ns[0] / 1e9) / 1e9 : 0.0;
+
+        char id[96];
+        snprintf(id, sizeof(id), "transform/%s/%s/%zuB", name, k_charsets[utf8], line_bytes);
+        fprintf(out, "%s\n    {\"id\": \"%s\", \"name\": \"transform\", \"plugin\": \"%s\", \"charset\": \"%s\", "
+                     "\"line_bytes\": %zu, \"lines\": %llu, \"rounds\": %llu, \"seconds\": %.6f, "
+                     "\"gb_per_sec\": %.4f, \"best_gb_per_sec\": %.4f, \"ns_per_line\": %.1f}",
+                *first ? "" : ",", id, name, k_charsets[utf8], line_bytes, lines, rounds, seconds,
+                gb_per_sec, best_gb_per_sec, ns_per_line);
+        *first = 0;
+        fprintf(stderr, "[bench] %-34s %8.3f GB/s %12.1f ns/line\n", id, gb_per_sec, ns_per_line);
+    }
+
+    free(pool);
+    free(round_ns);
+    return err;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--dir DIR] [--bytes N] [--rounds N] [--out FILE]\n"
+            "  --dir DIR     Where the plugin .so files are (default: %s)\n"
+            "  --bytes N     Input per round for every plugin, line length and charset (default: %llu)\n"
+            "  --rounds N    Rounds per case, the median is reported (default: %llu)\n"
+            "  --out FILE    Write the JSON results to FILE instead of stdout\n",
+            prog, DEFAULT_DIR, DEFAULT_BYTES, DEFAULT_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = DEFAULT_DIR;
+    const char *out_path = NULL;
+    unsigned long long budget = DEFAULT_BYTES, rounds = DEFAULT_ROUNDS;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc && bench_parse_count(argv[i + 1], &budget) == 0)
+            ++i;
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc && bench_parse_count(argv[i + 1], &rounds) == 0)
+            ++i;
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    g_null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (g_null_fd < 0)
+    {
+        fprintf(stderr, "cannot open /dev/null: %s\n", strerror(errno));
+        return 1;
+    }
+    FILE *out = bench_open_output(out_path);
+    if (!out)
+    {
+        fprintf(stderr, "cannot open '%s': %s\n", out_path, strerror(errno));
+        close(g_null_fd);
+        return 1;
+    }
+
+    int first = 1;
+    const char *err = NULL;
+    const char *failed = NULL;
+    fprintf(out, "{\"suite\": \"transform\", \"bytes\": %llu, \"rounds\": %llu, \"results\": [", budget, rounds);
+    for (size_t p = 0; !err && p < sizeof(k_plugins) / sizeof(k_plugins[0]); ++p)
+    {
+        plugin_t plugin;
+        failed = k_plugins[p];
+        err = load_plugin(&plugin, dir, k_plugins[p]);
+        for (size_t l = 0; !err && l < sizeof(k_line_bytes) / sizeof(k_line_bytes[0]); ++l)
+            for (int utf8 = 0; !err && utf8 <= 1; ++utf8)
+                err = run_case(out, &first, &plugin, k_plugins[p], k_line_bytes[l], utf8, budget, rounds);
+        if (plugin.handle)
+        {
+            const char *unload_err = unload_plugin(&plugin);
+            err = err ? err : unload_err;
+        }
+    }
+    fputs("\n]}\n", out);
+    if (out != stdout)
+        fclose(out);
+    close(g_null_fd);
+
+    if (err)
+    {
+        fprintf(stderr, "transform_bench: %s: %s\n", failed, err);
+        return 1;
+    }
+    return 0;
+}
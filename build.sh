@@ -7,7 +7,13 @@ print_status() { echo -e "[BUILD] $*"; }
 print_error()  { echo -e "[ERROR] $*" >&2; }
 
 # ---------- Config ----------
+# ./build.sh          - analyzer, libpipeline.so and the plugins
+# ./build.sh static   - also output/analyzer_static, with every plugin below linked in
+# ./build.sh bench    - also the benchmark tools in output/bench (modes combine: ./build.sh static bench)
+BUILD_STATIC=0
+BUILD_BENCH=0
 MAIN_SRC="main.c"
+LIB_SRC="pipeline.c"
 OUT_DIR="output"
 
 # Feature included so strdup/usleep are declared on glibc
@@ -61,6 +67,16 @@ if [[ ! -f "${MAIN_SRC}" ]] || [[ ! -d "plugins" ]]; then
   print_error "Run from project root (expect '${MAIN_SRC}' and 'plugins/')."
   exit 1
 fi
+for mode in "$@"; do
+  case "${mode}" in
+    static) BUILD_STATIC=1 ;;
+    bench)  BUILD_BENCH=1 ;;
+    *)
+      print_error "Unknown build mode '${mode}' (usage: ./build.sh [static] [bench])."
+      exit 1
+      ;;
+  esac
+done
 
 
 # makes sure every build runs over the previous output dir (delete prev)
@@ -69,9 +85,13 @@ rm -rf "${OUT_DIR}"
 mkdir -p "${OUT_DIR}"
 
 
-# ---------- Build main into the output directory ----------
+# ---------- Build the pipeline library, then main against it ----------
+print_status "Building library → ${OUT_DIR}/libpipeline.so"
+${CC} -fPIC -shared ${CFLAGS} -o "${OUT_DIR}/libpipeline.so" "${LIB_SRC}" -ldl -lpthread
+
+# the analyzer finds the library next to itself
 print_status "Building analyzer → ${OUT_DIR}/analyzer"
-${CC} ${CFLAGS} -o "${OUT_DIR}/analyzer" "${MAIN_SRC}" -ldl
+${CC} ${CFLAGS} -o "${OUT_DIR}/analyzer" "${MAIN_SRC}" -L"${OUT_DIR}" -lpipeline -Wl,-rpath,'$ORIGIN' -lpthread
 
 
 # ---------- Build plugins like the instructions ----------
@@ -95,5 +115,56 @@ for name in "${PLUGINS[@]}"; do
     -ldl -lpthread
 done
 
+
+# ---------- Static registry build: plugins linked into the analyzer ----------
+# Every plugin is compiled with its symbols prefixed by its name, pipeline.c gets the PLUGINS list as
+# its registry. LTO inlines across the plugin / plugin_common boundary. Names that are not in the
+# list (and a second copy of a listed one in the same process) still load from <dir>/<name>.so
+if [[ "${BUILD_STATIC}" == 1 ]]; then
+  STATIC_DIR="${OUT_DIR}/static"
+  mkdir -p "${STATIC_DIR}"
+  STATIC_OBJS=()
+  REGISTRY=""
+  for name in "${PLUGINS[@]}"; do
+    print_status "Compiling linked-in plugin: ${name}"
+    ${CC} -c -flto ${CFLAGS} -DPLUGIN_STATIC_NAME="${name}" -o "${STATIC_DIR}/${name}.o" "${SRC[$name]}"
+    ${CC} -c -flto ${CFLAGS} -DPLUGIN_STATIC_NAME="${name}" -o "${STATIC_DIR}/${name}_common.o" "plugins/plugin_common.c"
+    STATIC_OBJS+=("${STATIC_DIR}/${name}.o" "${STATIC_DIR}/${name}_common.o")
+    REGISTRY+="X(${name}) "
+  done
+
+  print_status "Building analyzer with linked-in plugins → ${OUT_DIR}/analyzer_static"
+  ${CC} -flto ${CFLAGS} "-DPIPELINE_STATIC_PLUGINS(X)=${REGISTRY}" -o "${OUT_DIR}/analyzer_static" \
+    "${MAIN_SRC}" "${LIB_SRC}" "${STATIC_OBJS[@]}" \
+    "plugins/sync/monitor.c" \
+    "plugins/sync/consumer_producer.c" \
+    -ldl -lpthread
+fi
+
+
+# ---------- Benchmarks: output/bench, JSON results (see bench/bench_util.h) ----------
+if [[ "${BUILD_BENCH}" == 1 ]]; then
+  BENCH_DIR="${OUT_DIR}/bench"
+  mkdir -p "${BENCH_DIR}"
+
+  print_status "Building benchmark: queue_bench → ${BENCH_DIR}/queue_bench"
+  ${CC} ${CFLAGS} -Iplugins/sync -o "${BENCH_DIR}/queue_bench" \
+    "bench/queue_bench.c" "bench/bench_util.c" \
+    "plugins/sync/monitor.c" \
+    "plugins/sync/consumer_producer.c" \
+    -lpthread
+
+  print_status "Building benchmark: transform_bench → ${BENCH_DIR}/transform_bench"
+  ${CC} ${CFLAGS} -Iplugins -o "${BENCH_DIR}/transform_bench" \
+    "bench/transform_bench.c" "bench/bench_util.c" \
+    -ldl
+
+  # next to libpipeline.so's directory, like the analyzer
+  print_status "Building benchmark: analyzer_bench → ${BENCH_DIR}/analyzer_bench"
+  ${CC} ${CFLAGS} -I. -o "${BENCH_DIR}/analyzer_bench" \
+    "bench/analyzer_bench.c" "bench/bench_util.c" \
+    -L"${OUT_DIR}" -lpipeline -Wl,-rpath,'$ORIGIN/..' -lm -lpthread
+fi
+
 echo
 print_status "Build succeeded."
\ No newline at end of file
@@ -1,61 +1,59 @@
 #define _GNU_SOURCE // allowed as said in the Q&A video
 
-#include <dlfcn.h>  // ok to use (Piazza)
 #include <errno.h>  // ok to use (Piazza)
 #include <stdio.h>  // ok to use (Piazza)
 #include <stdlib.h> // ok to use (Piazza)
 #include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <string.h> // ok to use (Piazza)
 #include <unistd.h> // ok to use (Piazza)
-
-#include "plugins/plugin_sdk.h" // the contract
-
-// Bonus - Sets a compile-time flag that checks if we can use dlmopen
-#if defined(__GLIBC__)
-#include <link.h> // used by dlmopen
-#define DLMOPEN_SUPPORTED 1
-#else
-#define DLMOPEN_SUPPORTED 0
-#endif
-
-// Bonus - Allow turning choosing dlmopen / dlopen at runtime
-#define DLMOPEN_ENV_VAR "ANALYZER_DLMOPEN"
-static int use_dlmopen(void)
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "pipeline.h" // loading, wiring and running the chain (libpipeline.so)
+
+// Where the last stage's results go (--output)
+typedef enum
 {
-#if !DLMOPEN_SUPPORTED
-    return 0; // Not available, shouldnt happen on ubuntu
-#else
-    const char *val = getenv(DLMOPEN_ENV_VAR);
-    return (val == NULL) || (strcmp(val, "0") != 0);
-#endif
-}
+    SINK_NONE,  // dropped (the default for line input)
+    SINK_RAW,   // one line per result on stdout
+    SINK_FRAMED // one --binary data frame per result on stdout (the default for --binary)
+} sink_mode_t;
 
 // Step 1 - Holds parsed Command-Line info to keep clean main function
 typedef struct
 {
     int queue_size;
     int selected_plugin_count;
+    char **plugin_names; // the chain as written (points into argv)
+    int verbose;       // --verbose: print the optimized plan to stderr
+    int optimize;      // cleared by --no-optimize
+    int virtual_clock; // --virtual-clock: plugin delays are accounted, not slept
+    int stats;         // --stats: per-stage statistics on stderr at shutdown
+    int latency;       // --latency: latency percentiles on stderr at shutdown and on SIGUSR1
+    const char *trace; // --trace FILE: Chrome trace-event timeline of every stage, written at shutdown
+    const char *queue_csv; // --queue-csv FILE: queue occupancy time series, bottleneck verdict at shutdown
+    int queue_interval;    // --queue-interval MS: sampling period of --queue-csv, 0 = the library's default
+    const char *metrics;   // --metrics-socket PATH: Prometheus metrics for every connection to this Unix socket
+    size_t max_line;   // --max-line N: longer lines go in segments of at most N bytes, 0 = no limit
+    const char *input;  // --input FILE: read this instead of stdin
+    const char *listen; // --listen PATH: serve clients of this Unix socket instead of reading stdin
+    int binary;         // --binary: length-prefixed frames on stdin instead of lines
+    sink_mode_t output; // --output: what happens to the last stage's results
 } pipeline_configuration_t;
 
-// Step 2 - function pointer typedefs matching plugin_sdk.h so dlsym casts are type-safe
-typedef const char *(*plugin_init_func_t)(int queue_size);
-typedef const char *(*plugin_fini_func_t)(void);
-typedef const char *(*plugin_place_work_func_t)(const char *str);
-typedef void (*plugin_attach_func_t)(const char *(*next_place_work)(const char *));
-typedef const char *(*plugin_wait_finished_func_t)(void);
-
-// Step 2 - Copied from instructions (Stores the plugins .so)
-typedef struct
-{
-    plugin_init_func_t init;
-    plugin_fini_func_t fini;
-    plugin_place_work_func_t place_work;
-    plugin_attach_func_t attach;
-    plugin_wait_finished_func_t wait_finished;
-    char *name;
-    void *handle;
-} plugin_handle_t;
-
 // -------------------------------------------- Helpers --------------------------------------------------------
 
 static const char *g_prog = NULL;
@@ -66,6 +64,9 @@ static void usage_help_message(const char *prog);
 // Helper to handle errors
 static void print_error_and_exit(int exit_code, int print_usage, const char *prefix_line, const char *fmt, ...)
 {
+    // whatever the stages already queued goes out before we exit
+    pipeline_output_flush();
+
     // If theres an error message, print it first
     if (prefix_line && *prefix_line)
         fputs(prefix_line, stderr);
@@ -89,12 +90,29 @@ static void print_error_and_exit(int exit_code, int print_usage, const char *pre
 static void usage_help_message(const char *prog)
 {
     fprintf(stdout,
-            "Usage: %s <queue_size> <plugin1> <plugin2> ... <pluginN>\n"
+            "Usage: %s [options] <queue_size> <plugin1> <plugin2> ... <pluginN>\n"
             "\n"
             "Arguments:\n"
             "  queue_size  Maximum number of items in each plugin's queue\n"
             "  plugin1..N  Names of plugins to load (without .so extension)\n"
             "\n"
+            "Options:\n"
+            "  --verbose        Print the optimized plugin chain to stderr\n"
+            "  --no-optimize    Run the chain exactly as written\n"
+            "  --virtual-clock  Account plugin delays (typewriter) instead of sleeping them\n"
+            "  --stats          Print per-stage message counts and timings to stderr at shutdown\n"
+            "  --latency        Print latency percentiles per stage and end-to-end to stderr at shutdown and on SIGUSR1\n"
+            "  --trace FILE     Write a timeline of every stage's steps to FILE (Chrome trace-event JSON, for Perfetto)\n"
+            "  --queue-csv FILE Sample every stage's queue into FILE (CSV) and name the bottleneck stage on stderr\n"
+            "  --queue-interval MS  Sampling period of --queue-csv (default: 10)\n"
+            "  --metrics-socket PATH  Serve live per-stage metrics (Prometheus text over HTTP) on the Unix socket PATH\n"
+            "  --max-line N     Send lines longer than N bytes in segments of at most N, their results are\n"
+            "                   joined again by --output and --listen (default: no limit)\n"
+            "  --input FILE     Read FILE instead of stdin (memory-mapped when it is a regular file)\n"
+            "  --listen PATH    Serve clients of the Unix socket PATH with one pipeline, until SIGINT/SIGTERM\n"
+            "  --binary         Varint length-prefixed frames on stdin instead of lines (implies --output framed)\n"
+            "  --output MODE    Last stage's results: none (default), raw (lines) or framed, on stdout\n"
+            "\n"
             "Available plugins:\n"
             "  logger      - Logs all strings that pass through\n"
             "  typewriter  - Simulates typewriter effect with delays\n"
@@ -112,333 +130,1451 @@ static void usage_help_message(const char *prog)
 
 // -------------------------------------------- Main Application Steps --------------------------------------------------------
 
-// Step 1 - parse, allocate names[] and plugins[]
-static void parse_command_line(int argc, char **argv, pipeline_configuration_t *cfg, plugin_handle_t **plugins_out, char ***names_out)
+// Step 1 - parse the options, the queue size and the chain
+static void parse_command_line(int argc, char **argv, pipeline_configuration_t *cfg)
 {
-    // we need at least 3 arguments: name of program, queue size, at least one plugin
-    if (argc < 3)
+    cfg->optimize = 1; // on unless --no-optimize
+
+    // Options come first. Only "--" prefixed words count, so "-3" still reports an invalid queue size
+    int output_mode = -1; // not given
+    int arg_index = 1;
+    while (arg_index < argc && strncmp(argv[arg_index], "--", 2) == 0)
+    {
+        if (strcmp(argv[arg_index], "--verbose") == 0)
+            cfg->verbose = 1;
+        else if (strcmp(argv[arg_index], "--no-optimize") == 0)
+            cfg->optimize = 0;
+        else if (strcmp(argv[arg_index], "--virtual-clock") == 0)
+            cfg->virtual_clock = 1;
+        else if (strcmp(argv[arg_index], "--stats") == 0)
+            cfg->stats = 1;
+        else if (strcmp(argv[arg_index], "--latency") == 0)
+            cfg->latency = 1;
+        else if (strcmp(argv[arg_index], "--trace") == 0)
+        {
+            if (arg_index + 1 >= argc)
+                print_error_and_exit(1, 1, NULL, "--trace needs a file name");
+            cfg->trace = argv[++arg_index];
+        }
+        else if (strcmp(argv[arg_index], "--queue-csv") == 0)
+        {
+            if (arg_index + 1 >= argc)
+                print_error_and_exit(1, 1, NULL, "--queue-csv needs a file name");
+            cfg->queue_csv = argv[++arg_index];
+        }
+        else if (strcmp(argv[arg_index], "--queue-interval") == 0)
+        {
+            char *endptr = NULL;
+            long interval = arg_index + 1 < argc ? strtol(argv[arg_index + 1], &endptr, 10) : 0;
+            if (!endptr || *endptr != '\0' || interval < 1 || interval > 60000)
+                print_error_and_exit(1, 1, NULL, "invalid --queue-interval (1 to 60000 ms): '%s'",
+                                     arg_index + 1 < argc ? argv[arg_index + 1] : "");
+            cfg->queue_interval = (int)interval;
+            ++arg_index; // the value
+        }
+        else if (strcmp(argv[arg_index], "--metrics-socket") == 0)
+        {
+            if (arg_index + 1 >= argc)
+                print_error_and_exit(1, 1, NULL, "--metrics-socket needs a socket path");
+            cfg->metrics = argv[++arg_index];
+        }
+        else if (strcmp(argv[arg_index], "--max-line") == 0)
+        {
+            char *endptr = NULL;
+            long max_line = arg_index + 1 < argc ? strtol(argv[arg_index + 1], &endptr, 10) : 0;
+            if (!endptr || *endptr != '\0' || max_line < 1)
+                print_error_and_exit(1, 1, NULL, "invalid --max-line (must be greater than 0): '%s'",
+                                     arg_index + 1 < argc ? argv[arg_index + 1] : "");
+            cfg->max_line = (size_t)max_line;
+            ++arg_index; // the value
+        }
+        else if (strcmp(argv[arg_index], "--input") == 0)
+        {
+            if (arg_index + 1 >= argc)
+                print_error_and_exit(1, 1, NULL, "--input needs a file name");
+            cfg->input = argv[++arg_index];
+        }
+        else if (strcmp(argv[arg_index], "--binary") == 0)
+            cfg->binary = 1;
+        else if (strcmp(argv[arg_index], "--output") == 0)
+        {
+            const char *mode = arg_index + 1 < argc ? argv[++arg_index] : "";
+            if (strcmp(mode, "none") == 0)
+                output_mode = SINK_NONE;
+            else if (strcmp(mode, "raw") == 0)
+                output_mode = SINK_RAW;
+            else if (strcmp(mode, "framed") == 0)
+                output_mode = SINK_FRAMED;
+            else
+                print_error_and_exit(1, 1, NULL, "invalid --output (none, raw or framed): '%s'", mode);
+        }
+        else if (strcmp(argv[arg_index], "--listen") == 0)
+        {
+            if (arg_index + 1 >= argc)
+                print_error_and_exit(1, 1, NULL, "--listen needs a socket path");
+            cfg->listen = argv[++arg_index];
+        }
+        else
+            // print error to stderr, print the usage message, exit with code 1
+            print_error_and_exit(1, 1, NULL, "unknown option: '%s'", argv[arg_index]);
+        ++arg_index;
+    }
+
+    if (cfg->metrics && cfg->listen && strcmp(cfg->metrics, cfg->listen) == 0)
+        print_error_and_exit(1, 1, NULL, "--metrics-socket and --listen need different paths");
+    if (cfg->input && cfg->listen)
+        print_error_and_exit(1, 1, NULL, "--input and --listen cannot be combined");
+    if ((cfg->binary || output_mode >= 0) && cfg->listen)
+        print_error_and_exit(1, 1, NULL, "--binary and --output cannot be combined with --listen");
+    if (output_mode >= 0)
+        cfg->output = (sink_mode_t)output_mode;
+    else
+        cfg->output = cfg->binary ? SINK_FRAMED : SINK_NONE;
+
+    // we need at least 2 more arguments: queue size, at least one plugin
+    if (argc - arg_index < 2)
     {
         // print error to stderr, print the usage message, exit with code 1
         print_error_and_exit(1, 1, NULL, "Missing arguments");
     }
 
     // Parsing queue size
-    char *endptr_after_number = NULL;                                                 // catches the numbers part
-    long queue_size_value = strtol(argv[1], &endptr_after_number, 10);                // takes the second argument (queue size)
+    char *endptr_after_number = NULL;                                                  // catches the numbers part
+    long queue_size_value = strtol(argv[arg_index], &endptr_after_number, 10);         // takes the queue size argument
     if (!endptr_after_number || *endptr_after_number != '\0' || queue_size_value < 1) // checks: parsing works, 0 < queue_size
     {
         // print error to stderr, print the usage message, exit with code 1
-        print_error_and_exit(1, 1, NULL, "invalid queue size (must be greater than 0): '%s'", argv[1]);
+        print_error_and_exit(1, 1, NULL, "invalid queue size (must be greater than 0): '%s'", argv[arg_index]);
     }
     cfg->queue_size = (int)queue_size_value; // puts the number into queue_size if its good
 
     // Parsing the plugins
-    cfg->selected_plugin_count = argc - 2; // Everything after argv[1] (queue size) is treated as a plugin name, counts them
-    if (cfg->selected_plugin_count <= 0)   // Double-checks theres at least one plugin - not supposed to ever be true
+    cfg->selected_plugin_count = argc - arg_index - 1; // Everything after the queue size is treated as a plugin name, counts them
+    if (cfg->selected_plugin_count <= 0)               // Double-checks theres at least one plugin - not supposed to ever be true
     {
         // print error to stderr, print the usage message, exit with code 1
         print_error_and_exit(1, 1, NULL, "No plugins specified");
     }
 
-    // Allocates arrays to hold per-plugin state (stages) and the plugin names (names)
-    // use calloc and error out if memory allocation fails.
-    plugin_handle_t *plugins = calloc((size_t)cfg->selected_plugin_count, sizeof(plugin_handle_t));
-    if (!plugins)
-        // prints error to stderr, exit with code 1
-        print_error_and_exit(1, 0, NULL, "calloc plugins failed");
+    // the names stay in argv, the library copies what it keeps
+    cfg->plugin_names = &argv[arg_index + 1];
+}
+
+// Step 5 - read inputs, strip newline, send to first plugin
+// If the line is exactly "<END>", send it and stop reading
 
-    char **names = calloc((size_t)cfg->selected_plugin_count, sizeof(char *));
-    if (!names)
-        // prints error to stderr, exit with code 1
-        print_error_and_exit(1, 0, NULL, "calloc names failed");
+// hand one line (or --max-line chunk) to the first stage
+static void place_line(pipeline_t *pipeline, const char *line, size_t line_len)
+{
+    const char *err = pipeline_push(pipeline, line, line_len);
+    if (err)
+        // returns null on success
+        print_error_and_exit(1, 0, NULL, "place_work error: %s", err);
+}
 
-    // fill names from argv (just point to argv memory)
-    for (int i = 0; i < cfg->selected_plugin_count; ++i)
+// send <END> into the pipeline, the stages drain and shut down
+static void end_input(pipeline_t *pipeline)
+{
+    const char *err = pipeline_end(pipeline);
+    if (err)
+        // error to stderr, exit code 1
+        print_error_and_exit(1, 0, NULL, "place_work('<END>') error: %s", err);
+}
+
+// same, but an <END> line shuts the pipeline down; returns 1 when it was <END>
+static int feed_line(pipeline_t *pipeline, const char *line, size_t line_len)
+{
+    // check if the line is exactly "<END>"
+    if (line_len == 5 && memcmp(line, "<END>", 5) == 0)
     {
-        names[i] = argv[i + 2];
+        end_input(pipeline); // send it into the pipeline
+        return 1;            // Stop reading more lines
     }
 
-    // returns the newly allocated arrays
-    *plugins_out = plugins;
-    *names_out = names;
+    // if the line is normal, send it to the pipeline
+    place_line(pipeline, line, line_len);
+    return 0;
 }
 
-// Step 2 - loads the plugin
-static void load_plugin(plugin_handle_t *ph, const char *plugin_name)
+// --max-line cuts a longer line into segments. The stages see the bare segments, whether one continues
+// its line stays with the host (g_segments, or the server's tags) so the results can be joined again:
+// anything put into the payload could be a real last byte, and the stages move it around.
+// Only a whole line can be <END>
+#define SEGMENT_LOOKAHEAD 8 // a cut may move 3 bytes past max_line (one character), then "<END>\n"
+
+// bytes of the next segment when len are left: at most max_line, backed off to the start of a UTF-8
+// character (a character longer than max_line goes whole)
+static size_t segment_length(const char *line, size_t len, size_t max_line)
 {
-    // Supports explicit paths - only for testing (annoying bugs)
-    char so_path[512];
-    if (strchr(plugin_name, '/'))
+    if (len <= max_line)
+        return len;
+    size_t cut = max_line;
+    while (cut > 0 && ((unsigned char)line[cut] & 0xC0) == 0x80)
+        --cut;
+    if (cut == 0)
+        for (cut = max_line; cut < len && ((unsigned char)line[cut] & 0xC0) == 0x80; ++cut)
+            ;
+    // the last segment must not read as <END>: cut one character earlier
+    if (len - cut == 5 && memcmp(line + cut, "<END>", 5) == 0)
     {
-        // treat as explicit path
-        snprintf(so_path, sizeof so_path, "%s", plugin_name);
+        size_t earlier = cut - 1;
+        while (earlier > 0 && ((unsigned char)line[earlier] & 0xC0) == 0x80)
+            --earlier;
+        if (earlier > 0)
+            cut = earlier;
     }
-    else
+    return cut;
+}
+
+// Which results continue their line, for the result sink: one flag per message in push order, the sink
+// takes one with each result (a message gives at most one). The ring holds more than the chain can have
+// in flight; a stage that drops a message breaks the match, from then on every result ends its line
+static struct
+{
+    pipeline_t *pipeline;
+    unsigned char *continues; // ring, NULL when nobody joins results
+    size_t mask;
+    atomic_size_t pushed; // main thread
+    atomic_size_t taken;  // the sink, on the last stage's thread
+    atomic_int lost;      // a stage dropped a message
+} g_segments;
+
+static void segments_start(pipeline_t *pipeline, int queue_size)
+{
+    // every stage holds a queue, one message it works on and one it waits to hand on
+    size_t in_flight = ((size_t)queue_size + 2) * (size_t)pipeline_stage_count(pipeline) + 1, size = 2;
+    while (size < in_flight)
+        size <<= 1;
+    g_segments.continues = malloc(size);
+    if (!g_segments.continues)
+        print_error_and_exit(1, 0, NULL, "segment flag allocation failed");
+    g_segments.mask = size - 1;
+    g_segments.pipeline = pipeline;
+}
+
+static int segments_lost(void)
+{
+    if (atomic_load(&g_segments.lost))
+        return 1;
+    if (pipeline_dropped(g_segments.pipeline) == 0)
+        return 0;
+    if (!atomic_exchange(&g_segments.lost, 1))
+        fprintf(stderr, "[segments] a stage dropped a message, --max-line segments are no longer joined\n");
+    return 1;
+}
+
+// before the message is pushed, so its flag is there when the result comes
+static void segments_put(int continues)
+{
+    size_t at = atomic_load_explicit(&g_segments.pushed, memory_order_relaxed);
+    while (at - atomic_load_explicit(&g_segments.taken, memory_order_acquire) > g_segments.mask)
     {
-        // load from ./output/<name>.so
-        snprintf(so_path, sizeof so_path, "./output/%s.so", plugin_name);
+        if (segments_lost())
+            return; // the dropped messages' flags are never taken
+        sched_yield();
     }
+    g_segments.continues[at & g_segments.mask] = (unsigned char)continues;
+    atomic_store_explicit(&g_segments.pushed, at + 1, memory_order_release);
+}
 
-    // Save an owned copy of the plugin name
-    ph->name = strdup(plugin_name);
-    if (!ph->name)
-        // print error to stderr, print usage message, exit with code 1
-        print_error_and_exit(1, 1, "Step 2: Load Plugin Shared Objects failed\n", "out of memory for plugin name '%s'", plugin_name);
+// 1 when this result's line goes on in the next result
+static int segments_take(void)
+{
+    if (segments_lost())
+        return 0;
+    size_t at = atomic_load_explicit(&g_segments.taken, memory_order_relaxed);
+    if (at == atomic_load_explicit(&g_segments.pushed, memory_order_acquire))
+        return 0; // no flag: a message gives at most one result, cannot happen
+    int continues = g_segments.continues[at & g_segments.mask];
+    atomic_store_explicit(&g_segments.taken, at + 1, memory_order_release);
+    return continues;
+}
 
-// Load with RTLD_NOW | RTLD_LOCAL, report dlerror on failure
-// Load each instance in its own namespace
-#if DLMOPEN_SUPPORTED
-    if (use_dlmopen())
+// hand one segment to the first stage, noting for the sink whether its line goes on
+static void place_segment(pipeline_t *pipeline, const char *segment, size_t len, int continues)
+{
+    if (g_segments.continues)
+        segments_put(continues);
+    place_line(pipeline, segment, len);
+}
+
+// the rest of a line (all of it unless continued), cut into segments when it is longer than max_line
+// (0 = never); returns 1 when it was a whole <END> line
+static int feed_line_chunked(pipeline_t *pipeline, const char *line, size_t line_len, size_t max_line, int continued)
+{
+    if (!continued && line_len == 5 && memcmp(line, "<END>", 5) == 0)
+        return feed_line(pipeline, line, line_len);
+    size_t at = 0, segment;
+    do
+    {
+        segment = max_line ? segment_length(line + at, line_len - at, max_line) : line_len;
+        place_segment(pipeline, line + at, segment, at + segment < line_len);
+        at += segment;
+    } while (at < line_len);
+    return 0;
+}
+
+// read stdin in large blocks with read() and split lines with memchr (vectorized in libc).
+// Lines have no length limit, the buffer grows to hold the longest one and is reused.
+// With max_line set, longer lines go in segments instead (see g_segments), so a line never
+// has to be held whole: a segment is cut once SEGMENT_LOOKAHEAD bytes behind it hold no newline, so the
+// rest of a line is never just "<END>"
+static void feed_input(pipeline_t *pipeline, int fd, size_t max_line)
+{
+    enum
     {
-        ph->handle = dlmopen(LM_ID_NEWLM, so_path, RTLD_NOW | RTLD_LOCAL);
-        if (!ph->handle)
-            // print error to stderr, print usage to stdout, exit with code 1
-            print_error_and_exit(1, 1, "Step 2: Load Plugin Shared Objects failed\n", "dlmopen('%s') error: %s", so_path, dlerror());
+        INPUT_BLOCK_SIZE = 256 * 1024 // initial buffer, and the most one read() asks for
+    };
+
+    size_t capacity = INPUT_BLOCK_SIZE;
+    char *block = malloc(capacity);
+    if (!block)
+        print_error_and_exit(1, 0, NULL, "input buffer allocation failed");
+
+    size_t start = 0, end = 0; // unconsumed bytes are block[start..end)
+    size_t scanned = 0;        // bytes after start already known to hold no newline
+    int continued = 0;         // block[start] is inside a line that was cut
+    int at_eof = 0, done = 0;
+
+    while (!done)
+    {
+        // split every complete line we have
+        while (start < end)
+        {
+            size_t avail = end - start;
+            size_t cut_at = max_line + SEGMENT_LOOKAHEAD; // longer without a newline: cut
+            size_t window = (max_line && avail > cut_at) ? cut_at + 1 : avail;
+            char *line = block + start;
+            char *newline = scanned < window ? memchr(line + scanned, '\n', window - scanned) : NULL;
+
+            size_t line_len, consumed;
+            if (newline)
+            {
+                line_len = (size_t)(newline - line); // plugins dont see \n
+                consumed = line_len + 1;
+            }
+            else if (max_line && avail > cut_at)
+            {
+                // no newline within the window: cut, the rest of the line follows
+                line_len = segment_length(line, avail, max_line);
+                start += line_len;
+                scanned = 0;
+                continued = 1;
+                place_segment(pipeline, line, line_len, 1);
+                continue;
+            }
+            else if (at_eof)
+            {
+                line_len = avail; // last line without a newline
+                consumed = avail;
+            }
+            else
+            {
+                scanned = window; // partial line, read more
+                break;
+            }
+
+            start += consumed;
+            scanned = 0;
+            if (feed_line_chunked(pipeline, line, line_len, max_line, continued))
+            {
+                done = 1;
+                break;
+            }
+            continued = 0;
+        }
+
+        if (done || at_eof)
+            break;
+
+        // move the partial line to the front, grow when it fills the whole buffer
+        if (start > 0)
+        {
+            memmove(block, block + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end == capacity)
+        {
+            char *grown = realloc(block, capacity * 2);
+            if (!grown)
+                print_error_and_exit(1, 0, NULL, "input buffer allocation failed (line of %zu bytes)", end);
+            block = grown;
+            capacity *= 2;
+        }
+
+        size_t room = capacity - end;
+        ssize_t got = read(fd, block + end, room < INPUT_BLOCK_SIZE ? room : INPUT_BLOCK_SIZE);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // If input ended with an error, show it
+            print_error_and_exit(1, 0, NULL, "input read error");
+        }
+        if (got == 0)
+            at_eof = 1;
+        end += (size_t)got;
     }
-    else
+
+    free(block);
+}
+
+// --input of a regular file: the file is mapped and split into shards of about INPUT_SHARD_SIZE,
+// each moved forward to the next line start. Worker threads index the line ends of shards ahead
+// of the feeder in parallel (which also faults the pages in), the feeder hands the lines to the
+// first stage in order straight from the mapping and drops the pages it is done with
+#define INPUT_SHARD_SIZE (64UL * 1024 * 1024)
+#define INPUT_MAX_WORKERS 8
+#define INPUT_SHARDS_PER_WORKER 2 // how far the workers may run ahead of the feeder
+
+typedef struct
+{
+    size_t begin, end; // shard bytes, whole lines only
+    size_t *line_ends; // offset of every line's '\n' (or of the file end for an unterminated last line)
+    size_t line_count;
+    int ready;  // indexed by a worker
+    int failed; // out of memory while indexing
+} input_shard_t;
+
+typedef struct
+{
+    const char *base;
+    size_t size;
+    input_shard_t *shards;
+    size_t shard_count;
+    size_t lookahead;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t shard_ready; // a worker finished a shard
+    pthread_cond_t shard_fed;   // the feeder finished a shard, workers may go on
+    size_t next_shard;          // next shard a worker takes
+    size_t fed;                 // shards the feeder is done with
+    int stop;                   // <END> seen, workers quit
+} mapped_input_t;
+
+// first line start at or after offset
+static size_t mapped_line_start(const mapped_input_t *in, size_t offset)
+{
+    if (offset == 0 || offset >= in->size)
+        return offset < in->size ? offset : in->size;
+    const char *newline = memchr(in->base + offset - 1, '\n', in->size - offset + 1);
+    return newline ? (size_t)(newline - in->base) + 1 : in->size;
+}
+
+static void mapped_index_shard(const mapped_input_t *in, input_shard_t *shard, size_t index)
+{
+    shard->begin = mapped_line_start(in, index * INPUT_SHARD_SIZE);
+    shard->end = mapped_line_start(in, (index + 1) * INPUT_SHARD_SIZE);
+
+    size_t capacity = 0;
+    for (size_t at = shard->begin; at < shard->end;)
+    {
+        const char *newline = memchr(in->base + at, '\n', shard->end - at);
+        size_t line_end = newline ? (size_t)(newline - in->base) : shard->end;
+
+        if (shard->line_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            size_t *grown = realloc(shard->line_ends, capacity * sizeof(size_t));
+            if (!grown)
+            {
+                shard->failed = 1;
+                return;
+            }
+            shard->line_ends = grown;
+        }
+        shard->line_ends[shard->line_count++] = line_end;
+        at = line_end + 1;
+    }
+}
+
+static void *mapped_input_worker(void *arg)
+{
+    mapped_input_t *in = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&in->mutex);
+        while (!in->stop && in->next_shard < in->shard_count && in->next_shard >= in->fed + in->lookahead)
+            pthread_cond_wait(&in->shard_fed, &in->mutex);
+        if (in->stop || in->next_shard >= in->shard_count)
+        {
+            pthread_mutex_unlock(&in->mutex);
+            return NULL;
+        }
+        size_t index = in->next_shard++;
+        pthread_mutex_unlock(&in->mutex);
+
+        mapped_index_shard(in, &in->shards[index], index);
+
+        pthread_mutex_lock(&in->mutex);
+        in->shards[index].ready = 1;
+        pthread_cond_broadcast(&in->shard_ready);
+        pthread_mutex_unlock(&in->mutex);
+    }
+}
+
+// feed a mapped regular file, returns 0 when fd cannot be mapped (the caller streams it instead)
+static int feed_mapped_input(pipeline_t *pipeline, int fd, size_t max_line)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return 0;
+    if (st.st_size == 0)
+        return 1; // nothing to feed
+
+    mapped_input_t in = {.size = (size_t)st.st_size};
+    void *map = mmap(NULL, in.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return 0;
+    in.base = map;
+
+    // hints only, the kernel may ignore them
+    madvise(map, in.size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, in.size, MADV_HUGEPAGE);
 #endif
+
+    in.shard_count = (in.size + INPUT_SHARD_SIZE - 1) / INPUT_SHARD_SIZE;
+    in.shards = calloc(in.shard_count, sizeof(input_shard_t));
+    if (!in.shards)
+        print_error_and_exit(1, 0, NULL, "input shard allocation failed");
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cpus > 1 ? (size_t)cpus : 1;
+    if (workers > INPUT_MAX_WORKERS)
+        workers = INPUT_MAX_WORKERS;
+    if (workers > in.shard_count)
+        workers = in.shard_count;
+    in.lookahead = workers * INPUT_SHARDS_PER_WORKER;
+
+    pthread_mutex_init(&in.mutex, NULL);
+    pthread_cond_init(&in.shard_ready, NULL);
+    pthread_cond_init(&in.shard_fed, NULL);
+    pthread_t threads[INPUT_MAX_WORKERS];
+    size_t started = 0;
+    while (started < workers && pthread_create(&threads[started], NULL, mapped_input_worker, &in) == 0)
+        ++started;
+    if (started == 0)
+        print_error_and_exit(1, 0, NULL, "failed to create input worker thread");
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t dropped = 0; // pages below this offset were given back
+    int done = 0;
+    for (size_t i = 0; i < in.shard_count && !done; ++i)
     {
-        ph->handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
-        if (!ph->handle)
-            // print error to stderr, print usage to stdout, exit with code 1
-            print_error_and_exit(1, 1, "Step 2: Load Plugin Shared Objects failed\n", "dlopen('%s') error: %s", so_path, dlerror());
-    }
-
-    // Resolve each symbol with dlerror() checks after each dlsym
-    dlerror();
-    *(void **)(&ph->init) = dlsym(ph->handle, "plugin_init");
-    const char *e = dlerror();
-    if (e || !ph->init)
-        print_error_and_exit(1, 1,
-                             "Step 2: Load Plugin Shared Objects failed\n",
-                             "missing required symbol '%s' in '%s': %s",
-                             "plugin_init", so_path, e ? e : "(null)");
-
-    dlerror();
-    *(void **)(&ph->place_work) = dlsym(ph->handle, "plugin_place_work");
-    e = dlerror();
-    if (e || !ph->place_work)
-        print_error_and_exit(1, 1,
-                             "Step 2: Load Plugin Shared Objects failed\n",
-                             "missing required symbol '%s' in '%s': %s",
-                             "plugin_place_work", so_path, e ? e : "(null)");
-
-    dlerror();
-    *(void **)(&ph->attach) = dlsym(ph->handle, "plugin_attach");
-    e = dlerror();
-    if (e || !ph->attach)
-        print_error_and_exit(1, 1,
-                             "Step 2: Load Plugin Shared Objects failed\n",
-                             "missing required symbol '%s' in '%s': %s",
-                             "plugin_attach", so_path, e ? e : "(null)");
-
-    dlerror();
-    *(void **)(&ph->wait_finished) = dlsym(ph->handle, "plugin_wait_finished");
-    e = dlerror();
-    if (e || !ph->wait_finished)
-        print_error_and_exit(1, 1,
-                             "Step 2: Load Plugin Shared Objects failed\n",
-                             "missing required symbol '%s' in '%s': %s",
-                             "plugin_wait_finished", so_path, e ? e : "(null)");
-
-    dlerror();
-    *(void **)(&ph->fini) = dlsym(ph->handle, "plugin_fini");
-    e = dlerror();
-    if (e || !ph->fini)
-        print_error_and_exit(1, 1,
-                             "Step 2: Load Plugin Shared Objects failed\n",
-                             "missing required symbol '%s' in '%s': %s",
-                             "plugin_fini", so_path, e ? e : "(null)");
-}
-
-// Step 2: Loads the plugin (dont need to check uniqe)
-static void step2_load_or_exit(const pipeline_configuration_t *cfg, char **names, plugin_handle_t *plugins)
-{
-    // load the plugins
-    for (int i = 0; i < cfg->selected_plugin_count; ++i)
-    {
-        load_plugin(&plugins[i], names[i]);
-    }
-}
-
-// Step 3 - Call init(queue_size) for each plugin.
-// On failure: clean up already loaded plugins, print to stderr, and exit with code 2.
-static void init_plugin(plugin_handle_t *p, int plugins_count, int queue_size)
-{
-    for (int i = 0; i < plugins_count; ++i)
-    {
-        const char *err = p[i].init(queue_size);
-        // init returns NULL on success,
-        if (err)
+        input_shard_t *shard = &in.shards[i];
+        pthread_mutex_lock(&in.mutex);
+        while (!shard->ready)
+            pthread_cond_wait(&in.shard_ready, &in.mutex);
+        pthread_mutex_unlock(&in.mutex);
+        if (shard->failed)
+            print_error_and_exit(1, 0, NULL, "input line index allocation failed");
+
+        size_t at = shard->begin;
+        for (size_t l = 0; l < shard->line_count && !done; ++l)
         {
-            // Preserve the failing plugin name before we free it
-            const char *name_ptr = p[i].name ? p[i].name : "(unknown)";
-            char failing_name[256];
-            snprintf(failing_name, sizeof failing_name, "%s", name_ptr);
+            done = feed_line_chunked(pipeline, in.base + at, shard->line_ends[l] - at, max_line, 0);
+            at = shard->line_ends[l] + 1;
+        }
+        free(shard->line_ends);
+        shard->line_ends = NULL;
+
+        // the queues copied every line, so the pages behind us are not needed any more
+        size_t keep_from = shard->end / page * page;
+        if (keep_from > dropped)
+        {
+            madvise((char *)map + dropped, keep_from - dropped, MADV_DONTNEED);
+            dropped = keep_from;
+        }
 
-            // Prints context to stderr
-            fprintf(stderr, "Initialize Plugins failed\n");
-            fprintf(stderr, "plugin_init(%s) error: %s\n", failing_name, err);
+        pthread_mutex_lock(&in.mutex);
+        in.fed = i + 1;
+        in.stop = done;
+        pthread_cond_broadcast(&in.shard_fed);
+        pthread_mutex_unlock(&in.mutex);
+    }
+
+    for (size_t t = 0; t < started; ++t)
+        pthread_join(threads[t], NULL);
+    for (size_t i = 0; i < in.shard_count; ++i)
+        free(in.shards[i].line_ends);
+    free(in.shards);
+    pthread_cond_destroy(&in.shard_fed);
+    pthread_cond_destroy(&in.shard_ready);
+    pthread_mutex_destroy(&in.mutex);
+    munmap(map, in.size);
+    return 1;
+}
 
-            // Roll back already-initialized/loaded plugins, including the failing one
-            for (int j = i; j >= 0; --j)
+// -------------------------------------------- Binary framing --------------------------------------------------------
+
+// --binary: every message is a frame, an unsigned LEB128 varint header followed by a payload.
+//   even header h: data frame, payload of h >> 1 bytes
+//   odd header h:  control frame without payload, code h >> 1 (FRAME_END, FRAME_FLUSH, FRAME_CONTINUES)
+// Data frames are sliced out of the read buffer by their length and handed to the first stage
+// as views, nothing is scanned. Results go out through the result sink, framed by default.
+// Payloads reach the stages as C strings, so they must not contain NUL bytes, and a payload of
+// exactly "<END>" is refused (the stages would take it for the shutdown marker)
+#define FRAME_END 0   // end of the stream, same as the <END> line
+#define FRAME_FLUSH 1 // everything before this frame is written out before reading on
+#define FRAME_CONTINUES 2 // output only: the next data frame is a --max-line segment, its line goes on in the one after
+#define FRAME_VARINT_MAX 10
+
+static size_t frame_header(unsigned char *out, unsigned long long value)
+{
+    size_t n = 0;
+    do
+    {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        out[n++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return n;
+}
+
+// decode a varint from [p, end): returns its size, 0 when incomplete, -1 when malformed
+static int frame_parse_header(const unsigned char *p, const unsigned char *end, unsigned long long *value)
+{
+    unsigned long long v = 0;
+    for (int i = 0; i < FRAME_VARINT_MAX; ++i)
+    {
+        if (p + i >= end)
+            return 0;
+        v |= (unsigned long long)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80))
+        {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+// -------------------------------------------- Result sink --------------------------------------------------------
+
+// The sink is the pipeline's result callback and takes over the last stage's results, which would
+// otherwise be dropped: --output raw writes each one as a line, --output framed as a data frame
+// (closed by an END frame). Results go out as records of the output writer, which batches them
+// into large writevs and keeps them in order with the stages' own output.
+// A --max-line segment whose line goes on gets no newline (raw) or a CONTINUES frame before it (framed)
+static void sink_result(void *ctx, const char *result, size_t len)
+{
+    sink_mode_t mode = *(const sink_mode_t *)ctx;
+    unsigned char header[FRAME_VARINT_MAX];
+    if (!result)
+    {
+        if (mode == SINK_FRAMED)
+        {
+            struct iovec iov = {.iov_base = header, .iov_len = frame_header(header, ((unsigned long long)FRAME_END << 1) | 1)};
+            pipeline_output_write(STDOUT_FILENO, &iov, 1);
+        }
+        return;
+    }
+
+    int continues = g_segments.continues && segments_take();
+    if (mode == SINK_RAW)
+    {
+        struct iovec iov[2] = {
+            {.iov_base = (void *)result, .iov_len = len},
+            {.iov_base = "\n", .iov_len = 1},
+        };
+        pipeline_output_write(STDOUT_FILENO, iov, continues ? 1 : 2);
+    }
+    else if (mode == SINK_FRAMED)
+    {
+        unsigned char chunk[FRAME_VARINT_MAX];
+        struct iovec iov[3] = {
+            {.iov_base = chunk, .iov_len = frame_header(chunk, ((unsigned long long)FRAME_CONTINUES << 1) | 1)},
+            {.iov_base = header, .iov_len = frame_header(header, (unsigned long long)len << 1)},
+            {.iov_base = (void *)result, .iov_len = len},
+        };
+        pipeline_output_write(STDOUT_FILENO, iov + !continues, 3 - !continues); // headers and payload stay one record
+    }
+}
+
+// Step 5 in --binary mode: slice frames out of large reads, until an END frame or the end of input
+static void feed_framed_input(pipeline_t *pipeline, int fd)
+{
+    enum
+    {
+        INPUT_BLOCK_SIZE = 256 * 1024 // initial buffer, and the most one read() asks for
+    };
+
+    size_t capacity = INPUT_BLOCK_SIZE;
+    unsigned char *block = malloc(capacity);
+    if (!block)
+        print_error_and_exit(1, 0, NULL, "input buffer allocation failed");
+
+    size_t start = 0, end = 0; // unconsumed bytes are block[start..end)
+    size_t need = 0;           // bytes the frame at start needs in total, 0 = not known yet
+    int at_eof = 0;
+
+    for (;;)
+    {
+        while (start < end)
+        {
+            unsigned long long header;
+            int header_len = frame_parse_header(block + start, block + end, &header);
+            if (header_len < 0)
+                print_error_and_exit(1, 0, NULL, "--binary: malformed frame header");
+            if (header_len == 0)
+                break; // header not complete yet
+
+            if (header & 1)
             {
-                if (p[j].fini)
+                start += (size_t)header_len;
+                unsigned long long code = header >> 1;
+                if (code == FRAME_END)
                 {
-                    const char *ferr = p[j].fini();
-                    // fini returns NULL on success, error message on failure
-                    if (ferr)
-                        fprintf(stderr, "plugin_fini(%s) error during rollback: %s\n", p[j].name ? p[j].name : "(null)", ferr);
+                    at_eof = 1; // anything after END is ignored, like after the <END> line
+                    start = end;
+                    break;
                 }
-                if (p[j].handle)
-                    dlclose(p[j].handle);
-
-                free(p[j].name);
-                p[j].name = NULL;
-                p[j].handle = NULL;
+                if (code != FRAME_FLUSH)
+                    print_error_and_exit(1, 0, NULL, "--binary: unknown control frame %llu", code);
+                pipeline_flush(pipeline); // every result so far is written
+                continue;
             }
 
-            // Ensure anything after i that we may have partially touched is also closed/freed
-            for (int j = i + 1; j < plugins_count; ++j)
+            unsigned long long payload = header >> 1;
+            if (payload > SIZE_MAX / 2)
+                print_error_and_exit(1, 0, NULL, "--binary: frame too large (%llu bytes)", payload);
+            if (end - start < (size_t)header_len + payload)
             {
-                if (p[j].handle)
-                    dlclose(p[j].handle);
-                free(p[j].name);
-                p[j].name = NULL;
-                p[j].handle = NULL;
+                need = (size_t)header_len + (size_t)payload;
+                break; // payload not complete yet
             }
 
-            // exit with code 2, Summarize the primary failure
-            print_error_and_exit(2, /*print_usage=*/0, /*prefix=*/NULL, "plugin_init(%s) error: %s", failing_name, err);
+            const char *data = (const char *)block + start + header_len;
+            if (payload == 5 && memcmp(data, "<END>", 5) == 0)
+                print_error_and_exit(1, 0, NULL, "--binary: a data frame may not hold exactly <END>, send an END frame");
+            place_line(pipeline, data, (size_t)payload);
+            start += (size_t)header_len + (size_t)payload;
+            need = 0;
+        }
+
+        if (at_eof)
+            break;
+
+        // move the partial frame to the front, grow when it cannot fit
+        if (start > 0)
+        {
+            memmove(block, block + start, end - start);
+            end -= start;
+            start = 0;
         }
+        if (end == capacity || need > capacity)
+        {
+            size_t new_capacity = capacity * 2 > need ? capacity * 2 : need;
+            unsigned char *grown = realloc(block, new_capacity);
+            if (!grown)
+                print_error_and_exit(1, 0, NULL, "input buffer allocation failed (frame of %zu bytes)", need);
+            block = grown;
+            capacity = new_capacity;
+        }
+
+        size_t room = capacity - end;
+        ssize_t got = read(fd, block + end, room < INPUT_BLOCK_SIZE ? room : INPUT_BLOCK_SIZE);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            print_error_and_exit(1, 0, NULL, "input read error");
+        }
+        if (got == 0)
+        {
+            if (end > 0)
+                print_error_and_exit(1, 0, NULL, "--binary: input ends inside a frame");
+            break; // a clean end of input counts as END
+        }
+        end += (size_t)got;
     }
+
+    free(block);
+    end_input(pipeline);
 }
 
-// Step 4 - attach the plugin to the next one in the pipeline
-static void wire_plugins(plugin_handle_t *p, int n)
+// -------------------------------------------- Server mode --------------------------------------------------------
+
+// --listen PATH: one long-lived pipeline serves every client of a Unix socket.
+// The chain gives at most one output per input, in order, so a FIFO of client tags (one per line
+// sent into the first stage) is enough to route the last stage's outputs back: the pipeline's
+// result callback pops one tag per result and queues the result for that client.
+// The loop never waits on the pipeline: fewer lines than a queue holds are in flight, so pipeline_push
+// always finds room, and a client is not read while its lines cannot go in or its results pile up.
+// A client line "<END>" only ends that client, SIGINT / SIGTERM shut the pipeline down
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_OUT_LIMIT (1024 * 1024) // a client's unsent results above which its input waits
+#define SERVER_DROP_POLL_MS 50         // how often a drop is looked for while lines are in flight
+
+typedef struct server_client
 {
-    // Basic check
-    if (!p || n <= 0)
-        // error to stderr, exit with code 1
-        print_error_and_exit(1, 0, NULL, "wire_plugins: invalid pipeline (n=%d)", n);
+    int fd;
+    char *in; // bytes read, not yet sent into the pipeline
+    size_t in_len, in_cap;
+    size_t line_at; // --max-line segments of the first line in `in` already sent
+    char *out;      // results waiting to be written (guarded by g_server.mutex)
+    size_t out_len, out_cap;
+    size_t pending;  // lines in the pipeline whose results have not come back yet
+    int blocked;     // a whole line in `in` waits for room, reading waits with it
+    int closing;     // no more input (hangup or <END>), close once the results are out
+    int dead;        // write failed or results lost to a drop: results are dropped, input ignored
+    uint32_t events; // what epoll watches for this client right now (0 = not registered)
+    struct server_client *prev, *next;
+} server_client_t;
+
+// a line in flight: whose it is, and whether it is a --max-line segment whose line goes on
+typedef struct
+{
+    server_client_t *client;
+    int continues;
+} server_tag_t;
 
-    // Loops over all plugins except the last one. attach them to the next one
-    for (int i = 0; i + 1 < n; ++i)
+static struct
+{
+    int listen_fd, epoll_fd, wake_fd, signal_fd;
+    const char *path;
+    size_t max_line;
+    server_client_t *clients;
+    pipeline_t *pipeline;
+
+    pthread_mutex_t mutex;  // tags, pending counts and out buffers (the result callback runs on a stage thread)
+    server_tag_t *tags;     // ring of client tags, one per line in flight
+    size_t tag_head, tag_count, tag_cap; // tag_cap = queue size, more lines in flight could make a push wait
+    unsigned long long drops_known;      // drops already matched with the tags of their lines
+    int unsure;              // a stage dropped a line: which result is whose is unknown until all are back
+    size_t settled;          // results while unsure
+    atomic_int wake_pending; // an eventfd write is already on its way
+    int finished;            // the result callback saw the end
+} g_server = {.listen_fd = -1, .epoll_fd = -1, .wake_fd = -1, .signal_fd = -1};
+
+static int server_append(char **buf, size_t *len, size_t *cap, const char *data, size_t n)
+{
+    if (*len + n > *cap)
     {
-        // Check required function pointers exist
-        if (!p[i].attach)
-            // print error to stderr, exit with code 1
-            print_error_and_exit(1, 0, NULL, "wire_plugins: plugin %d ('%s') missing attach",
-                                 i, p[i].name ? p[i].name : "(null)");
+        size_t new_cap = *cap ? *cap : 4096;
+        while (new_cap < *len + n)
+            new_cap *= 2;
+        char *grown = realloc(*buf, new_cap);
+        if (!grown)
+            return -1;
+        *buf = grown;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    return 0;
+}
 
-        if (!p[i + 1].place_work)
-            // print error to stderr, exit with code 1
-            print_error_and_exit(1, 0, NULL, "wire_plugins: plugin %d ('%s') missing place_work",
-                                 i + 1, p[i + 1].name ? p[i + 1].name : "(null)");
+static void server_wake(void)
+{
+    if (atomic_exchange(&g_server.wake_pending, 1))
+        return;
+    uint64_t one = 1;
+    while (write(g_server.wake_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
 
-        // Do the wiring
-        p[i].attach(p[i + 1].place_work);
+// result callback: route one result to the client whose line it came from
+static void server_result(void *ctx, const char *result, size_t len)
+{
+    (void)ctx;
+    if (!result)
+    {
+        pthread_mutex_lock(&g_server.mutex);
+        g_server.finished = 1;
+        pthread_mutex_unlock(&g_server.mutex);
+        server_wake();
+        return;
     }
+
+    pthread_mutex_lock(&g_server.mutex);
+    // a drop of an earlier line is counted by now: without a new one the head tag is this result's line
+    if (!g_server.unsure && pipeline_dropped(g_server.pipeline) != g_server.drops_known)
+        g_server.unsure = 1;
+    if (g_server.unsure || g_server.tag_count == 0) // no tag: a line gives at most one result, cannot happen
+    {
+        g_server.settled += g_server.unsure; // nobody gets it, see server_resync
+        pthread_mutex_unlock(&g_server.mutex);
+        server_wake();
+        return;
+    }
+    server_tag_t tag = g_server.tags[g_server.tag_head];
+    server_client_t *client = tag.client;
+    g_server.tag_head = (g_server.tag_head + 1) % g_server.tag_cap;
+    --g_server.tag_count;
+    --client->pending;
+    if (!client->dead &&
+        (server_append(&client->out, &client->out_len, &client->out_cap, result, len) != 0 ||
+         (!tag.continues && server_append(&client->out, &client->out_len, &client->out_cap, "\n", 1) != 0)))
+        client->dead = 1; // out of memory: this client loses its results, the others go on
+    pthread_mutex_unlock(&g_server.mutex);
+
+    server_wake();
 }
 
-// Step 5 - read inputs, strip newline, send to first plugin
-// If the line is exactly "<END>", send it and break the loop
-static void feed_input(plugin_handle_t *first_plugin)
+// after a drop, once every line in flight has its result or was dropped: the clients those lines came
+// from are closed (one of them lost a line, the others' results may have gone to the wrong tag) and
+// new lines go in again
+static void server_resync(void)
 {
-    enum
+    pthread_mutex_lock(&g_server.mutex);
+    unsigned long long dropped = pipeline_dropped(g_server.pipeline);
+    if (dropped != g_server.drops_known)
+        g_server.unsure = 1; // also when no result came after the drop
+    if (g_server.unsure && g_server.settled + (dropped - g_server.drops_known) == g_server.tag_count)
     {
-        MAX_LINE_LEN = 1024 // max length is 1024 characters
-    };
-    char line_buffer[MAX_LINE_LEN + 1]; // room for the terminating '\0'
+        for (size_t i = 0; i < g_server.tag_count; ++i)
+        {
+            server_client_t *client = g_server.tags[(g_server.tag_head + i) % g_server.tag_cap].client;
+            --client->pending;
+            client->dead = 1;
+        }
+        fprintf(stderr, "[server] %llu line(s) dropped by a stage, closing the clients that had lines in flight\n",
+                dropped - g_server.drops_known);
+        g_server.tag_head = g_server.tag_count = g_server.settled = 0;
+        g_server.drops_known = dropped;
+        g_server.unsure = 0;
+    }
+    pthread_mutex_unlock(&g_server.mutex);
+}
+
+// tag the line with its client, then send it into the pipeline; 0 when there is no room for it
+static int server_submit(server_client_t *client, const char *line, size_t len, int continues)
+{
+    pthread_mutex_lock(&g_server.mutex);
+    int room = !g_server.unsure && g_server.tag_count < g_server.tag_cap;
+    if (room)
+    {
+        g_server.tags[(g_server.tag_head + g_server.tag_count) % g_server.tag_cap] =
+            (server_tag_t){.client = client, .continues = continues};
+        ++g_server.tag_count;
+        ++client->pending;
+    }
+    pthread_mutex_unlock(&g_server.mutex);
 
-    // basic check (Step 4 already checks this, but to be sure)
-    if (!first_plugin || !first_plugin->place_work)
-        // print to stderr, exit with code 1
-        print_error_and_exit(1, 0, NULL, "feed_input: invalid pipeline entry");
+    if (room)
+        place_line(g_server.pipeline, line, len); // the first queue has room, see tag_cap
+    return room;
+}
 
-    // Use fgets() to read lines up to 1024 characters
-    while (fgets(line_buffer, sizeof line_buffer, stdin))
+// one client line, --max-line segments tagged one by one from client->line_at on.
+// Returns 1 when the client sent <END>, -1 when the pipeline is full (line_at says how far it got), else 0
+static int server_client_line(server_client_t *client, const char *line, size_t len)
+{
+    if (len == 5 && memcmp(line, "<END>", 5) == 0)
+        return 1;
+    size_t max_line = g_server.max_line;
+    do
     {
-        size_t line_len = strlen(line_buffer);
-        int had_trailing_newline = 0;
+        size_t at = client->line_at;
+        size_t segment = max_line ? segment_length(line + at, len - at, max_line) : len - at;
+        int sent = server_submit(client, line + at, segment, at + segment < len);
+        if (!sent)
+            return -1;
+        client->line_at = at + segment;
+    } while (client->line_at < len);
+    client->line_at = 0;
+    return 0;
+}
+
+static int server_out_full(server_client_t *client)
+{
+    pthread_mutex_lock(&g_server.mutex);
+    int full = client->out_len >= SERVER_OUT_LIMIT;
+    pthread_mutex_unlock(&g_server.mutex);
+    return full;
+}
+
+// read while the client is open and nothing holds its input back, wait for writability only while
+// results are stuck (EPOLLOUT is level-triggered, leaving it on would spin)
+static void server_watch(server_client_t *client, int readable, int waiting)
+{
+    uint32_t events = (readable && !client->closing ? EPOLLIN : 0) | (waiting ? EPOLLOUT : 0);
+    if (events == client->events)
+        return;
+
+    struct epoll_event ev = {.events = events, .data.ptr = client};
+    if (client->events == 0)
+        epoll_ctl(g_server.epoll_fd, EPOLL_CTL_ADD, client->fd, &ev);
+    else if (events == 0)
+        epoll_ctl(g_server.epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    else
+        epoll_ctl(g_server.epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+    client->events = events;
+}
 
-        // Removes the trailing newline so plugins dont see \n
-        if (line_len && line_buffer[line_len - 1] == '\n')
+static void server_stop_reading(server_client_t *client)
+{
+    if (client->closing)
+        return;
+    client->closing = 1;
+    server_watch(client, 0, 0);
+}
+
+// send the client's buffered lines while the pipeline and its out buffer have room; after a hangup an
+// unterminated last line counts too, like at the end of stdin
+static void server_feed(server_client_t *client)
+{
+    size_t start = 0;
+    int rc = 0;
+    while (rc == 0 && start < client->in_len)
+    {
+        char *newline = memchr(client->in + start, '\n', client->in_len - start);
+        if (!newline && !client->closing)
+            break; // the rest of the line is still to come
+        size_t len = newline ? (size_t)(newline - (client->in + start)) : client->in_len - start;
+        if (server_out_full(client))
+            rc = -1;
+        else if ((rc = server_client_line(client, client->in + start, len)) == 0)
+            start += len + (newline != NULL);
+    }
+    if (rc == 1)
+    {
+        client->in_len = 0; // <END>: anything after it is ignored
+        client->blocked = 0;
+        server_stop_reading(client);
+        return;
+    }
+    client->blocked = rc < 0;
+    memmove(client->in, client->in + start, client->in_len - start);
+    client->in_len -= start;
+}
+
+static void server_close_client(server_client_t *client)
+{
+    if (client->prev)
+        client->prev->next = client->next;
+    else
+        g_server.clients = client->next;
+    if (client->next)
+        client->next->prev = client->prev;
+    close(client->fd); // also removes it from epoll
+    free(client->in);
+    free(client->out);
+    free(client);
+}
+
+static void server_accept(void)
+{
+    for (;;)
+    {
+        int fd = accept4(g_server.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return; // EAGAIN: all accepted (or a transient error, retried on the next event)
+
+        server_client_t *client = calloc(1, sizeof(*client));
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = client};
+        if (!client || epoll_ctl(g_server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
         {
-            line_buffer[--line_len] = '\0';
-            had_trailing_newline = 1;
+            free(client);
+            close(fd);
+            continue;
         }
+        client->fd = fd;
+        client->events = EPOLLIN;
+        client->next = g_server.clients;
+        if (client->next)
+            client->next->prev = client;
+        g_server.clients = client;
+    }
+}
 
-        // Just in case - If buffer filled exactly and no '\n' was read, swallow a lone newline next
-        if (!had_trailing_newline && line_len == (sizeof line_buffer - 1))
+static void server_read(server_client_t *client)
+{
+    char block[SERVER_READ_SIZE];
+    ssize_t got = read(client->fd, block, sizeof(block));
+    if (got < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (got > 0 && server_append(&client->in, &client->in_len, &client->in_cap, block, (size_t)got) != 0)
+        got = -1; // out of memory: drop this client
+    if (got < 0)
+        client->in_len = 0;
+    if (got <= 0)
+        server_stop_reading(client); // hangup: server_feed still sends what was read
+    server_feed(client);
+}
+
+// write what each client has waiting, resume clients whose input waited; closes clients that are done.
+// final = block until written
+static void server_flush_clients(int final)
+{
+    for (server_client_t *client = g_server.clients, *next; client; client = next)
+    {
+        next = client->next;
+        if (!final && !client->dead && (client->blocked || (client->closing && client->in_len > 0)))
+            server_feed(client);
+
+        pthread_mutex_lock(&g_server.mutex);
+        size_t sent = 0;
+        while (!client->dead && sent < client->out_len)
+        {
+            ssize_t n = send(client->fd, client->out + sent, client->out_len - sent, MSG_NOSIGNAL);
+            if (n > 0)
+                sent += (size_t)n;
+            else if (n < 0 && errno == EINTR)
+                continue;
+            else if (n < 0 && errno == EAGAIN && final)
+            {
+                struct pollfd pfd = {.fd = client->fd, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+            }
+            else if (n < 0 && errno == EAGAIN)
+                break; // socket full, the rest goes on the next wake / EPOLLOUT
+            else
+                client->dead = 1; // the client is gone
+        }
+        memmove(client->out, client->out + sent, client->out_len - sent);
+        client->out_len = client->dead ? 0 : client->out_len - sent;
+        int waiting = client->out_len > 0;
+        int readable = !client->blocked && client->out_len < SERVER_OUT_LIMIT;
+        int dead = client->dead;
+        int done = (client->closing || dead) && client->pending == 0 && !waiting;
+        pthread_mutex_unlock(&g_server.mutex);
+
+        if (dead)
         {
-            int next_char = fgetc(stdin);
-            if (next_char != '\n' && next_char != EOF)
-                ungetc(next_char, stdin);
+            client->in_len = 0; // its input goes nowhere either
+            client->blocked = 0;
+            server_stop_reading(client);
         }
+        if ((done && client->in_len == 0) || final)
+            server_close_client(client);
+        else
+            server_watch(client, readable, waiting);
+    }
+}
+
+// taken by the result callback on a stage thread: pshared, see host_mutex_init in pipeline.c
+static int server_mutex_init(void)
+{
+    pthread_mutexattr_t attr;
+    if (pthread_mutexattr_init(&attr) != 0)
+        return -1;
+    int rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (rc == 0)
+        rc = pthread_mutex_init(&g_server.mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
 
-        const char *err;
+// before any thread exists: bind the socket (so a bad path fails early) and block the shutdown
+// signals, every thread created later inherits the mask and only the signalfd sees them
+static void server_prepare(const pipeline_configuration_t *cfg)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(cfg->listen) >= sizeof(addr.sun_path))
+        print_error_and_exit(1, 1, NULL, "--listen path too long: '%s'", cfg->listen);
+    strcpy(addr.sun_path, cfg->listen);
+
+    // a socket left behind by an earlier run is replaced, any other file is not
+    struct stat st;
+    if (stat(cfg->listen, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(cfg->listen);
+
+    g_server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_server.listen_fd < 0 || bind(g_server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(g_server.listen_fd, SOMAXCONN) != 0)
+        print_error_and_exit(1, 1, NULL, "cannot listen on '%s': %s", cfg->listen, strerror(errno));
+    g_server.path = cfg->listen;
+    g_server.max_line = cfg->max_line;
+    g_server.tag_cap = (size_t)cfg->queue_size;
+    g_server.tags = malloc(g_server.tag_cap * sizeof(*g_server.tags));
+    if (!g_server.tags)
+        print_error_and_exit(1, 0, NULL, "server: tag queue allocation failed");
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    g_server.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    g_server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    g_server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_server.signal_fd < 0 || g_server.wake_fd < 0 || g_server.epoll_fd < 0 || server_mutex_init() != 0)
+        print_error_and_exit(1, 0, NULL, "server setup failed: %s", strerror(errno));
+
+    // these three are told apart by their fd's address in g_server, clients by their struct
+    int *own_fds[] = {&g_server.listen_fd, &g_server.signal_fd, &g_server.wake_fd};
+    for (size_t i = 0; i < sizeof(own_fds) / sizeof(own_fds[0]); ++i)
+    {
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = own_fds[i]};
+        if (epoll_ctl(g_server.epoll_fd, EPOLL_CTL_ADD, *own_fds[i], &ev) != 0)
+            print_error_and_exit(1, 0, NULL, "server setup failed: %s", strerror(errno));
+    }
+}
 
-        // check if the line is exactly "<END>"
-        if (strcmp(line_buffer, "<END>") == 0)
+// Step 5 in server mode: serve clients until a shutdown signal, then drain the pipeline
+static void serve_clients(pipeline_t *pipeline)
+{
+    fprintf(stderr, "[server] listening on %s\n", g_server.path);
+    g_server.pipeline = pipeline;
+
+    int shutting_down = 0;
+    for (;;)
+    {
+        // a drop wakes nobody: look for one now and then while lines are in flight
+        pthread_mutex_lock(&g_server.mutex);
+        int timeout = g_server.tag_count > 0 ? SERVER_DROP_POLL_MS : -1;
+        pthread_mutex_unlock(&g_server.mutex);
+
+        struct epoll_event events[SERVER_MAX_EVENTS];
+        int ready = epoll_wait(g_server.epoll_fd, events, SERVER_MAX_EVENTS, timeout);
+        if (ready < 0)
         {
-            err = first_plugin->place_work("<END>"); // send it into the pipeline
-            if (err)
-                // error to stderr, exit code 1
-                print_error_and_exit(1, 0, NULL, "place_work('<END>') error: %s", err);
-            break; // Stop reading more lines
+            if (errno == EINTR)
+                continue;
+            print_error_and_exit(1, 0, NULL, "epoll_wait failed: %s", strerror(errno));
         }
 
-        // if the line is normal, send it to the pipeline
-        err = first_plugin->place_work(line_buffer);
-        if (err)
-            // returns null on success
-            print_error_and_exit(1, 0, NULL, "place_work error: %s", err);
+        for (int i = 0; i < ready; ++i)
+        {
+            void *source = events[i].data.ptr;
+            if (source == &g_server.listen_fd)
+                server_accept();
+            else if (source == &g_server.signal_fd)
+            {
+                struct signalfd_siginfo info;
+                while (read(g_server.signal_fd, &info, sizeof(info)) > 0)
+                    ;
+                if (!shutting_down)
+                {
+                    // stop taking input, let everything in flight come back
+                    shutting_down = 1;
+                    epoll_ctl(g_server.epoll_fd, EPOLL_CTL_DEL, g_server.listen_fd, NULL);
+                    for (server_client_t *client = g_server.clients; client; client = client->next)
+                    {
+                        client->in_len = 0; // lines that did not go in yet are not answered
+                        client->blocked = 0;
+                        server_stop_reading(client);
+                    }
+                    end_input(pipeline);
+                }
+            }
+            else if (source == &g_server.wake_fd)
+            {
+                uint64_t count;
+                atomic_store(&g_server.wake_pending, 0);
+                while (read(g_server.wake_fd, &count, sizeof(count)) > 0)
+                    ;
+            }
+            else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                server_client_t *client = source;
+                if (client->events & EPOLLIN) // a hangup while its input waits is read once it goes on
+                    server_read(client);
+            }
+        }
+
+        server_resync();
+        server_flush_clients(0);
+
+        pthread_mutex_lock(&g_server.mutex);
+        int finished = g_server.finished;
+        pthread_mutex_unlock(&g_server.mutex);
+        if (finished)
+            break;
     }
+    server_flush_clients(1);
+}
+
+// after pipeline_destroy: nothing calls the result callback any more
+static void server_close(void)
+{
+    while (g_server.clients)
+        server_close_client(g_server.clients);
+    close(g_server.listen_fd);
+    close(g_server.signal_fd);
+    close(g_server.wake_fd);
+    close(g_server.epoll_fd);
+    unlink(g_server.path);
+    free(g_server.tags);
+    fprintf(stderr, "[server] stopped\n");
+}
+
+// -------------------------------------------- Latency reports --------------------------------------------------------
 
-    // If input ended with an error, show it
-    if (ferror(stdin))
-        print_error_and_exit(1, 0, NULL, "stdin read error");
+// --latency: SIGUSR1 prints the latency table while the pipeline runs. The signal is blocked before
+// any thread exists (they all inherit the mask) and only this thread takes it with sigwait
+static struct
+{
+    pthread_t thread;
+    pipeline_t *pipeline;
+    sigset_t mask;
+    atomic_int stopping; // set before the last SIGUSR1, which only wakes the thread up
+    int running;
+} g_reporter;
+
+static void reporter_block_signal(void)
+{
+    sigemptyset(&g_reporter.mask);
+    sigaddset(&g_reporter.mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &g_reporter.mask, NULL);
 }
 
-// Step 6 + 7 - Wait for plugins to finish and cleanup
-static void teardown(plugin_handle_t *p, int n)
+static void *reporter_thread(void *arg)
 {
-    // loop that waits for all the plugins to finish
-    for (int i = 0; i < n; ++i)
+    (void)arg;
+    for (;;)
     {
-        // just to make sure
-        if (!p[i].wait_finished)
-            print_error_and_exit(1, 0, NULL, "plugin %d ('%s') missing wait_finished",
-                                 i, p[i].name ? p[i].name : "(null)");
+        int sig;
+        if (sigwait(&g_reporter.mask, &sig) != 0 || atomic_load(&g_reporter.stopping))
+            break;
+        pipeline_latency_report(g_reporter.pipeline, STDERR_FILENO);
+    }
+    return NULL;
+}
+
+static void reporter_start(pipeline_t *pipeline)
+{
+    g_reporter.pipeline = pipeline;
+    g_reporter.running = pthread_create(&g_reporter.thread, NULL, reporter_thread, NULL) == 0;
+}
+
+// before pipeline_destroy, the thread reads the pipeline
+static void reporter_stop(void)
+{
+    if (!g_reporter.running)
+        return;
+    atomic_store(&g_reporter.stopping, 1);
+    pthread_kill(g_reporter.thread, SIGUSR1);
+    pthread_join(g_reporter.thread, NULL);
+    g_reporter.running = 0;
+}
 
-        const char *werr = p[i].wait_finished();
-        // If there was an error string, abort the program with a clear message that includes the plugin’s name
-        if (werr)
-            print_error_and_exit(1, 0, NULL, "plugin_wait_finished(%s) error: %s",
-                                 p[i].name ? p[i].name : "(null)", werr);
+// -------------------------------------------- Metrics endpoint --------------------------------------------------------
+
+// --metrics-socket: a thread answers every connection to a Unix socket with pipeline_metrics as an
+// HTTP/1.0 response (curl --unix-socket, or the scraper's socket proxy). Clients are served one at a
+// time, a slow one is cut off by the timeouts
+#define METRICS_TIMEOUT_MS 1000
+
+static struct
+{
+    pthread_t thread;
+    pipeline_t *pipeline;
+    const char *path;
+    int listen_fd;
+    int wake_fd; // written once to stop the thread
+    int running;
+} g_metrics = {.listen_fd = -1, .wake_fd = -1};
+
+// bound before the chain loads, so a bad path fails first
+static void metrics_prepare(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        print_error_and_exit(1, 1, NULL, "--metrics-socket path too long: '%s'", path);
+    strcpy(addr.sun_path, path);
+
+    // a socket left behind by an earlier run is replaced, any other file is not
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    g_metrics.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_metrics.listen_fd < 0 || bind(g_metrics.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(g_metrics.listen_fd, SOMAXCONN) != 0)
+        print_error_and_exit(1, 1, NULL, "cannot listen on '%s': %s", path, strerror(errno));
+    g_metrics.path = path;
+    g_metrics.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (g_metrics.wake_fd < 0)
+        print_error_and_exit(1, 0, NULL, "metrics setup failed: %s", strerror(errno));
+}
+
+static void metrics_send(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return; // gone or too slow
+        data += n;
+        len -= (size_t)n;
     }
+}
 
-    // reverse loop to cleanup the piplelines safely
-    for (int i = n - 1; i >= 0; --i)
+static void metrics_serve(int fd)
+{
+    // the request is read up to its blank line (or what arrives in time) and not looked at
+    char request[2048];
+    size_t got = 0;
+    while (got < sizeof(request) - 1)
     {
-        // just to make sure
-        if (!p[i].fini)
-            print_error_and_exit(1, 0, NULL, "plugin %d ('%s') missing fini",
-                                 i, p[i].name ? p[i].name : "(null)");
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, METRICS_TIMEOUT_MS) <= 0)
+            break;
+        ssize_t n = read(fd, request + got, sizeof(request) - 1 - got);
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+
+    char *body = NULL;
+    size_t len = 0;
+    const char *err = pipeline_metrics(g_metrics.pipeline, &body, &len);
+    char header[192];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                              err ? "500 Internal Server Error" : "200 OK", err ? strlen(err) : len);
+    struct timeval timeout = {.tv_sec = METRICS_TIMEOUT_MS / 1000, .tv_usec = (METRICS_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    metrics_send(fd, header, (size_t)header_len);
+    metrics_send(fd, err ? err : body, err ? strlen(err) : len);
+    free(body);
+}
 
-        const char *ferr = p[i].fini(); // call each plugin's fini
-        // If the plugin’s finalization reports an error, abort with details
-        if (ferr)
-            print_error_and_exit(1, 0, NULL, "plugin_fini(%s) error: %s",
-                                 p[i].name ? p[i].name : "(null)", ferr);
+static void *metrics_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        struct pollfd pfd[2] = {{.fd = g_metrics.listen_fd, .events = POLLIN}, {.fd = g_metrics.wake_fd, .events = POLLIN}};
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (pfd[1].revents)
+            break;
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+        int fd = accept4(g_metrics.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        metrics_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
 
-        // Unload the shared object only after the plugin finalized
-        if (p[i].handle)
-            dlclose(p[i].handle);
+static void metrics_start(pipeline_t *pipeline)
+{
+    g_metrics.pipeline = pipeline;
+    g_metrics.running = pthread_create(&g_metrics.thread, NULL, metrics_thread, NULL) == 0;
+}
 
-        free(p[i].name); // Free the heap-allocated copy of the plugin’s name
+// before pipeline_destroy, the thread reads the pipeline
+static void metrics_stop(void)
+{
+    if (g_metrics.listen_fd < 0)
+        return;
+    if (g_metrics.running)
+    {
+        uint64_t one = 1;
+        if (write(g_metrics.wake_fd, &one, sizeof(one)) == (ssize_t)sizeof(one))
+            pthread_join(g_metrics.thread, NULL);
+        g_metrics.running = 0;
     }
+    close(g_metrics.listen_fd);
+    close(g_metrics.wake_fd);
+    unlink(g_metrics.path);
+    g_metrics.listen_fd = -1;
 }
 
 // ---------------------------------------------- Main --------------------------------------------------
@@ -446,32 +1582,88 @@ int main(int argc, char **argv)
 {
     g_prog = argv[0];
 
-    // Step 1: parse and alloc
+    // Step 1: parse
     pipeline_configuration_t cfg = {0};
-    plugin_handle_t *plugins = NULL;
-    char **names = NULL;
-    parse_command_line(argc, argv, &cfg, &plugins, &names);
-
-    // Step 2: Load Plugins Shared Objects
-    step2_load_or_exit(&cfg, names, plugins);
-
-    // Step 3: Initialize Plugins
-    init_plugin(plugins, cfg.selected_plugin_count, cfg.queue_size);
-
-    // Step 4: Attach Plugins Together
-    wire_plugins(plugins, cfg.selected_plugin_count);
-
-    // Step 5: Read Input from STDIN
-    feed_input(&plugins[0]);
+    parse_command_line(argc, argv, &cfg);
 
-    // Steps 6 + 7: Wait for Plugins to Finish and Cleanup
-    teardown(plugins, cfg.selected_plugin_count);
+    // open --input now, so a bad path fails before any plugin is loaded
+    int input_fd = STDIN_FILENO;
+    if (cfg.input)
+    {
+        input_fd = open(cfg.input, O_RDONLY | O_CLOEXEC);
+        if (input_fd < 0)
+            print_error_and_exit(1, 1, NULL, "cannot open input '%s': %s", cfg.input, strerror(errno));
+    }
 
-    // free top-level arrays allocated in main
-    free(names);
-    free(plugins);
+    // Server mode binds its socket before any thread starts
+    if (cfg.listen)
+        server_prepare(&cfg);
+    if (cfg.metrics)
+        metrics_prepare(cfg.metrics);
+    if (cfg.latency)
+        reporter_block_signal();
+
+    // Steps 1.5 - 4: optimize, load, initialize and wire the chain.
+    // Results of the last stage go to the sink (server mode routes them itself)
+    pipeline_options_t options = {
+        .queue_size = cfg.queue_size,
+        .no_optimize = !cfg.optimize,
+        .verbose = cfg.verbose,
+        .virtual_clock = cfg.virtual_clock,
+        .stats = cfg.stats,
+        .trace_latency = cfg.latency,
+        .trace_path = cfg.trace,
+        .queue_csv_path = cfg.queue_csv,
+        .queue_sample_ms = cfg.queue_interval,
+        .metrics = cfg.metrics != NULL,
+        .stage_output_fd = cfg.output == SINK_FRAMED ? STDERR_FILENO : STDOUT_FILENO, // stdout carries only frames
+        .on_result = cfg.listen ? server_result : sink_result,
+        .result_ctx = &cfg.output,
+        .drop_results = !cfg.listen && !cfg.binary && cfg.output == SINK_NONE, // --binary FLUSH counts results
+    };
+    pipeline_t *pipeline = NULL;
+    const char *err = pipeline_create(&pipeline, (const char *const *)cfg.plugin_names, cfg.selected_plugin_count, &options);
+    if (err && pipeline_failed_step() == PIPELINE_STEP_INIT)
+        // everything was rolled back, exit with code 2
+        print_error_and_exit(2, 0, "Initialize Plugins failed\n", "%s", err);
+    if (err)
+        print_error_and_exit(1, 1, "Step 2: Load Plugin Shared Objects failed\n", "%s", err);
+    if (cfg.max_line && cfg.output != SINK_NONE && !cfg.listen && !cfg.binary)
+        segments_start(pipeline, cfg.queue_size); // the sink joins the segments' results again
+    if (cfg.latency)
+        reporter_start(pipeline);
+    if (cfg.metrics)
+        metrics_start(pipeline);
+
+    // Step 5: Read Input from STDIN (or --input, mapped when it is a regular file, or socket clients)
+    if (cfg.listen)
+        serve_clients(pipeline);
+    else if (cfg.binary)
+        feed_framed_input(pipeline, input_fd);
+    else if (input_fd == STDIN_FILENO || !feed_mapped_input(pipeline, input_fd, cfg.max_line))
+        feed_input(pipeline, input_fd, cfg.max_line);
+    if (input_fd != STDIN_FILENO)
+        close(input_fd);
+    reporter_stop();
+    metrics_stop();
+
+    // Steps 6 + 7: Wait for Plugins to Finish and Cleanup (input without <END> is ended here),
+    // the last pipeline also writes the rest of the output and stops the writer
+    err = pipeline_destroy(pipeline);
+    if (err)
+        print_error_and_exit(1, 0, NULL, "%s", err);
+
+    if (cfg.listen)
+        server_close();
+    free(g_segments.continues);
+
+    // what the delays would have cost without --virtual-clock
+    if (cfg.virtual_clock)
+        fprintf(stderr, "[clock] virtual clock skipped %lld ms of plugin delays\n",
+                pipeline_clock_skipped_ns() / 1000000LL);
 
     // Step 8: Finalize
-    printf("Pipeline shutdown complete\n");
+    // framed output keeps stdout for frames only
+    fprintf(cfg.output == SINK_FRAMED ? stderr : stdout, "Pipeline shutdown complete\n");
     return 0; // exit with code 0
-}
\ No newline at end of file
+}
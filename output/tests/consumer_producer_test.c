@@ -174,6 +174,18 @@ static int t15_no_spurious_null_get(){
   consumer_producer_destroy(&q);
   return !ok;
 }
+static int t16_put_view_rotates(){
+  consumer_producer_t q; consumer_producer_init(&q,4);
+  consumer_producer_put_view(&q,"hello",5,4);
+  consumer_producer_put_view(&q,"hello",5,0);
+  consumer_producer_put_view(&q,"hello",5,5);
+  int bad = consumer_producer_put_view(&q,"hello",5,6)==NULL;
+  char *a=consumer_producer_get(&q), *b=consumer_producer_get(&q), *c=consumer_producer_get(&q);
+  int ok = !bad && a && strcmp(a,"ohell")==0 && b && strcmp(b,"hello")==0 && c && strcmp(c,"hello")==0;
+  free(a); free(b); free(c);
+  consumer_producer_destroy(&q);
+  return !ok;
+}
 
 int main(int argc, char**argv){
   if (argc<2){ fprintf(stderr,"need test name\n"); return 2; }
@@ -194,6 +206,7 @@ int main(int argc, char**argv){
     {"t13_capacity_wraparound",t13_capacity_wraparound},
     {"t14_many_small_ops",t14_many_small_ops},
     {"t15_no_spurious_null_get",t15_no_spurious_null_get},
+    {"t16_put_view_rotates",t16_put_view_rotates},
   };
   for (size_t i=0;i<sizeof(cases)/sizeof(cases[0]);++i){
     if (strcmp(t,cases[i].name)==0) return cases[i].fn();
@@ -0,0 +1,2350 @@
+#define _GNU_SOURCE // dlmopen
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/uio.h>
+
+#include "pipeline.h"
+#include "plugins/plugin_sdk.h" // the contract
+
+// Bonus - Sets a compile-time flag that checks if we can use dlmopen
+#if defined(__GLIBC__)
+#include <link.h> // used by dlmopen
+#define DLMOPEN_SUPPORTED 1
+#else
+#define DLMOPEN_SUPPORTED 0
+#endif
+
+// Bonus - Allow turning choosing dlmopen / dlopen at runtime
+#define DLMOPEN_ENV_VAR "ANALYZER_DLMOPEN"
+static int use_dlmopen(void)
+{
+#if !DLMOPEN_SUPPORTED
+    return 0; // Not available, shouldnt happen on ubuntu
+#else
+    const char *val = getenv(DLMOPEN_ENV_VAR);
+    return (val == NULL) || (strcmp(val, "0") != 0);
+#endif
+}
+
+// One stage of the chain, as given to pipeline_create or as rewritten by the optimizer
+typedef struct
+{
+    const char *name;      // plugin name (points into the caller's names or is a literal)
+    const char *param_key; // optional parameter passed through plugin_set_param (NULL = none)
+    long param_value;      // value for param_key
+} pipeline_stage_t;
+
+// Step 2 - function pointer typedefs matching plugin_sdk.h so dlsym casts are type-safe
+typedef const char *(*plugin_init_func_t)(int queue_size);
+typedef const char *(*plugin_fini_func_t)(void);
+typedef const char *(*plugin_place_work_func_t)(const char *str);
+typedef void (*plugin_attach_func_t)(const char *(*next_place_work)(const char *));
+typedef const char *(*plugin_wait_finished_func_t)(void);
+typedef const char *(*plugin_set_param_func_t)(const char *key, long value);
+typedef const char *(*plugin_set_host_func_t)(const plugin_host_t *host);
+typedef const char *(*plugin_place_work_view_func_t)(const char *base, size_t len, size_t offset);
+typedef void (*plugin_attach_view_func_t)(plugin_place_work_view_func_t next_place_work_view);
+typedef const char *(*plugin_get_stats_func_t)(plugin_stats_t *out);
+
+// Step 2 - Copied from instructions (Stores the plugins .so)
+typedef struct
+{
+    plugin_init_func_t init;
+    plugin_fini_func_t fini;
+    plugin_place_work_func_t place_work;
+    plugin_attach_func_t attach;
+    plugin_wait_finished_func_t wait_finished;
+    plugin_set_param_func_t set_param;             // optional, NULL if the plugin takes no parameters
+    plugin_set_host_func_t set_host;               // optional, receives the host services
+    plugin_place_work_view_func_t place_work_view; // optional, takes circular views
+    plugin_attach_view_func_t attach_view;         // optional, forwards circular views
+    plugin_get_stats_func_t get_stats;             // optional, runtime statistics
+    char *name;
+    void *handle;
+    int builtin; // 1 + index in the static registry when linked in, 0 when loaded from a .so
+} plugin_handle_t;
+
+// Results kept for pipeline_pop: a ring of malloc'd copies, growing as needed (the stage queues
+// already bound how fast results arrive, the caller decides how many it lets pile up)
+typedef struct
+{
+    char *data;
+    size_t len;
+} pipeline_result_t;
+
+// Latency histogram, HDR style: 32 linear steps per power of two, so every value is kept within ~3%.
+// Each one has a single writer (a stage thread), readers (a report on a signal) may look at any time
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+typedef struct
+{
+    atomic_ullong counts[LATENCY_BUCKETS];
+    atomic_ullong total;
+    atomic_ullong sum_ns; // exact, for the metrics summary's _sum
+    atomic_ullong max_ns;
+} latency_histogram_t;
+
+// Timeline of one thread (--trace): spans appended by that thread only, in chunks, so nothing is
+// locked or moved while it runs. Written out once the stages are done
+#define TIMELINE_CHUNK_SPANS 4096
+#define TIMELINE_MAX_SPANS (1 << 18) // per thread (~25 MB of JSON), later spans are only counted
+#define TIMELINE_SPAN_PUSH (PLUGIN_SPAN_PUT + 1) // the input thread's pipeline_push, after the plugin_span_kind_t kinds
+
+typedef struct
+{
+    unsigned long long begin_ns, end_ns;
+    int kind;
+} timeline_span_t;
+
+typedef struct timeline_chunk
+{
+    struct timeline_chunk *next;
+    int used;
+    timeline_span_t spans[TIMELINE_CHUNK_SPANS];
+} timeline_chunk_t;
+
+typedef struct
+{
+    timeline_chunk_t *head, *tail;
+    size_t total;
+    unsigned long long dropped;
+} timeline_track_t;
+
+// Queue sampler (queue_csv_path): a thread reads every stage's input queue each period into a CSV
+// time series and tallies how often each one was full or empty
+typedef struct
+{
+    unsigned long long samples;
+    unsigned long long full;  // samples with the queue at capacity
+    unsigned long long empty; // samples with nothing queued
+    unsigned long long depth_sum;
+    unsigned long long full_waits, empty_waits; // last counts read
+} queue_tally_t;
+
+typedef struct
+{
+    FILE *csv;
+    long long interval_ns;
+    long long origin_ns;  // time_ms 0 in the file
+    queue_tally_t *tally; // per stage, guarded by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t wake; // on CLOCK_MONOTONIC, signaled to stop
+    int stopping;
+    int running;
+    pthread_t thread;
+} queue_sampler_t;
+
+// a result on its way through the chain: when it was ready and when its message was pushed
+typedef struct
+{
+    unsigned long long exit_ns, ingest_ns;
+} latency_mark_t;
+
+// Every stage gets its own copy of the host services: it carries its pipeline's settings (collect_stats),
+// and trace_exit and trace_span find their way back from it
+typedef struct
+{
+    plugin_host_t host; // first, the plugin hands this pointer back
+    pipeline_t *pipeline;
+    int stage;
+    int silent;                  // no plugin_set_host, never reports: the next reporting stage covers it
+    atomic_int reports;          // trace_exit was called, set before the first result is handed on
+    latency_mark_t *marks;       // ring: result n of this stage, read by the later stages
+    unsigned long long results;  // results reported so far (stage thread only)
+    latency_histogram_t latency; // entered this stage's queue -> result ready
+    timeline_track_t timeline;   // the stage thread's spans
+} stage_host_t;
+
+struct pipeline
+{
+    plugin_handle_t *plugins;
+    int count;
+    int slot; // index of the collector trampoline behind the last stage, -1 with drop_results
+    int ended;
+
+    pipeline_result_func_t on_result;
+    void *result_ctx;
+
+    char *scratch; // terminated copy for a first stage without place_work_view, reused
+    size_t scratch_size;
+
+    int stats;          // print the stage statistics at destroy
+    int latency_report; // print the latency table at destroy
+
+    stage_host_t *stage_hosts; // one per stage, handed to plugin_set_host
+
+    // latency tracing (NULL when off): every stage keeps results in input order, so input n of a stage is
+    // result n of the stage before it (push n for the first) and the marks travel beside it in rings indexed
+    // by n. A stage drops an input by skipping its number, a silent stage is assumed to drop nothing
+    latency_histogram_t *end_to_end; // pipeline_push -> result of the last stage that can report ready
+    unsigned long long *ingest_ns;   // ring: when message n was pushed
+    size_t ring_mask;                // ring sizes - 1, big enough for everything that can be in flight
+    int latency_last;                // the last stage that is not silent, -1 when none is
+
+    // timeline (NULL when off)
+    FILE *timeline_file;
+    unsigned long long timeline_origin_ns; // ts 0 in the file
+    timeline_track_t input_timeline;       // pipeline_push calls
+
+    queue_sampler_t *sampler; // NULL when off
+
+    pthread_mutex_t mutex; // the result ring and sleeping (the collector runs on the last stage's thread)
+    pthread_cond_t changed;
+    atomic_ullong pushed;    // messages sent into the first stage
+    atomic_ullong collected; // results that came out of the last stage
+    atomic_ullong dropped;   // messages a stage gave no result for (message_dropped)
+    atomic_int waiters;      // flush / pop callers waiting on changed
+    int finished;            // the collector saw <END>
+    pipeline_result_t *results;
+    size_t result_head, result_count, result_cap;
+};
+
+// Errors: formatted into a per-thread buffer, so the messages can carry names like the analyzer's always did
+static _Thread_local char g_error[1024];
+static _Thread_local pipeline_step_t g_failed_step = PIPELINE_STEP_NONE;
+
+static const char *pipeline_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static const char *pipeline_error(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(g_error, sizeof g_error, fmt, ap);
+    va_end(ap);
+    return g_error;
+}
+
+pipeline_step_t pipeline_failed_step(void)
+{
+    return g_failed_step;
+}
+
+// -------------------------------------------- Host services --------------------------------------------------------
+
+// One stdout lock for every stage. Plugins loaded with dlmopen each have their own libc,
+// so a lock they could share has to live here
+static pthread_mutex_t g_output_mutex;
+
+// The host's locks and condition variables are taken on stage threads, which the plugins' own libc
+// copies (dlmopen namespaces) start and the host's libc knows nothing about. Process-shared objects
+// only rely on the shared futex word, never on the calling thread's libc state, so every lock the
+// host or a client of the library hands to those threads is made pshared (host_cond_init too)
+static int host_mutex_init(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attr;
+    if (pthread_mutexattr_init(&attr) != 0)
+        return -1;
+    int rc = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (rc == 0)
+        rc = pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+static void host_output_lock(void)
+{
+    pthread_mutex_lock(&g_output_mutex);
+}
+
+static void host_output_unlock(void)
+{
+    pthread_mutex_unlock(&g_output_mutex);
+}
+
+// Output service: stages push records into a lock-free MPSC queue (Vyukov's intrusive design)
+// and a single writer thread drains it into stdout with large writev calls.
+// A session (output_begin .. output_end) reserves stdout for one source, the writer parks
+// other sources' records meanwhile and replays them, in arrival order, when the session ends
+// Queued bytes are bounded: past OUTPUT_MAX_PENDING, sources other than the session owner wait for
+// the writer (a typing session would otherwise park everything the other stages print meanwhile)
+#define OUTPUT_BATCH_IOV 64 // records per writev
+#define OUTPUT_MAX_PENDING (16 * 1024 * 1024)
+
+typedef enum
+{
+    OUTPUT_DATA,
+    OUTPUT_BEGIN,
+    OUTPUT_END
+} output_kind_t;
+
+typedef struct output_record
+{
+    _Atomic(struct output_record *) next;
+    const void *source;
+    output_kind_t kind;
+    int fd; // where a data record goes
+    size_t len;
+    char data[];
+} output_record_t;
+
+static struct
+{
+    _Atomic(output_record_t *) head; // producers push here
+    output_record_t *tail;           // writer pops here
+    output_record_t stub;
+
+    atomic_ullong submitted; // records pushed so far
+    atomic_ullong processed; // records the writer is done with
+    atomic_ullong pending_bytes;  // data bytes submitted and not written yet (parked ones included)
+    atomic_ullong lost;      // data records dropped because their copy could not be allocated
+    _Atomic(const void *) owner;  // source of the open session, as the writer sees it
+    atomic_int sleeping;     // writer is (about to be) waiting on wake
+    atomic_int flush_waiters;
+    atomic_int space_waiters; // sources blocked on OUTPUT_MAX_PENDING
+    atomic_int stopping;
+    int running;
+    int text_fd; // where the stages' records go (stderr when stdout carries frames)
+
+    pthread_mutex_t mutex; // only for sleeping / waking, never held while writing
+    pthread_cond_t wake;
+    pthread_cond_t drained;
+    pthread_cond_t space; // pending_bytes dropped or the session owner changed
+    pthread_t thread;
+} g_output;
+
+static int host_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0)
+        return -1;
+    int rc = pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (rc == 0)
+        rc = pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+static void output_push(output_record_t *rec)
+{
+    atomic_store_explicit(&rec->next, NULL, memory_order_relaxed);
+    output_record_t *prev = atomic_exchange(&g_output.head, rec);
+    atomic_store_explicit(&prev->next, rec, memory_order_release);
+}
+
+// NULL when empty, or when a push is half done (its producer links it in a moment)
+static output_record_t *output_pop(void)
+{
+    output_record_t *tail = g_output.tail;
+    output_record_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &g_output.stub)
+    {
+        if (!next)
+            return NULL;
+        g_output.tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next)
+    {
+        g_output.tail = next;
+        return tail;
+    }
+    if (tail != atomic_load(&g_output.head))
+        return NULL;
+
+    // tail is the last record: put the stub behind it so it can be taken
+    output_push(&g_output.stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next)
+    {
+        g_output.tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int output_queue_empty(void)
+{
+    return g_output.tail == &g_output.stub && atomic_load(&g_output.head) == &g_output.stub;
+}
+
+static void output_submit(output_record_t *rec)
+{
+    atomic_fetch_add(&g_output.submitted, 1);
+    output_push(rec);
+    if (atomic_load(&g_output.sleeping))
+    {
+        pthread_mutex_lock(&g_output.mutex);
+        pthread_cond_signal(&g_output.wake);
+        pthread_mutex_unlock(&g_output.mutex);
+    }
+}
+
+// a lost OUTPUT_END would leave the session open and park every other source for good,
+// so a marker waits for memory instead of being dropped
+static void output_submit_marker(const void *source, output_kind_t kind)
+{
+    output_record_t *rec;
+    while ((rec = malloc(sizeof(*rec))) == NULL)
+    {
+        struct timespec retry = {.tv_sec = 0, .tv_nsec = 1000000};
+        nanosleep(&retry, NULL);
+    }
+    rec->source = source;
+    rec->kind = kind;
+    rec->len = 0;
+    output_submit(rec);
+}
+
+// backpressure: wait while too much is queued, unless source owns the session (it has to be able to end it)
+static void output_wait_space(const void *source)
+{
+    if (atomic_load(&g_output.pending_bytes) < OUTPUT_MAX_PENDING || atomic_load(&g_output.owner) == source)
+        return;
+    atomic_fetch_add(&g_output.space_waiters, 1);
+    pthread_mutex_lock(&g_output.mutex);
+    while (atomic_load(&g_output.pending_bytes) >= OUTPUT_MAX_PENDING && atomic_load(&g_output.owner) != source &&
+           !atomic_load(&g_output.stopping))
+        pthread_cond_wait(&g_output.space, &g_output.mutex);
+    pthread_mutex_unlock(&g_output.mutex);
+    atomic_fetch_sub(&g_output.space_waiters, 1);
+}
+
+static void output_writev_fd(const void *source, int fd, const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+    if (len == 0)
+        return;
+    output_wait_space(source);
+
+    output_record_t *rec = malloc(sizeof(*rec) + len);
+    if (!rec)
+    {
+        // out of memory: the record is dropped and counted (pipeline_output_records_lost_total), the stage keeps running
+        atomic_fetch_add(&g_output.lost, 1);
+        return;
+    }
+    rec->source = source;
+    rec->kind = OUTPUT_DATA;
+    rec->fd = fd;
+    rec->len = len;
+    size_t at = 0;
+    for (int i = 0; i < iovcnt; at += iov[i].iov_len, ++i)
+        memcpy(rec->data + at, iov[i].iov_base, iov[i].iov_len);
+    atomic_fetch_add(&g_output.pending_bytes, len);
+    output_submit(rec);
+}
+
+static void host_output_writev(const void *source, const struct iovec *iov, int iovcnt)
+{
+    output_writev_fd(source, g_output.text_fd, iov, iovcnt);
+}
+
+static void host_output_begin(const void *source)
+{
+    output_submit_marker(source, OUTPUT_BEGIN);
+}
+
+static void host_output_end(const void *source)
+{
+    output_submit_marker(source, OUTPUT_END);
+}
+
+// write all iovecs to fd, retrying short writes
+static void write_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return; // stdout is gone, nothing useful left to do
+        }
+
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= (ssize_t)iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+}
+
+// Writer-side state, only touched by the writer thread
+typedef struct
+{
+    output_record_t *pending_head; // records taken from the queue, not yet handled
+    output_record_t *pending_tail;
+    output_record_t *parked_head; // other sources' records held back during a session
+    output_record_t *parked_tail;
+    const void *owner; // source of the open session, NULL if none
+
+    struct iovec iov[OUTPUT_BATCH_IOV];
+    output_record_t *batch[OUTPUT_BATCH_IOV];
+    int batch_len;
+    int batch_fd;
+} output_writer_t;
+
+static void writer_append(output_record_t **head, output_record_t **tail, output_record_t *rec)
+{
+    atomic_store_explicit(&rec->next, NULL, memory_order_relaxed);
+    if (*tail)
+        atomic_store_explicit(&(*tail)->next, rec, memory_order_relaxed);
+    else
+        *head = rec;
+    *tail = rec;
+}
+
+static void writer_done(unsigned long long count, unsigned long long bytes)
+{
+    atomic_fetch_add(&g_output.processed, count);
+    atomic_fetch_sub(&g_output.pending_bytes, bytes);
+    if (atomic_load(&g_output.flush_waiters) || atomic_load(&g_output.space_waiters))
+    {
+        pthread_mutex_lock(&g_output.mutex);
+        pthread_cond_broadcast(&g_output.drained);
+        pthread_cond_broadcast(&g_output.space);
+        pthread_mutex_unlock(&g_output.mutex);
+    }
+}
+
+// the session owner never waits for space, the waiters re-check when it changes
+static void writer_set_owner(output_writer_t *w, const void *owner)
+{
+    w->owner = owner;
+    atomic_store(&g_output.owner, owner);
+}
+
+// one writev for everything batched (under the legacy lock, for plugins that still write themselves)
+static void writer_flush_batch(output_writer_t *w)
+{
+    if (w->batch_len == 0)
+        return;
+    pthread_mutex_lock(&g_output_mutex);
+    write_all(w->batch_fd, w->iov, w->batch_len);
+    pthread_mutex_unlock(&g_output_mutex);
+    unsigned long long bytes = 0;
+    for (int i = 0; i < w->batch_len; ++i)
+    {
+        bytes += w->batch[i]->len;
+        free(w->batch[i]);
+    }
+    writer_done((unsigned long long)w->batch_len, bytes);
+    w->batch_len = 0;
+}
+
+static void writer_handle(output_writer_t *w, output_record_t *rec)
+{
+    if (w->owner && rec->source != w->owner)
+    {
+        writer_append(&w->parked_head, &w->parked_tail, rec);
+        return;
+    }
+
+    if (rec->kind == OUTPUT_DATA)
+    {
+        if (w->batch_len == OUTPUT_BATCH_IOV || (w->batch_len > 0 && w->batch_fd != rec->fd))
+            writer_flush_batch(w);
+        w->batch_fd = rec->fd;
+        w->iov[w->batch_len] = (struct iovec){.iov_base = rec->data, .iov_len = rec->len};
+        w->batch[w->batch_len++] = rec;
+        return;
+    }
+
+    if (rec->kind == OUTPUT_BEGIN)
+        writer_set_owner(w, rec->source);
+    else
+    {
+        // session over: parked records came before anything still pending, handle them first
+        writer_set_owner(w, NULL);
+        if (w->parked_head)
+        {
+            atomic_store_explicit(&w->parked_tail->next, w->pending_head, memory_order_relaxed);
+            if (!w->pending_head)
+                w->pending_tail = w->parked_tail;
+            w->pending_head = w->parked_head;
+            w->parked_head = w->parked_tail = NULL;
+        }
+    }
+    free(rec);
+    writer_done(1, 0);
+}
+
+static void *output_writer_thread(void *arg)
+{
+    (void)arg;
+    output_writer_t w = {0};
+    for (;;)
+    {
+        // take everything queued so far, then handle it in order
+        output_record_t *rec;
+        while ((rec = output_pop()) != NULL)
+            writer_append(&w.pending_head, &w.pending_tail, rec);
+        while (w.pending_head)
+        {
+            rec = w.pending_head;
+            w.pending_head = atomic_load_explicit(&rec->next, memory_order_relaxed);
+            if (!w.pending_head)
+                w.pending_tail = NULL;
+            writer_handle(&w, rec);
+        }
+
+        if (!output_queue_empty())
+        {
+            if (w.batch_len == OUTPUT_BATCH_IOV)
+                writer_flush_batch(&w);
+            sched_yield(); // a producer is between its two push steps
+            continue;
+        }
+
+        // nothing more right now: what we have goes out before we wait
+        writer_flush_batch(&w);
+
+        pthread_mutex_lock(&g_output.mutex);
+        atomic_store(&g_output.sleeping, 1);
+        while (output_queue_empty() && !atomic_load(&g_output.stopping))
+            pthread_cond_wait(&g_output.wake, &g_output.mutex);
+        atomic_store(&g_output.sleeping, 0);
+        int stop = atomic_load(&g_output.stopping) && output_queue_empty();
+        pthread_mutex_unlock(&g_output.mutex);
+        if (stop)
+            break;
+    }
+
+    // a session that was never ended must not swallow the records parked behind it
+    writer_set_owner(&w, NULL);
+    while (w.parked_head)
+    {
+        output_record_t *rec = w.parked_head;
+        w.parked_head = atomic_load_explicit(&rec->next, memory_order_relaxed);
+        writer_handle(&w, rec);
+    }
+    writer_flush_batch(&w);
+    return NULL;
+}
+
+// block until everything queued before this call is written
+static void host_output_flush(void)
+{
+    if (!g_output.running)
+        return;
+    unsigned long long target = atomic_load(&g_output.submitted);
+
+    atomic_fetch_add(&g_output.flush_waiters, 1);
+    pthread_mutex_lock(&g_output.mutex);
+    while (atomic_load(&g_output.processed) < target)
+    {
+        pthread_cond_signal(&g_output.wake);
+        pthread_cond_wait(&g_output.drained, &g_output.mutex);
+    }
+    pthread_mutex_unlock(&g_output.mutex);
+    atomic_fetch_sub(&g_output.flush_waiters, 1);
+}
+
+static int host_output_start(void)
+{
+    atomic_store(&g_output.stub.next, NULL);
+    atomic_store(&g_output.head, &g_output.stub);
+    g_output.tail = &g_output.stub;
+    atomic_store(&g_output.stopping, 0); // a later pipeline may start it again
+    if (host_mutex_init(&g_output.mutex) != 0 || host_cond_init(&g_output.wake) != 0 ||
+        host_cond_init(&g_output.drained) != 0 || host_cond_init(&g_output.space) != 0)
+        return -1;
+    if (pthread_create(&g_output.thread, NULL, output_writer_thread, NULL) != 0)
+        return -1;
+    g_output.running = 1;
+    return 0;
+}
+
+// after the last stage is gone: write what is left and stop the writer
+static void host_output_stop(void)
+{
+    if (!g_output.running)
+        return;
+    host_output_flush();
+    pthread_mutex_lock(&g_output.mutex);
+    atomic_store(&g_output.stopping, 1);
+    pthread_cond_signal(&g_output.wake);
+    pthread_cond_broadcast(&g_output.space);
+    pthread_mutex_unlock(&g_output.mutex);
+    pthread_join(g_output.thread, NULL);
+    g_output.running = 0;
+}
+
+// Host clock. In virtual mode sleeping jumps the clock forward instead of blocking,
+// g_virtual_offset_ns is how far the virtual clock runs ahead of the real one
+static int g_virtual_clock = 0;
+static atomic_llong g_virtual_offset_ns = 0;
+
+static long long real_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long host_now_ns(void)
+{
+    return real_now_ns() + atomic_load(&g_virtual_offset_ns);
+}
+
+static void host_sleep_until_ns(long long deadline_ns)
+{
+    if (!g_virtual_clock)
+    {
+        struct timespec deadline = {.tv_sec = (time_t)(deadline_ns / 1000000000LL), .tv_nsec = (long)(deadline_ns % 1000000000LL)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0)
+            ; // interrupted - sleep again until the same deadline
+        return;
+    }
+
+    // move the clock up to the deadline; concurrent sleepers only ever push it further
+    long long offset = atomic_load(&g_virtual_offset_ns);
+    for (;;)
+    {
+        long long ahead = deadline_ns - (real_now_ns() + offset);
+        if (ahead <= 0)
+            return;
+        if (atomic_compare_exchange_weak(&g_virtual_offset_ns, &offset, offset + ahead))
+            return;
+    }
+}
+
+// a stage gave no result for a message: a flush waiting for it stops waiting
+static void host_message_dropped(const plugin_host_t *host)
+{
+    pipeline_t *p = ((const stage_host_t *)host)->pipeline;
+    atomic_fetch_add(&p->dropped, 1);
+    if (atomic_load(&p->waiters))
+    {
+        pthread_mutex_lock(&p->mutex);
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->mutex);
+    }
+}
+
+// the services every plugin that exports plugin_set_host gets, in a copy per stage (see stage_host_t)
+static plugin_host_t g_host_services = {
+    .size = sizeof(plugin_host_t),
+    .output_lock = host_output_lock,
+    .output_unlock = host_output_unlock,
+    .now_ns = host_now_ns,
+    .sleep_until_ns = host_sleep_until_ns,
+    .output_writev = host_output_writev,
+    .output_begin = host_output_begin,
+    .output_end = host_output_end,
+    .output_flush = host_output_flush,
+    .message_dropped = host_message_dropped,
+};
+
+// The services are process-wide: the first pipeline starts them, the last one stops them
+static pthread_once_t g_services_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_services_mutex; // users, the collector slots
+static int g_services_ok = 0;
+static int g_services_users = 0;
+
+static void host_services_once(void)
+{
+    g_services_ok = host_mutex_init(&g_services_mutex) == 0 && host_mutex_init(&g_output_mutex) == 0;
+}
+
+// set up the state behind g_host_services, before the first plugin is loaded
+static const char *host_services_acquire(const pipeline_options_t *options)
+{
+    pthread_once(&g_services_once, host_services_once);
+    if (!g_services_ok)
+        return pipeline_error("host output lock init failed");
+
+    const char *err = NULL;
+    pthread_mutex_lock(&g_services_mutex);
+    if (g_services_users == 0)
+    {
+        g_output.text_fd = options->stage_output_fd >= 0 ? options->stage_output_fd : STDOUT_FILENO;
+        g_virtual_clock = options->virtual_clock;
+        if (host_output_start() != 0)
+            err = pipeline_error("host output writer start failed");
+    }
+    if (!err)
+        ++g_services_users;
+    pthread_mutex_unlock(&g_services_mutex);
+    return err;
+}
+
+// after a pipeline's stages are gone: the last one out writes the rest and stops the writer
+static void host_services_release(void)
+{
+    pthread_mutex_lock(&g_services_mutex);
+    if (--g_services_users == 0)
+        host_output_stop();
+    pthread_mutex_unlock(&g_services_mutex);
+}
+
+void pipeline_output_write(int fd, const struct iovec *iov, int iovcnt)
+{
+    if (!g_output.running)
+    {
+        // no pipeline: nothing to keep in order with, write it right away
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            struct iovec piece = iov[i];
+            write_all(fd, &piece, 1);
+        }
+        return;
+    }
+    output_writev_fd(&g_services_users, fd, iov, iovcnt); // one source for every client record
+}
+
+void pipeline_output_flush(void)
+{
+    host_output_flush();
+}
+
+long long pipeline_clock_skipped_ns(void)
+{
+    return atomic_load(&g_virtual_offset_ns);
+}
+
+// -------------------------------------------- Latency tracing --------------------------------------------------------
+
+static int latency_bucket(unsigned long long ns)
+{
+    if (ns < LATENCY_SUB_COUNT)
+        return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    return ((shift + 1) << LATENCY_SUB_BITS) + (int)((ns >> shift) & (LATENCY_SUB_COUNT - 1));
+}
+
+// highest value that lands in bucket (what a percentile reports, so it never understates)
+static unsigned long long latency_bucket_top(int bucket)
+{
+    if (bucket < LATENCY_SUB_COUNT)
+        return (unsigned long long)bucket;
+    int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    unsigned long long base = (unsigned long long)(LATENCY_SUB_COUNT + (bucket & (LATENCY_SUB_COUNT - 1))) << shift;
+    return base + ((1ULL << shift) - 1);
+}
+
+// single writer: a plain load + store, no locked add per message
+static void latency_bump(atomic_ullong *counter, unsigned long long value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static void latency_record(latency_histogram_t *h, unsigned long long ns)
+{
+    latency_bump(&h->counts[latency_bucket(ns)], 1);
+    latency_bump(&h->total, 1);
+    latency_bump(&h->sum_ns, ns);
+    if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed))
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+}
+
+// value below which a fraction q of the recorded latencies fall, 0 when nothing was recorded
+static unsigned long long latency_percentile(const latency_histogram_t *h, double q)
+{
+    unsigned long long total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    unsigned long long rank = (unsigned long long)(q * (double)total + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; ++b)
+    {
+        seen += atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+        if (seen >= rank)
+        {
+            unsigned long long top = latency_bucket_top(b);
+            unsigned long long max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+            return top < max ? top : max;
+        }
+    }
+    return atomic_load_explicit(&h->max_ns, memory_order_relaxed); // counts moved on while we read
+}
+
+// the result of the stage's input seq is ready: that input was result seq of the nearest earlier stage that
+// reports (or push seq), stages in between that never report are counted into this one. The mark is stored
+// before the result is handed on, so the later stages always find it in the ring
+static void host_trace_exit(const plugin_host_t *host, unsigned long long seq)
+{
+    stage_host_t *t = (stage_host_t *)host;
+    pipeline_t *p = t->pipeline;
+    unsigned long long now = (unsigned long long)real_now_ns();
+
+    int from = t->stage - 1;
+    while (from >= 0 && !atomic_load_explicit(&p->stage_hosts[from].reports, memory_order_acquire))
+        --from;
+    latency_mark_t entered;
+    if (from >= 0)
+        entered = p->stage_hosts[from].marks[seq & p->ring_mask];
+    else
+        entered.exit_ns = entered.ingest_ns = p->ingest_ns[seq & p->ring_mask];
+
+    if (t->results == 0)
+        atomic_store_explicit(&t->reports, 1, memory_order_release);
+    t->marks[t->results++ & p->ring_mask] = (latency_mark_t){.exit_ns = now, .ingest_ns = entered.ingest_ns};
+    latency_record(&t->latency, now - entered.exit_ns);
+    if (t->stage == p->latency_last)
+        latency_record(p->end_to_end, now - entered.ingest_ns);
+}
+
+// after loading: a stage without plugin_set_host never gets trace_exit
+static void latency_find_silent(pipeline_t *p)
+{
+    p->latency_last = -1;
+    for (int i = 0; i < p->count; ++i)
+        if (!(p->stage_hosts[i].silent = !p->plugins[i].set_host))
+            p->latency_last = i;
+}
+
+static size_t ring_size_for(unsigned long long in_flight)
+{
+    size_t size = 2;
+    while (size < in_flight)
+        size <<= 1;
+    return size;
+}
+
+// the rings. A message is at most queue_size + 2 results ahead of the next stage (its queue, the one
+// being processed, the one blocked in put), and the whole chain at most holds count times that: a ring is
+// read by any later stage, when the ones in between are silent
+static const char *latency_start(pipeline_t *p, int queue_size)
+{
+    unsigned long long per_stage = (unsigned long long)queue_size + 2;
+    p->ring_mask = ring_size_for(per_stage * (unsigned long long)p->count + 1) - 1;
+    p->latency_last = p->count - 1;
+
+    p->end_to_end = calloc(1, sizeof(latency_histogram_t));
+    p->ingest_ns = calloc(p->ring_mask + 1, sizeof(unsigned long long));
+    if (!p->end_to_end || !p->ingest_ns)
+        return pipeline_error("out of memory for latency tracing");
+
+    for (int i = 0; i < p->count; ++i)
+    {
+        stage_host_t *t = &p->stage_hosts[i];
+        t->host.trace_exit = host_trace_exit;
+        if (!(t->marks = calloc(p->ring_mask + 1, sizeof(latency_mark_t))))
+            return pipeline_error("out of memory for latency tracing");
+    }
+    return NULL;
+}
+
+// -------------------------------------------- Timeline --------------------------------------------------------
+
+static void timeline_append(timeline_track_t *track, int kind, unsigned long long begin_ns, unsigned long long end_ns)
+{
+    if (track->total >= TIMELINE_MAX_SPANS)
+    {
+        ++track->dropped;
+        return;
+    }
+    if (!track->tail || track->tail->used == TIMELINE_CHUNK_SPANS)
+    {
+        timeline_chunk_t *chunk = malloc(sizeof(*chunk));
+        if (!chunk)
+        {
+            ++track->dropped;
+            return;
+        }
+        chunk->next = NULL;
+        chunk->used = 0;
+        if (track->tail)
+            track->tail->next = chunk;
+        else
+            track->head = chunk;
+        track->tail = chunk;
+    }
+    track->tail->spans[track->tail->used++] = (timeline_span_t){.begin_ns = begin_ns, .end_ns = end_ns, .kind = kind};
+    ++track->total;
+}
+
+// kind comes from the plugin: a span of no plugin_span_kind_t is not recorded, only counted as dropped
+static void host_trace_span(const plugin_host_t *host, int kind, unsigned long long begin_ns, unsigned long long end_ns)
+{
+    stage_host_t *t = (stage_host_t *)host;
+    if (kind < PLUGIN_SPAN_GET || kind > PLUGIN_SPAN_PUT)
+    {
+        ++t->timeline.dropped;
+        return;
+    }
+    timeline_append(&t->timeline, kind, begin_ns, end_ns);
+}
+
+static void timeline_free(timeline_track_t *track)
+{
+    while (track->head)
+    {
+        timeline_chunk_t *next = track->head->next;
+        free(track->head);
+        track->head = next;
+    }
+    track->tail = NULL;
+}
+
+// the file is opened up front, so a bad path fails pipeline_create and not the end of a long run
+static const char *timeline_start(pipeline_t *p, const char *path)
+{
+    if (!(p->timeline_file = fopen(path, "w")))
+        return pipeline_error("cannot open trace file '%s': %s", path, strerror(errno));
+    p->timeline_origin_ns = (unsigned long long)real_now_ns();
+    for (int i = 0; i < p->count; ++i)
+        p->stage_hosts[i].host.trace_span = host_trace_span;
+    return NULL;
+}
+
+static void timeline_write_track(FILE *f, const pipeline_t *p, const timeline_track_t *track, int tid, const char *name, int *first)
+{
+    static const char *const kind_names[] = {"get", "process", "put", "push"};
+
+    fprintf(f, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", tid, name);
+    fprintf(f, ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}", tid, tid);
+    *first = 0;
+
+    for (const timeline_chunk_t *c = track->head; c; c = c->next)
+    {
+        for (int i = 0; i < c->used; ++i)
+        {
+            const timeline_span_t *span = &c->spans[i];
+            unsigned long long begin = span->begin_ns > p->timeline_origin_ns ? span->begin_ns - p->timeline_origin_ns : 0;
+            unsigned long long end = span->end_ns > p->timeline_origin_ns ? span->end_ns - p->timeline_origin_ns : 0;
+            fprintf(f, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                    tid, kind_names[span->kind], begin / 1000, begin % 1000, (end - begin) / 1000, (end - begin) % 1000);
+        }
+    }
+    if (track->dropped)
+        fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":\"%llu spans dropped\",\"ts\":0}",
+                tid, track->dropped);
+}
+
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev): the input as thread 0, stage i as thread i + 1.
+// Called once every stage finished, nothing writes the tracks any more
+static const char *timeline_write(pipeline_t *p)
+{
+    FILE *f = p->timeline_file;
+    p->timeline_file = NULL;
+    int first = 1;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    timeline_write_track(f, p, &p->input_timeline, 0, "input", &first);
+    for (int i = 0; i < p->count; ++i)
+    {
+        // "<index> <plugin>", a path given as plugin name is escaped for JSON
+        char name[256];
+        int len = snprintf(name, sizeof name, "%d ", i + 1);
+        for (const char *c = p->plugins[i].name; *c && len < (int)sizeof name - 3; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+                name[len++] = '\\';
+            name[len++] = (unsigned char)*c < 0x20 ? '?' : *c;
+        }
+        name[len] = '\0';
+        timeline_write_track(f, p, &p->stage_hosts[i].timeline, i + 1, name, &first);
+    }
+    fprintf(f, "\n]}\n");
+
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed)
+        return pipeline_error("writing the trace file failed");
+    return NULL;
+}
+
+// -------------------------------------------- Stage hosts --------------------------------------------------------
+
+// per-stage host copies with this pipeline's settings, so two pipelines in one process can differ
+static const char *stage_hosts_start(pipeline_t *p, const pipeline_options_t *options)
+{
+    p->stage_hosts = calloc((size_t)p->count, sizeof(stage_host_t));
+    if (!p->stage_hosts)
+        return pipeline_error("pipeline_create: allocation failed");
+    for (int i = 0; i < p->count; ++i)
+    {
+        p->stage_hosts[i].host = g_host_services;
+        p->stage_hosts[i].host.collect_stats = options->stats || options->metrics;
+        p->stage_hosts[i].pipeline = p;
+        p->stage_hosts[i].stage = i;
+    }
+    return NULL;
+}
+
+// latency tracing and the timeline hook into the stage hosts
+static const char *tracing_start(pipeline_t *p, const pipeline_options_t *options)
+{
+    const char *err = NULL;
+    if ((options->trace_latency || options->metrics) && (err = latency_start(p, options->queue_size)) != NULL)
+        return err;
+    if (options->trace_path && (err = timeline_start(p, options->trace_path)) != NULL)
+        return err;
+    return NULL;
+}
+
+static void stage_hosts_free(pipeline_t *p)
+{
+    for (int i = 0; p->stage_hosts && i < p->count; ++i)
+    {
+        free(p->stage_hosts[i].marks);
+        timeline_free(&p->stage_hosts[i].timeline);
+    }
+    free(p->stage_hosts);
+    free(p->end_to_end);
+    free(p->ingest_ns);
+    timeline_free(&p->input_timeline);
+    if (p->timeline_file)
+        fclose(p->timeline_file);
+}
+
+static void latency_report_row(int fd, const char *name, const latency_histogram_t *h)
+{
+    static const double q[] = {0.50, 0.90, 0.99, 0.999};
+    unsigned long long v[4];
+    for (int i = 0; i < 4; ++i)
+        v[i] = latency_percentile(h, q[i]);
+    dprintf(fd, "[latency] %-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            name, atomic_load_explicit(&h->total, memory_order_relaxed), v[0] / 1e3, v[1] / 1e3, v[2] / 1e3, v[3] / 1e3,
+            atomic_load_explicit(&h->max_ns, memory_order_relaxed) / 1e3);
+}
+
+// -------------------------------------------- Chain optimizer --------------------------------------------------------
+
+// Algebraic properties of the in-tree plugins. Anything not listed here (or given by path) is a barrier
+enum
+{
+    STAGE_PURE = 1 << 0,       // output depends only on the input, no side effects
+    STAGE_CHARWISE = 1 << 1,   // maps every character on its own and keeps ' ' as ' ' (commutes with every pure stage)
+    STAGE_IDEMPOTENT = 1 << 2, // f(f(x)) == f(x)
+    STAGE_REVERSAL = 1 << 3,   // reverses character order
+    STAGE_ROTATION = 1 << 4,   // rotates right by param_value (1 when no parameter is given)
+};
+
+typedef struct
+{
+    const char *name;
+    unsigned props;
+} stage_properties_t;
+
+static const stage_properties_t k_stage_properties[] = {
+    {"uppercaser", STAGE_PURE | STAGE_CHARWISE | STAGE_IDEMPOTENT},
+    {"flipper", STAGE_PURE | STAGE_REVERSAL},
+    {"rotator", STAGE_PURE | STAGE_ROTATION},
+    {"expander", STAGE_PURE},
+    {"logger", 0},
+    {"typewriter", 0},
+};
+
+static unsigned stage_props(const char *name)
+{
+    for (size_t i = 0; i < sizeof k_stage_properties / sizeof k_stage_properties[0]; ++i)
+    {
+        if (strcmp(k_stage_properties[i].name, name) == 0)
+            return k_stage_properties[i].props;
+    }
+    return 0; // unknown plugin: treat as a barrier
+}
+
+// Append the permutation "flip first (if flip), then rotate right by steps" as at most two stages
+static int emit_permutation(pipeline_stage_t *out, int out_count, int flip, long steps)
+{
+    if (flip)
+        out[out_count++] = (pipeline_stage_t){.name = "flipper"};
+    if (steps != 0)
+    {
+        out[out_count] = (pipeline_stage_t){.name = "rotator"};
+        if (steps != 1) // plain rotator already rotates by one
+        {
+            out[out_count].param_key = "steps";
+            out[out_count].param_value = steps;
+        }
+        ++out_count;
+    }
+    return out_count;
+}
+
+// Rewrite one run of pure stages [begin, end) into out, returns the new out_count
+// Charwise stages move to the front (they are the cheapest and shrink nothing downstream has to do),
+// repeated idempotent ones collapse, and flips/rotations between other stages fold into one flip + one rotation
+static int optimize_pure_run(const pipeline_stage_t *in, int begin, int end, pipeline_stage_t *out, int out_count)
+{
+    // charwise stages first, keeping their relative order
+    for (int i = begin; i < end; ++i)
+    {
+        unsigned props = stage_props(in[i].name);
+        if (!(props & STAGE_CHARWISE))
+            continue;
+        if ((props & STAGE_IDEMPOTENT) && out_count > 0 && strcmp(out[out_count - 1].name, in[i].name) == 0)
+            continue; // f(f(x)) == f(x)
+        out[out_count++] = in[i];
+    }
+
+    // the rest, folding flips and rotations: pending transform is x -> rotate(flip?(x), steps)
+    int flip = 0;
+    long steps = 0;
+    for (int i = begin; i < end; ++i)
+    {
+        unsigned props = stage_props(in[i].name);
+        if (props & STAGE_CHARWISE)
+            continue;
+
+        if (props & STAGE_ROTATION)
+        {
+            steps += in[i].param_key ? in[i].param_value : 1;
+        }
+        else if (props & STAGE_REVERSAL)
+        {
+            // flip after rotate(x, k) == rotate(flip(x), -k)
+            flip = !flip;
+            steps = -steps;
+        }
+        else
+        {
+            out_count = emit_permutation(out, out_count, flip, steps);
+            flip = 0;
+            steps = 0;
+            out[out_count++] = in[i];
+        }
+    }
+    return emit_permutation(out, out_count, flip, steps);
+}
+
+// print the chain as "a -> b -> rotator(steps=3)"
+static void print_plan(FILE *stream, const pipeline_stage_t *stages, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        fprintf(stream, "%s%s", i ? " -> " : "", stages[i].name);
+        if (stages[i].param_key)
+            fprintf(stream, "(%s=%ld)", stages[i].param_key, stages[i].param_value);
+    }
+    fputc('\n', stream);
+}
+
+// rewrite the chain into an equivalent cheaper one using the declared stage properties, returns the new count
+// Side-effecting and unknown stages are barriers: nothing moves across them and they are never removed
+static int optimize_chain(pipeline_stage_t *stages, int count, int verbose)
+{
+    // a run of n stages never grows past n (charwise stages + at most flip + rotation between others)
+    pipeline_stage_t *rewritten = calloc((size_t)count, sizeof(pipeline_stage_t));
+    if (!rewritten)
+        return count; // no memory for a plan: run the chain as written
+
+    int out_count = 0;
+    int run_begin = 0;
+    for (int i = 0; i <= count; ++i)
+    {
+        if (i < count && strchr(stages[i].name, '/') == NULL && (stage_props(stages[i].name) & STAGE_PURE))
+            continue;
+
+        out_count = optimize_pure_run(stages, run_begin, i, rewritten, out_count);
+        if (i < count)
+            rewritten[out_count++] = stages[i]; // the barrier itself
+        run_begin = i + 1;
+    }
+
+    // a chain that cancels out completely still needs a stage to feed, keep it as written
+    int new_count = count;
+    if (out_count > 0 && out_count <= count)
+    {
+        memcpy(stages, rewritten, (size_t)out_count * sizeof(pipeline_stage_t));
+        new_count = out_count;
+    }
+    free(rewritten);
+
+    if (verbose)
+    {
+        fprintf(stderr, "[optimizer] %d -> %d stages: ", count, new_count);
+        print_plan(stderr, stages, new_count);
+    }
+    return new_count;
+}
+
+// -------------------------------------------- Loading and wiring --------------------------------------------------------
+
+// resolve one required symbol, with dlerror() checks around the dlsym
+static const char *resolve_required(plugin_handle_t *ph, const char *symbol, const char *so_path, void **out)
+{
+    dlerror();
+    *out = dlsym(ph->handle, symbol);
+    const char *e = dlerror();
+    if (e || !*out)
+        return pipeline_error("missing required symbol '%s' in '%s': %s", symbol, so_path, e ? e : "(null)");
+    return NULL;
+}
+
+// Static registry (./build.sh static): the build passes its PLUGINS list as
+// PIPELINE_STATIC_PLUGINS(X) = X(logger) X(uppercaser) ..., every one of them was compiled with its
+// symbols prefixed by its name (see PLUGIN_STATIC_NAME in plugin_common.h) and linked in.
+// A linked-in plugin has one state per process, so a second copy in use comes from its .so
+#ifdef PIPELINE_STATIC_PLUGINS
+#define PIPELINE_BUILTIN_DECLARE(n)                                                                            \
+    const char *n##_plugin_init(int queue_size);                                                               \
+    const char *n##_plugin_fini(void);                                                                         \
+    const char *n##_plugin_place_work(const char *str);                                                        \
+    void n##_plugin_attach(plugin_place_work_func_t next_place_work);                                          \
+    const char *n##_plugin_wait_finished(void);                                                                \
+    __attribute__((weak)) const char *n##_plugin_set_param(const char *key, long value);                       \
+    __attribute__((weak)) const char *n##_plugin_set_host(const plugin_host_t *host);                          \
+    __attribute__((weak)) const char *n##_plugin_place_work_view(const char *base, size_t len, size_t offset); \
+    __attribute__((weak)) void n##_plugin_attach_view(plugin_place_work_view_func_t next_place_work_view);     \
+    __attribute__((weak)) const char *n##_plugin_get_stats(plugin_stats_t *out);
+PIPELINE_STATIC_PLUGINS(PIPELINE_BUILTIN_DECLARE)
+
+// optional symbols are weak, NULL when the plugin does not define them (like a failed dlsym)
+#define PIPELINE_BUILTIN_ENTRY(n)                                  \
+    {#n,                                                           \
+     {.init = n##_plugin_init,                                     \
+      .fini = n##_plugin_fini,                                     \
+      .place_work = n##_plugin_place_work,                         \
+      .attach = n##_plugin_attach,                                 \
+      .wait_finished = n##_plugin_wait_finished,                   \
+      .set_param = n##_plugin_set_param,                           \
+      .set_host = n##_plugin_set_host,                             \
+      .place_work_view = n##_plugin_place_work_view,               \
+      .attach_view = n##_plugin_attach_view,                       \
+      .get_stats = n##_plugin_get_stats}},
+
+static const struct
+{
+    const char *name;
+    plugin_handle_t funcs; // name and handle stay NULL
+} k_builtin_plugins[] = {PIPELINE_STATIC_PLUGINS(PIPELINE_BUILTIN_ENTRY)};
+
+#define PIPELINE_BUILTIN_COUNT ((int)(sizeof k_builtin_plugins / sizeof k_builtin_plugins[0]))
+static int g_builtin_in_use[PIPELINE_BUILTIN_COUNT]; // guarded by g_services_mutex
+
+// take the linked-in plugin called ph->name if it is free, returns 1 when ph was filled in
+static int builtin_claim(plugin_handle_t *ph)
+{
+    for (int i = 0; i < PIPELINE_BUILTIN_COUNT; ++i)
+    {
+        if (strcmp(k_builtin_plugins[i].name, ph->name) != 0)
+            continue;
+
+        pthread_mutex_lock(&g_services_mutex);
+        int taken = g_builtin_in_use[i];
+        g_builtin_in_use[i] = 1;
+        pthread_mutex_unlock(&g_services_mutex);
+        if (taken)
+            return 0;
+
+        char *name = ph->name;
+        *ph = k_builtin_plugins[i].funcs;
+        ph->name = name;
+        ph->builtin = i + 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void builtin_release(int builtin)
+{
+    if (builtin <= 0)
+        return;
+    pthread_mutex_lock(&g_services_mutex);
+    g_builtin_in_use[builtin - 1] = 0;
+    pthread_mutex_unlock(&g_services_mutex);
+}
+#else
+static int builtin_claim(plugin_handle_t *ph)
+{
+    (void)ph;
+    return 0;
+}
+
+static void builtin_release(int builtin)
+{
+    (void)builtin;
+}
+#endif
+
+// Step 2 - loads the plugin
+static const char *load_plugin(plugin_handle_t *ph, const char *plugin_name, const char *plugin_dir)
+{
+    // Supports explicit paths - only for testing (annoying bugs)
+    char so_path[512];
+    if (strchr(plugin_name, '/'))
+    {
+        // treat as explicit path
+        snprintf(so_path, sizeof so_path, "%s", plugin_name);
+    }
+    else
+    {
+        // load from <plugin_dir>/<name>.so
+        snprintf(so_path, sizeof so_path, "%s/%s.so", plugin_dir, plugin_name);
+    }
+
+    // Save an owned copy of the plugin name
+    ph->name = strdup(plugin_name);
+    if (!ph->name)
+        return pipeline_error("out of memory for plugin name '%s'", plugin_name);
+
+    // linked into this binary: nothing to load
+    if (!strchr(plugin_name, '/') && builtin_claim(ph))
+        return NULL;
+
+// Load with RTLD_NOW | RTLD_LOCAL, report dlerror on failure
+// Load each instance in its own namespace
+#if DLMOPEN_SUPPORTED
+    if (use_dlmopen())
+    {
+        ph->handle = dlmopen(LM_ID_NEWLM, so_path, RTLD_NOW | RTLD_LOCAL);
+        if (!ph->handle)
+            return pipeline_error("dlmopen('%s') error: %s", so_path, dlerror());
+    }
+    else
+#endif
+    {
+        ph->handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+        if (!ph->handle)
+            return pipeline_error("dlopen('%s') error: %s", so_path, dlerror());
+    }
+
+    const char *err;
+    if ((err = resolve_required(ph, "plugin_init", so_path, (void **)&ph->init)) ||
+        (err = resolve_required(ph, "plugin_place_work", so_path, (void **)&ph->place_work)) ||
+        (err = resolve_required(ph, "plugin_attach", so_path, (void **)&ph->attach)) ||
+        (err = resolve_required(ph, "plugin_wait_finished", so_path, (void **)&ph->wait_finished)) ||
+        (err = resolve_required(ph, "plugin_fini", so_path, (void **)&ph->fini)))
+        return err;
+
+    // Optional symbols - NULL when the plugin does not export them
+    *(void **)(&ph->set_param) = dlsym(ph->handle, "plugin_set_param");
+    *(void **)(&ph->set_host) = dlsym(ph->handle, "plugin_set_host");
+    *(void **)(&ph->place_work_view) = dlsym(ph->handle, "plugin_place_work_view");
+    *(void **)(&ph->attach_view) = dlsym(ph->handle, "plugin_attach_view");
+    *(void **)(&ph->get_stats) = dlsym(ph->handle, "plugin_get_stats");
+    dlerror(); // clear the "undefined symbol" error of a missing optional symbol
+    return NULL;
+}
+
+// Step 2 - load every stage and hand over host services and parameters (dont need to check uniqe)
+// (each stage gets its own copy of the services, see stage_host_t)
+// One stage at a time, no thread pool: glibc holds its loader lock through each whole dlmopen, so only
+// plugin_init could overlap, and that is ~20% of pipeline_create (~0.17 ms for 8 stages) - the most a
+// pool could ever save, whatever the CPU count (analyzer_bench reports first_line_ms)
+static const char *load_plugins(plugin_handle_t *plugins, const pipeline_stage_t *stages, int count, const char *plugin_dir,
+                                stage_host_t *stage_hosts)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        const char *err = load_plugin(&plugins[i], stages[i].name, plugin_dir);
+        if (err)
+            return err;
+
+        // host services first, plugins may use them from plugin_init on
+        if (plugins[i].set_host && (err = plugins[i].set_host(&stage_hosts[i].host)) != NULL)
+            return pipeline_error("plugin_set_host(%s) error: %s", stages[i].name, err);
+
+        // hand over the stage parameter (set by the optimizer) before init starts the thread
+        if (stages[i].param_key)
+        {
+            if (!plugins[i].set_param)
+                return pipeline_error("plugin '%s' does not accept parameters", stages[i].name);
+            if ((err = plugins[i].set_param(stages[i].param_key, stages[i].param_value)) != NULL)
+                return pipeline_error("plugin_set_param(%s, %s=%ld) error: %s",
+                                      stages[i].name, stages[i].param_key, stages[i].param_value, err);
+        }
+    }
+    return NULL;
+}
+
+// give back what load_plugin took: the shared object, or the linked-in plugin
+static void release_plugin(plugin_handle_t *ph)
+{
+    if (ph->handle)
+        dlclose(ph->handle);
+    builtin_release(ph->builtin);
+    free(ph->name);
+    ph->name = NULL;
+    ph->handle = NULL;
+    ph->builtin = 0;
+}
+
+// unload every stage that was loaded (none of them initialized)
+static void unload_plugins(plugin_handle_t *p, int n)
+{
+    for (int i = n - 1; i >= 0; --i)
+        release_plugin(&p[i]);
+}
+
+// Step 3 - Call init(queue_size) for each plugin.
+// On failure the stages already running are shut down (they get their own <END>, they are not
+// wired yet) and finalized, then everything is unloaded
+static const char *init_plugins(plugin_handle_t *p, int plugins_count, int queue_size)
+{
+    for (int i = 0; i < plugins_count; ++i)
+    {
+        const char *err = p[i].init(queue_size);
+        // init returns NULL on success,
+        if (!err)
+            continue;
+
+        err = pipeline_error("plugin_init(%s) error: %s", p[i].name ? p[i].name : "(unknown)", err);
+        for (int j = i - 1; j >= 0; --j)
+        {
+            if (p[j].place_work("<END>") == NULL)
+                p[j].wait_finished();
+            p[j].fini();
+        }
+        unload_plugins(p, plugins_count);
+        return err;
+    }
+    return NULL;
+}
+
+// Step 4 - attach the plugin to the next one in the pipeline
+static void wire_plugins(plugin_handle_t *p, int n)
+{
+    // Loops over all plugins except the last one. attach them to the next one
+    // (attach and place_work are required symbols, load_plugin already checked them)
+    for (int i = 0; i + 1 < n; ++i)
+    {
+        p[i].attach(p[i + 1].place_work);
+
+        // Views (e.g. rotations) go straight into the next queue when both sides support them
+        if (p[i].attach_view && p[i + 1].place_work_view)
+            p[i].attach_view(p[i + 1].place_work_view);
+    }
+}
+
+// one stage's statistics, zero when the plugin keeps none
+static const char *read_stats(const plugin_handle_t *ph, plugin_stats_t *out)
+{
+    *out = (plugin_stats_t){.size = sizeof(plugin_stats_t)};
+    if (!ph->get_stats)
+        return "plugin keeps no statistics";
+    return ph->get_stats(out);
+}
+
+static double ns_to_ms(unsigned long long ns)
+{
+    return (double)ns / 1e6;
+}
+
+// summary at teardown: where the time went, stage by stage
+static void print_stats(FILE *stream, const plugin_handle_t *p, int n)
+{
+    fprintf(stream, "[stats] %-12s %10s %10s %12s %12s %11s %11s %11s\n",
+            "stage", "in", "out", "bytes in", "bytes out", "process ms", "get ms", "put ms");
+    for (int i = 0; i < n; ++i)
+    {
+        plugin_stats_t s;
+        if (read_stats(&p[i], &s) != NULL)
+        {
+            fprintf(stream, "[stats] %-12s (no statistics)\n", p[i].name);
+            continue;
+        }
+        fprintf(stream, "[stats] %-12s %10llu %10llu %12llu %12llu %11.1f %11.1f %11.1f\n",
+                p[i].name, s.messages_in, s.messages_out, s.bytes_in, s.bytes_out,
+                ns_to_ms(s.process_ns), ns_to_ms(s.get_wait_ns), ns_to_ms(s.put_wait_ns));
+    }
+}
+
+// -------------------------------------------- Queue sampler --------------------------------------------------------
+
+#define QUEUE_SAMPLE_DEFAULT_MS 10
+
+// one CSV row per stage, stages without statistics (foreign plugins) are left out
+static void sampler_take(pipeline_t *p, long long now_ns)
+{
+    queue_sampler_t *s = p->sampler;
+    double time_ms = (double)(now_ns - s->origin_ns) / 1e6;
+    for (int i = 0; i < p->count; ++i)
+    {
+        plugin_stats_t st;
+        if (read_stats(&p->plugins[i], &st) != NULL || st.queue_capacity == 0)
+            continue;
+        fprintf(s->csv, "%.3f,%d,%s,%d,%d,%llu,%llu\n", time_ms, i, p->plugins[i].name, st.queue_depth,
+                st.queue_capacity, st.queue_full_waits, st.queue_empty_waits);
+
+        queue_tally_t *t = &s->tally[i];
+        t->samples++;
+        t->full += st.queue_depth >= st.queue_capacity;
+        t->empty += st.queue_depth == 0;
+        t->depth_sum += (unsigned long long)st.queue_depth;
+        t->full_waits = st.queue_full_waits;
+        t->empty_waits = st.queue_empty_waits;
+    }
+}
+
+static void *sampler_thread(void *arg)
+{
+    pipeline_t *p = arg;
+    queue_sampler_t *s = p->sampler;
+    long long deadline_ns = real_now_ns();
+    pthread_mutex_lock(&s->mutex);
+    while (!s->stopping)
+    {
+        sampler_take(p, real_now_ns());
+
+        // fixed period, a slow sample does not shift the ones after it
+        deadline_ns += s->interval_ns;
+        struct timespec deadline = {.tv_sec = deadline_ns / 1000000000LL, .tv_nsec = deadline_ns % 1000000000LL};
+        while (!s->stopping && pthread_cond_timedwait(&s->wake, &s->mutex, &deadline) == 0)
+            ;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+// opened at create, so a bad path fails before any plugin is loaded
+static const char *sampler_open(pipeline_t *p, const pipeline_options_t *options)
+{
+    queue_sampler_t *s = calloc(1, sizeof(*s));
+    if (!s || !(s->tally = calloc((size_t)p->count, sizeof(queue_tally_t))))
+    {
+        free(s);
+        return pipeline_error("out of memory for the queue sampler");
+    }
+    p->sampler = s;
+    if (!(s->csv = fopen(options->queue_csv_path, "w")))
+        return pipeline_error("cannot open queue CSV '%s': %s", options->queue_csv_path, strerror(errno));
+    fputs("time_ms,stage,name,depth,capacity,full_waits,empty_waits\n", s->csv);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&s->mutex, NULL);
+    s->interval_ns = (long long)(options->queue_sample_ms > 0 ? options->queue_sample_ms : QUEUE_SAMPLE_DEFAULT_MS) * 1000000LL;
+    return NULL;
+}
+
+// once the chain is wired (the handles are not written anymore), without the thread there are no samples
+static void sampler_run(pipeline_t *p)
+{
+    p->sampler->origin_ns = real_now_ns();
+    p->sampler->running = pthread_create(&p->sampler->thread, NULL, sampler_thread, p) == 0;
+}
+
+static void sampler_stop(queue_sampler_t *s)
+{
+    if (!s->running)
+        return;
+    pthread_mutex_lock(&s->mutex);
+    s->stopping = 1;
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->mutex);
+    pthread_join(s->thread, NULL);
+    s->running = 0;
+}
+
+static void sampler_free(queue_sampler_t *s)
+{
+    if (!s)
+        return;
+    if (s->csv) // the mutex and cond exist once the file is open
+    {
+        fclose(s->csv);
+        pthread_mutex_destroy(&s->mutex);
+        pthread_cond_destroy(&s->wake);
+    }
+    free(s->tally);
+    free(s);
+}
+
+static double sampler_fraction(unsigned long long part, unsigned long long whole)
+{
+    return whole ? (double)part / (double)whole : 0.0;
+}
+
+// The bottleneck takes work slower than it gets it: its input queue is full most of the time while its
+// output queue (the next stage's input) is mostly empty. The last stage's results leave the chain right
+// away, its output counts as empty. Called under the sampler mutex, -1 when no stage qualifies
+static int sampler_bottleneck(const pipeline_t *p, double *full, double *out_empty)
+{
+    const queue_tally_t *t = p->sampler->tally;
+    int best = -1;
+    double best_score = 0.0;
+    for (int i = 0; i < p->count; ++i)
+    {
+        if (!t[i].samples || (i + 1 < p->count && !t[i + 1].samples))
+            continue;
+        double f = sampler_fraction(t[i].full, t[i].samples);
+        double e = i + 1 < p->count ? sampler_fraction(t[i + 1].empty, t[i + 1].samples) : 1.0;
+        if (f >= 0.5 && e >= 0.5 && f * e > best_score)
+        {
+            best = i;
+            best_score = f * e;
+            *full = f;
+            *out_empty = e;
+        }
+    }
+    return best;
+}
+
+// Step 6 + 7 - Wait for plugins to finish and cleanup, returns the first error (cleanup goes on regardless)
+static const char *teardown(pipeline_t *pipeline)
+{
+    plugin_handle_t *p = pipeline->plugins;
+    int n = pipeline->count;
+    const char *first_err = NULL;
+
+    // loop that waits for all the plugins to finish
+    for (int i = 0; i < n; ++i)
+    {
+        const char *werr = p[i].wait_finished();
+        if (werr && !first_err)
+            first_err = pipeline_error("plugin_wait_finished(%s) error: %s", p[i].name ? p[i].name : "(null)", werr);
+    }
+
+    // every stage is done, the counters are final until fini (stage output first, it may share stderr)
+    // the queues drained, the last samples are in
+    if (pipeline->sampler)
+        sampler_stop(pipeline->sampler);
+
+    if (pipeline->stats || pipeline->latency_report || pipeline->sampler)
+        host_output_flush();
+    if (pipeline->stats)
+        print_stats(stderr, p, n);
+    if (pipeline->latency_report)
+        pipeline_latency_report(pipeline, STDERR_FILENO);
+    if (pipeline->sampler)
+        pipeline_queue_report(pipeline, STDERR_FILENO);
+    if (pipeline->timeline_file)
+    {
+        const char *terr = timeline_write(pipeline);
+        if (terr && !first_err)
+            first_err = terr;
+    }
+
+    // reverse loop to cleanup the piplelines safely
+    for (int i = n - 1; i >= 0; --i)
+    {
+        const char *ferr = p[i].fini(); // call each plugin's fini
+        if (ferr && !first_err)
+            first_err = pipeline_error("plugin_fini(%s) error: %s", p[i].name ? p[i].name : "(null)", ferr);
+
+        // Unload the shared object (or free the linked-in plugin) only after the plugin finalized
+        release_plugin(&p[i]);
+    }
+    return first_err;
+}
+
+// -------------------------------------------- Results --------------------------------------------------------
+
+// The last stage forwards through a plain function pointer, without a context argument, so every
+// live pipeline gets its own collector from a fixed table of trampolines
+// Only pipelines with a collector take a slot (not drop_results), slot_acquire fails pipeline_create beyond
+// that. With dlmopen every stage also takes one of glibc's 16 namespaces, so there the namespaces usually run
+// out first; with dlopen (ANALYZER_DLMOPEN=0) or the static registry this is the limit
+#define PIPELINE_MAX_INSTANCES 16
+
+static pipeline_t *g_slots[PIPELINE_MAX_INSTANCES]; // guarded by g_services_mutex
+
+// attached behind the last stage: count the result and hand it to the callback or the result ring
+static const char *pipeline_collect(pipeline_t *p, const char *result)
+{
+    if (strcmp(result, "<END>") == 0)
+    {
+        if (p->on_result)
+            p->on_result(p->result_ctx, NULL, 0);
+        pthread_mutex_lock(&p->mutex);
+        p->finished = 1;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->mutex);
+        return NULL;
+    }
+
+    size_t len = strlen(result);
+    if (p->on_result)
+    {
+        p->on_result(p->result_ctx, result, len);
+        atomic_fetch_add(&p->collected, 1);
+        if (atomic_load(&p->waiters))
+        {
+            pthread_mutex_lock(&p->mutex);
+            pthread_cond_broadcast(&p->changed);
+            pthread_mutex_unlock(&p->mutex);
+        }
+        return NULL;
+    }
+
+    char *copy = malloc(len + 1);
+    if (copy)
+        memcpy(copy, result, len + 1);
+
+    pthread_mutex_lock(&p->mutex);
+    atomic_fetch_add(&p->collected, 1);
+    if (copy && p->result_count == p->result_cap)
+    {
+        size_t new_cap = p->result_cap ? p->result_cap * 2 : 64;
+        pipeline_result_t *grown = malloc(new_cap * sizeof(*grown));
+        if (grown)
+        {
+            for (size_t i = 0; i < p->result_count; ++i)
+                grown[i] = p->results[(p->result_head + i) % p->result_cap];
+            free(p->results);
+            p->results = grown;
+            p->result_head = 0;
+            p->result_cap = new_cap;
+        }
+    }
+    int stored = copy && p->result_count < p->result_cap;
+    if (stored)
+    {
+        p->results[(p->result_head + p->result_count) % p->result_cap] = (pipeline_result_t){copy, len};
+        ++p->result_count;
+    }
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->mutex);
+
+    if (stored)
+        return NULL;
+    free(copy); // out of memory: the result is lost, the pipeline keeps running
+    return "out of memory for a pipeline result";
+}
+
+#define PIPELINE_COLLECTOR(slot) \
+    static const char *pipeline_collect_##slot(const char *result) { return pipeline_collect(g_slots[slot], result); }
+PIPELINE_COLLECTOR(0)
+PIPELINE_COLLECTOR(1)
+PIPELINE_COLLECTOR(2)
+PIPELINE_COLLECTOR(3)
+PIPELINE_COLLECTOR(4)
+PIPELINE_COLLECTOR(5)
+PIPELINE_COLLECTOR(6)
+PIPELINE_COLLECTOR(7)
+PIPELINE_COLLECTOR(8)
+PIPELINE_COLLECTOR(9)
+PIPELINE_COLLECTOR(10)
+PIPELINE_COLLECTOR(11)
+PIPELINE_COLLECTOR(12)
+PIPELINE_COLLECTOR(13)
+PIPELINE_COLLECTOR(14)
+PIPELINE_COLLECTOR(15)
+
+static const plugin_place_work_func_t k_collectors[PIPELINE_MAX_INSTANCES] = {
+    pipeline_collect_0, pipeline_collect_1, pipeline_collect_2, pipeline_collect_3,
+    pipeline_collect_4, pipeline_collect_5, pipeline_collect_6, pipeline_collect_7,
+    pipeline_collect_8, pipeline_collect_9, pipeline_collect_10, pipeline_collect_11,
+    pipeline_collect_12, pipeline_collect_13, pipeline_collect_14, pipeline_collect_15,
+};
+
+// take a free collector slot for p, -1 when every slot is in use
+static int slot_acquire(pipeline_t *p)
+{
+    int slot = -1;
+    pthread_mutex_lock(&g_services_mutex);
+    for (int i = 0; i < PIPELINE_MAX_INSTANCES && slot < 0; ++i)
+    {
+        if (!g_slots[i])
+        {
+            g_slots[i] = p;
+            slot = i;
+        }
+    }
+    pthread_mutex_unlock(&g_services_mutex);
+    return slot;
+}
+
+static void slot_release(int slot)
+{
+    pthread_mutex_lock(&g_services_mutex);
+    g_slots[slot] = NULL;
+    pthread_mutex_unlock(&g_services_mutex);
+}
+
+// -------------------------------------------- Public API --------------------------------------------------------
+
+static void pipeline_free(pipeline_t *p)
+{
+    while (p->result_count > 0)
+    {
+        free(p->results[p->result_head].data);
+        p->result_head = (p->result_head + 1) % p->result_cap;
+        --p->result_count;
+    }
+    free(p->results);
+    free(p->scratch);
+    free(p->plugins);
+    stage_hosts_free(p);
+    sampler_free(p->sampler);
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->changed);
+    free(p);
+}
+
+const char *pipeline_create(pipeline_t **out, const char *const *stage_names, int count, const pipeline_options_t *options)
+{
+    g_failed_step = PIPELINE_STEP_ARGS;
+    if (!out || !stage_names || count <= 0 || !options)
+        return pipeline_error("pipeline_create: invalid arguments (count=%d)", count);
+    if (options->queue_size < 1)
+        return pipeline_error("invalid queue size (must be greater than 0): %d", options->queue_size);
+    *out = NULL;
+
+    pipeline_t *p = calloc(1, sizeof(*p));
+    pipeline_stage_t *stages = calloc((size_t)count, sizeof(pipeline_stage_t));
+    if (p)
+        p->plugins = calloc((size_t)count, sizeof(plugin_handle_t));
+    if (!p || !stages || !p->plugins || host_mutex_init(&p->mutex) != 0 || host_cond_init(&p->changed) != 0)
+    {
+        if (p)
+            free(p->plugins);
+        free(p);
+        free(stages);
+        return pipeline_error("pipeline_create: allocation failed");
+    }
+    p->on_result = options->on_result;
+    p->result_ctx = options->result_ctx;
+    p->stats = options->stats;
+    p->latency_report = options->trace_latency;
+    p->slot = -1;
+
+    // Step 1.5 - the chain as given, then rewritten into an equivalent cheaper one
+    for (int i = 0; i < count; ++i)
+        stages[i].name = stage_names[i];
+    p->count = options->no_optimize ? count : optimize_chain(stages, count, options->verbose);
+
+    // Services shared by all plugins
+    const char *err = host_services_acquire(options);
+    if (err)
+    {
+        free(stages);
+        pipeline_free(p);
+        return err;
+    }
+    if (!options->drop_results && (p->slot = slot_acquire(p)) < 0)
+    {
+        free(stages);
+        pipeline_free(p);
+        host_services_release();
+        return pipeline_error("too many pipelines (at most %d at once)", PIPELINE_MAX_INSTANCES);
+    }
+
+    if ((err = stage_hosts_start(p, options)) != NULL ||
+        ((options->trace_latency || options->metrics || options->trace_path) && (err = tracing_start(p, options)) != NULL))
+    {
+        free(stages);
+        goto fail;
+    }
+
+    if (options->queue_csv_path && (err = sampler_open(p, options)) != NULL)
+    {
+        free(stages);
+        goto fail;
+    }
+
+    // Step 2: Load Plugins Shared Objects
+    g_failed_step = PIPELINE_STEP_LOAD;
+    err = load_plugins(p->plugins, stages, p->count, options->plugin_dir ? options->plugin_dir : "./output", p->stage_hosts);
+    free(stages);
+    if (err)
+    {
+        unload_plugins(p->plugins, p->count);
+        goto fail;
+    }
+
+    // Step 3: Initialize Plugins
+    g_failed_step = PIPELINE_STEP_INIT;
+    if ((err = init_plugins(p->plugins, p->count, options->queue_size)) != NULL)
+        goto fail;
+
+    if (p->end_to_end)
+        latency_find_silent(p);
+
+    // Step 4: Attach Plugins Together, the collector behind the last one
+    wire_plugins(p->plugins, p->count);
+    if (p->slot >= 0)
+        p->plugins[p->count - 1].attach(k_collectors[p->slot]);
+    if (p->sampler)
+        sampler_run(p);
+
+    g_failed_step = PIPELINE_STEP_NONE;
+    *out = p;
+    return NULL;
+
+fail:
+    if (p->slot >= 0)
+        slot_release(p->slot);
+    pipeline_free(p);
+    host_services_release();
+    return err;
+}
+
+const char *pipeline_push(pipeline_t *p, const char *data, size_t len)
+{
+    if (p->ended)
+        return "pipeline already ended";
+    if (len == 5 && memcmp(data, "<END>", 5) == 0)
+        return "\"<END>\" is reserved, use pipeline_end";
+
+    const char *err;
+    plugin_handle_t *first = &p->plugins[0];
+    unsigned long long pushed_ns = p->end_to_end || p->timeline_file ? (unsigned long long)real_now_ns() : 0;
+    if (p->ingest_ns)
+        p->ingest_ns[atomic_load_explicit(&p->pushed, memory_order_relaxed) & p->ring_mask] = pushed_ns;
+    if (first->place_work_view)
+        err = first->place_work_view(data, len, 0); // length is known, no terminator needed
+    else
+    {
+        if (len + 1 > p->scratch_size)
+        {
+            char *grown = realloc(p->scratch, len + 1);
+            if (!grown)
+                return pipeline_error("line buffer allocation failed (line of %zu bytes)", len);
+            p->scratch = grown;
+            p->scratch_size = len + 1;
+        }
+        memcpy(p->scratch, data, len);
+        p->scratch[len] = '\0';
+        err = first->place_work(p->scratch);
+    }
+    if (err)
+        return err;
+    if (p->timeline_file)
+        timeline_append(&p->input_timeline, TIMELINE_SPAN_PUSH, pushed_ns, (unsigned long long)real_now_ns());
+
+    atomic_fetch_add(&p->pushed, 1);
+    return NULL;
+}
+
+const char *pipeline_end(pipeline_t *p)
+{
+    if (p->ended)
+        return NULL;
+    const char *err = p->plugins[0].place_work("<END>");
+    if (err)
+        return err;
+    p->ended = 1;
+    return NULL;
+}
+
+const char *pipeline_pop(pipeline_t *p, char **data, size_t *len)
+{
+    *data = NULL;
+    *len = 0;
+    if (p->on_result || p->slot < 0)
+        return "pipeline_pop: results go to the on_result callback or are dropped";
+
+    pthread_mutex_lock(&p->mutex);
+    while (p->result_count == 0 && !p->finished)
+        pthread_cond_wait(&p->changed, &p->mutex);
+    if (p->result_count > 0)
+    {
+        *data = p->results[p->result_head].data;
+        *len = p->results[p->result_head].len;
+        p->result_head = (p->result_head + 1) % p->result_cap;
+        --p->result_count;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+const char *pipeline_flush(pipeline_t *p)
+{
+    // every stage gives one output per input or reports the drop, so the counts meet once everything came through
+    atomic_fetch_add(&p->waiters, 1);
+    pthread_mutex_lock(&p->mutex);
+    while (p->slot >= 0 && atomic_load(&p->collected) + atomic_load(&p->dropped) < atomic_load(&p->pushed) && !p->finished)
+        pthread_cond_wait(&p->changed, &p->mutex);
+    pthread_mutex_unlock(&p->mutex);
+    atomic_fetch_sub(&p->waiters, 1);
+    host_output_flush();
+    return NULL;
+}
+
+const char *pipeline_destroy(pipeline_t *p)
+{
+    const char *end_err = pipeline_end(p);
+
+    // Steps 6 + 7: Wait for Plugins to Finish and Cleanup
+    const char *err = teardown(p);
+    if (end_err)
+        err = pipeline_error("place_work('<END>') error: %s", end_err);
+
+    if (p->slot >= 0)
+        slot_release(p->slot);
+    pipeline_free(p);
+    host_services_release();
+    return err;
+}
+
+int pipeline_stage_count(const pipeline_t *p)
+{
+    return p->count;
+}
+
+unsigned long long pipeline_dropped(pipeline_t *p)
+{
+    return atomic_load(&p->dropped);
+}
+
+const char *pipeline_stage_stats(pipeline_t *p, int stage, pipeline_stage_stats_t *out)
+{
+    if (stage < 0 || stage >= p->count)
+        return pipeline_error("pipeline_stage_stats: no stage %d (pipeline has %d)", stage, p->count);
+
+    plugin_stats_t s;
+    const char *err = read_stats(&p->plugins[stage], &s);
+    if (err)
+        return pipeline_error("plugin_get_stats(%s) error: %s", p->plugins[stage].name, err);
+
+    *out = (pipeline_stage_stats_t){
+        .name = p->plugins[stage].name,
+        .messages_in = s.messages_in,
+        .messages_out = s.messages_out,
+        .bytes_in = s.bytes_in,
+        .bytes_out = s.bytes_out,
+        .process_ns = s.process_ns,
+        .get_wait_ns = s.get_wait_ns,
+        .put_wait_ns = s.put_wait_ns,
+        .queue_depth = s.queue_depth,
+        .queue_capacity = s.queue_capacity,
+        .queue_full_waits = s.queue_full_waits,
+        .queue_empty_waits = s.queue_empty_waits,
+        .cpu_ns = s.cpu_ns,
+    };
+    return NULL;
+}
+
+const char *pipeline_bottleneck(pipeline_t *p, int *stage)
+{
+    *stage = -1;
+    if (!p->sampler)
+        return "pipeline_bottleneck: queue sampling is off";
+    double full, out_empty;
+    pthread_mutex_lock(&p->sampler->mutex);
+    *stage = sampler_bottleneck(p, &full, &out_empty);
+    pthread_mutex_unlock(&p->sampler->mutex);
+    return NULL;
+}
+
+const char *pipeline_queue_report(pipeline_t *p, int fd)
+{
+    if (!p->sampler)
+        return "pipeline_queue_report: queue sampling is off";
+
+    queue_sampler_t *s = p->sampler;
+    pthread_mutex_lock(&s->mutex);
+    dprintf(fd, "[queues] %-12s %8s %9s %7s %7s %11s %11s\n",
+            "stage", "samples", "avg depth", "full %", "empty %", "full waits", "empty waits");
+    for (int i = 0; i < p->count; ++i)
+    {
+        const queue_tally_t *t = &s->tally[i];
+        if (!t->samples)
+        {
+            dprintf(fd, "[queues] %-12s (no samples)\n", p->plugins[i].name);
+            continue;
+        }
+        dprintf(fd, "[queues] %-12s %8llu %9.1f %7.1f %7.1f %11llu %11llu\n", p->plugins[i].name, t->samples,
+                sampler_fraction(t->depth_sum, t->samples), 100.0 * sampler_fraction(t->full, t->samples),
+                100.0 * sampler_fraction(t->empty, t->samples), t->full_waits, t->empty_waits);
+    }
+    double full = 0.0, out_empty = 0.0;
+    int stage = sampler_bottleneck(p, &full, &out_empty);
+    if (stage < 0)
+        dprintf(fd, "[bottleneck] none: no stage's input queue stayed full while its output queue ran empty\n");
+    else
+        dprintf(fd, "[bottleneck] %s (stage %d): input queue full in %.0f%% of samples, output queue empty in %.0f%%\n",
+                p->plugins[stage].name, stage, 100.0 * full, 100.0 * out_empty);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+const char *pipeline_stage_latency(pipeline_t *p, int stage, double quantile, unsigned long long *ns)
+{
+    *ns = 0;
+    if (!p->end_to_end)
+        return "pipeline_stage_latency: latency tracing is off";
+    if (stage < -1 || stage >= p->count || quantile < 0.0 || quantile > 1.0)
+        return pipeline_error("pipeline_stage_latency: no stage %d or bad quantile %g", stage, quantile);
+    *ns = latency_percentile(stage < 0 ? p->end_to_end : &p->stage_hosts[stage].latency, quantile);
+    return NULL;
+}
+
+// Prometheus text exposition: per-stage families read from plugin_stats_t, "_total" ones are counters
+static const struct
+{
+    const char *name;
+    const char *type;
+    const char *help;
+    size_t offset; // an unsigned long long member of plugin_stats_t
+    double scale;  // 1e-9 turns ns into seconds
+} k_stage_metrics[] = {
+    {"pipeline_stage_messages_in_total", "counter", "Messages the stage took from its input queue", offsetof(plugin_stats_t, messages_in), 1.0},
+    {"pipeline_stage_messages_out_total", "counter", "Results the stage produced", offsetof(plugin_stats_t, messages_out), 1.0},
+    {"pipeline_stage_bytes_in_total", "counter", "Bytes of the messages taken", offsetof(plugin_stats_t, bytes_in), 1.0},
+    {"pipeline_stage_bytes_out_total", "counter", "Bytes of the results", offsetof(plugin_stats_t, bytes_out), 1.0},
+    {"pipeline_stage_process_seconds_total", "counter", "Time spent transforming", offsetof(plugin_stats_t, process_ns), 1e-9},
+    {"pipeline_stage_get_wait_seconds_total", "counter", "Time blocked waiting for input", offsetof(plugin_stats_t, get_wait_ns), 1e-9},
+    {"pipeline_stage_put_wait_seconds_total", "counter", "Time spent handing results on", offsetof(plugin_stats_t, put_wait_ns), 1e-9},
+    {"pipeline_stage_cpu_seconds_total", "counter", "CPU time of the stage thread", offsetof(plugin_stats_t, cpu_ns), 1e-9},
+    {"pipeline_queue_full_waits_total", "counter", "Puts into the stage's input queue that waited for space", offsetof(plugin_stats_t, queue_full_waits), 1.0},
+    {"pipeline_queue_empty_waits_total", "counter", "Gets from the stage's input queue that waited for an item", offsetof(plugin_stats_t, queue_empty_waits), 1.0},
+};
+
+static const double k_metric_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static void metrics_family(FILE *f, const char *name, const char *type, const char *help)
+{
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// stage="i",name="..." with the name escaped as the format wants (it may be a path)
+static void metrics_stage_labels(FILE *f, const pipeline_t *p, int stage)
+{
+    fprintf(f, "stage=\"%d\",name=\"", stage);
+    for (const char *c = p->plugins[stage].name; *c; ++c)
+    {
+        if (*c == '\\' || *c == '"')
+            fputc('\\', f);
+        if (*c == '\n')
+            fputs("\\n", f);
+        else
+            fputc(*c, f);
+    }
+    fputc('"', f);
+}
+
+// name{labels,quantile="q"} for every k_metric_quantiles, then name_sum and name_count: a summary,
+// labelled with the stage unless stage < 0
+static void metrics_latency_summary(FILE *f, const pipeline_t *p, const char *name, int stage, const latency_histogram_t *h)
+{
+    unsigned long long count = atomic_load_explicit(&h->total, memory_order_relaxed);
+    unsigned long long sum_ns = atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+    for (size_t q = 0; q < sizeof(k_metric_quantiles) / sizeof(k_metric_quantiles[0]); ++q)
+    {
+        fprintf(f, "%s{", name);
+        if (stage >= 0)
+        {
+            metrics_stage_labels(f, p, stage);
+            fputc(',', f);
+        }
+        fprintf(f, "quantile=\"%g\"} %.9f\n", k_metric_quantiles[q], latency_percentile(h, k_metric_quantiles[q]) / 1e9);
+    }
+    for (int part = 0; part < 2; ++part)
+    {
+        fprintf(f, "%s%s", name, part ? "_count" : "_sum");
+        if (stage >= 0)
+        {
+            fputc('{', f);
+            metrics_stage_labels(f, p, stage);
+            fputc('}', f);
+        }
+        if (part)
+            fprintf(f, " %llu\n", count);
+        else
+            fprintf(f, " %.9f\n", (double)sum_ns / 1e9);
+    }
+}
+
+const char *pipeline_metrics(pipeline_t *p, char **text, size_t *len)
+{
+    *text = NULL;
+    *len = 0;
+    plugin_stats_t *stats = calloc((size_t)p->count, sizeof(plugin_stats_t));
+    int *have = calloc((size_t)p->count, sizeof(int));
+    FILE *f = stats && have ? open_memstream(text, len) : NULL;
+    if (!f)
+    {
+        free(stats);
+        free(have);
+        return pipeline_error("out of memory for the metrics");
+    }
+
+    // one snapshot per stage, so every family shows the same moment
+    for (int i = 0; i < p->count; ++i)
+        have[i] = read_stats(&p->plugins[i], &stats[i]) == NULL;
+
+    for (size_t m = 0; m < sizeof(k_stage_metrics) / sizeof(k_stage_metrics[0]); ++m)
+    {
+        metrics_family(f, k_stage_metrics[m].name, k_stage_metrics[m].type, k_stage_metrics[m].help);
+        for (int i = 0; i < p->count; ++i)
+        {
+            if (!have[i])
+                continue;
+            unsigned long long v = *(const unsigned long long *)((const char *)&stats[i] + k_stage_metrics[m].offset);
+            fprintf(f, "%s{", k_stage_metrics[m].name);
+            metrics_stage_labels(f, p, i);
+            if (k_stage_metrics[m].scale == 1.0)
+                fprintf(f, "} %llu\n", v);
+            else
+                fprintf(f, "} %.9f\n", (double)v * k_stage_metrics[m].scale);
+        }
+    }
+
+    metrics_family(f, "pipeline_queue_depth", "gauge", "Items in the stage's input queue");
+    for (int i = 0; i < p->count; ++i)
+    {
+        if (!have[i])
+            continue;
+        fputs("pipeline_queue_depth{", f);
+        metrics_stage_labels(f, p, i);
+        fprintf(f, "} %d\n", stats[i].queue_depth);
+    }
+    metrics_family(f, "pipeline_queue_capacity", "gauge", "Size of the stage's input queue");
+    for (int i = 0; i < p->count; ++i)
+    {
+        if (!have[i])
+            continue;
+        fputs("pipeline_queue_capacity{", f);
+        metrics_stage_labels(f, p, i);
+        fprintf(f, "} %d\n", stats[i].queue_capacity);
+    }
+
+    if (p->end_to_end)
+    {
+        metrics_family(f, "pipeline_stage_latency_seconds", "summary", "Latency from entering the stage's queue to its result");
+        for (int i = 0; i < p->count; ++i)
+        {
+            if (!p->stage_hosts[i].silent) // else nothing to report, the next stage covers it
+                metrics_latency_summary(f, p, "pipeline_stage_latency_seconds", i, &p->stage_hosts[i].latency);
+        }
+        metrics_family(f, "pipeline_latency_seconds", "summary", "Latency from pipeline_push to the last stage's result");
+        metrics_latency_summary(f, p, "pipeline_latency_seconds", -1, p->end_to_end);
+    }
+
+    metrics_family(f, "pipeline_messages_pushed_total", "counter", "Messages sent into the first stage");
+    fprintf(f, "pipeline_messages_pushed_total %llu\n", (unsigned long long)atomic_load(&p->pushed));
+    metrics_family(f, "pipeline_messages_dropped_total", "counter", "Messages a stage gave no result for");
+    fprintf(f, "pipeline_messages_dropped_total %llu\n", (unsigned long long)atomic_load(&p->dropped));
+    metrics_family(f, "pipeline_output_records_lost_total", "counter", "Stage output records dropped for lack of memory (whole process)");
+    fprintf(f, "pipeline_output_records_lost_total %llu\n", (unsigned long long)atomic_load(&g_output.lost));
+
+    struct timespec cpu;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu) == 0)
+    {
+        metrics_family(f, "process_cpu_seconds_total", "counter", "CPU time of the whole process");
+        fprintf(f, "process_cpu_seconds_total %.9f\n", (double)cpu.tv_sec + (double)cpu.tv_nsec / 1e9);
+    }
+
+    free(stats);
+    free(have);
+    if (fclose(f) != 0)
+    {
+        free(*text);
+        *text = NULL;
+        *len = 0;
+        return pipeline_error("out of memory for the metrics");
+    }
+    return NULL;
+}
+
+const char *pipeline_latency_report(pipeline_t *p, int fd)
+{
+    if (!p->end_to_end)
+        return "pipeline_latency_report: latency tracing is off";
+    dprintf(fd, "[latency] %-12s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    for (int i = 0; i < p->count; ++i)
+    {
+        if (p->stage_hosts[i].silent)
+            dprintf(fd, "[latency] %-12s %10s (no plugin_set_host, counted into the next stage)\n", p->plugins[i].name, "-");
+        else
+            latency_report_row(fd, p->plugins[i].name, &p->stage_hosts[i].latency);
+    }
+    latency_report_row(fd, "end-to-end", p->end_to_end);
+    return NULL;
+}
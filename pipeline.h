@@ -0,0 +1,230 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>  // size_t
+#include <sys/uio.h> // struct iovec
+
+// Embeddable pipeline: loads a plugin chain, wires it and runs it in-process (libpipeline.so).
+// The analyzer is one client of this API, a service can be another.
+// Errors are reported like the plugin SDK does: NULL on success, otherwise a message
+// (valid until the next failing call on the same thread)
+
+typedef struct pipeline pipeline_t;
+
+/**
+ * Result callback, called on the last stage's thread for every result in input order,
+ * then once with data == NULL after the last result
+ * @param ctx result_ctx from the options
+ * @param data The result (borrowed, copy it to keep it), NULL at the end
+ * @param len Length of data
+ */
+typedef void (*pipeline_result_func_t)(void *ctx, const char *data, size_t len);
+
+typedef struct
+{
+    int queue_size;                     // capacity of every stage's queue (> 0)
+    const char *plugin_dir;             // where <name>.so is looked up, NULL = "./output" (names with '/' are paths)
+    int no_optimize;                    // run the chain exactly as written
+    int verbose;                        // print the optimized chain to stderr
+    int virtual_clock;                  // plugin delays are accounted instead of slept (process-wide, first pipeline decides)
+    int stage_output_fd;                // where the stages' own output goes (logger, ...), -1 = stdout (process-wide)
+    pipeline_result_func_t on_result;   // NULL: results are kept for pipeline_pop
+    void *result_ctx;                   // passed to on_result
+    int drop_results;                   // nothing behind the last stage: results are dropped (a last logger batches its lines)
+    int stats;                          // stages count and time their work (per pipeline),
+                                        // see pipeline_stage_stats, a summary goes to stderr at pipeline_destroy
+    int trace_latency;                  // time every message from pipeline_push through each stage, see
+                                        // pipeline_stage_latency, a summary goes to stderr at pipeline_destroy
+    const char *trace_path;             // record every step of every stage and write a Chrome trace-event
+                                        // JSON timeline here at pipeline_destroy, NULL = off
+    const char *queue_csv_path;         // sample every stage's input queue into this CSV file, the summary and
+                                        // bottleneck go to stderr at pipeline_destroy, NULL = off (see pipeline_bottleneck)
+    int queue_sample_ms;                // sampling period for queue_csv_path, 0 = 10 ms
+    int metrics;                        // count stage statistics and trace latency for pipeline_metrics (and the
+                                        // readers above) without the summaries at pipeline_destroy
+} pipeline_options_t;
+
+// options to start from: everything off or NULL, stages' output to stdout (a zeroed stage_output_fd is fd 0)
+#define PIPELINE_OPTIONS_INIT {.stage_output_fd = -1}
+
+/** Runtime statistics of one stage, the counters are zero unless statistics are collected (see pipeline_options_t) */
+typedef struct
+{
+    const char *name;                // plugin name (valid until pipeline_destroy)
+    unsigned long long messages_in;  // messages the stage took (<END> not counted)
+    unsigned long long messages_out; // results it produced
+    unsigned long long bytes_in;
+    unsigned long long bytes_out;
+    unsigned long long process_ns;  // time spent transforming
+    unsigned long long get_wait_ns; // time blocked waiting for input
+    unsigned long long put_wait_ns; // time spent handing results on (blocks while the next queue is full)
+    int queue_depth;                // items in the stage's input queue right now (always filled in)
+    int queue_capacity;             // size of that queue
+    unsigned long long queue_full_waits;  // puts into it that waited for space (always counted)
+    unsigned long long queue_empty_waits; // gets from it that waited for an item (always counted)
+    unsigned long long cpu_ns;            // CPU time of the stage thread (always filled in)
+} pipeline_stage_stats_t;
+
+/** Step of pipeline_create that failed, see pipeline_failed_step */
+typedef enum
+{
+    PIPELINE_STEP_NONE,
+    PIPELINE_STEP_ARGS, // bad options or chain
+    PIPELINE_STEP_LOAD, // a plugin could not be loaded or configured
+    PIPELINE_STEP_INIT, // a plugin_init failed (everything was rolled back)
+} pipeline_step_t;
+
+/**
+ * Load, initialize and wire a chain of plugins
+ * @param out Receives the pipeline
+ * @param stages Plugin names in chain order
+ * @param count Number of stages (> 0)
+ * @param options Settings, see pipeline_options_t
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_create(pipeline_t **out, const char *const *stages, int count, const pipeline_options_t *options);
+
+/**
+ * Which step the calling thread's last failed pipeline_create stopped at
+ * @return The failed step
+ */
+pipeline_step_t pipeline_failed_step(void);
+
+/**
+ * Send one message into the first stage (blocks while its queue is full)
+ * Not thread-safe per pipeline: push and end from one thread at a time
+ * @param p The pipeline
+ * @param data Message bytes (no NUL inside, stages take C strings)
+ * @param len Length of data
+ * @return NULL on success, error message on failure ("<END>" is reserved, see pipeline_end)
+ */
+const char *pipeline_push(pipeline_t *p, const char *data, size_t len);
+
+/**
+ * End the input: the stages drain and shut down, results keep coming until then
+ * @param p The pipeline
+ * @return NULL on success (also when already ended), error message on failure
+ */
+const char *pipeline_end(pipeline_t *p);
+
+/**
+ * Take the next result (only without on_result and drop_results), blocks until there is one
+ * @param p The pipeline
+ * @param data Receives the result (malloc'd, the caller frees it), NULL once the pipeline ended and was drained
+ * @param len Receives the length of the result
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_pop(pipeline_t *p, char **data, size_t *len);
+
+/**
+ * Block until every message pushed so far came out of the last stage (or a stage reported dropping it, see
+ * message_dropped in plugin_sdk.h) and all output is written. A stage without plugin_set_host cannot report a drop.
+ * With pipeline_pop, results that are not popped yet count as out, with drop_results only the output is flushed
+ * @param p The pipeline
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_flush(pipeline_t *p);
+
+/**
+ * End the input (if not done yet), wait for every stage to finish, unload the chain and free p
+ * Unpopped results are dropped
+ * @param p The pipeline
+ * @return NULL on success, error message on failure (p is freed either way)
+ */
+const char *pipeline_destroy(pipeline_t *p);
+
+/**
+ * Number of stages the pipeline runs (after the optimizer)
+ * @param p The pipeline
+ * @return Stage count
+ */
+int pipeline_stage_count(const pipeline_t *p);
+
+/**
+ * Messages a stage gave no result for so far (plugin_host_t.message_dropped), callable from any thread.
+ * A drop is counted before the stage takes its next message, so before any later message's result
+ * @param p The pipeline
+ * @return Dropped messages
+ */
+unsigned long long pipeline_dropped(pipeline_t *p);
+
+/**
+ * Read one stage's statistics, safe while the pipeline runs
+ * @param p The pipeline
+ * @param stage Stage index, 0 .. pipeline_stage_count - 1
+ * @param out Receives the statistics
+ * @return NULL on success, error message on failure (also when the plugin keeps no statistics)
+ */
+const char *pipeline_stage_stats(pipeline_t *p, int stage, pipeline_stage_stats_t *out);
+
+/**
+ * Latency percentile of one stage (entered its queue -> result ready) or of the whole chain
+ * (pipeline_push -> result of the last stage ready), only with trace_latency. Safe while the pipeline runs.
+ * A stage without plugin_set_host cannot report (0): the next stage that does is timed from the stage before
+ * it, and end-to-end stops at the last stage that reports
+ * @param p The pipeline
+ * @param stage Stage index, or -1 for end-to-end
+ * @param quantile 0.0 .. 1.0, e.g. 0.99
+ * @param ns Receives the latency (within ~3%, never below the true value), 0 when nothing passed yet
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_stage_latency(pipeline_t *p, int stage, double quantile, unsigned long long *ns);
+
+/**
+ * Write the latency table (count, p50, p90, p99, p99.9 and max per stage and end-to-end) to fd,
+ * only with trace_latency. Safe while the pipeline runs, e.g. from a signal-handling thread
+ * @param p The pipeline
+ * @param fd Where to write
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_latency_report(pipeline_t *p, int fd);
+
+/**
+ * Every stage's statistics, queue and latency percentiles (with trace_latency or metrics) and the process
+ * CPU time in Prometheus text exposition format. Safe while the pipeline runs
+ * @param p The pipeline
+ * @param text Receives the text (malloc'd, the caller frees it)
+ * @param len Receives the length of text
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_metrics(pipeline_t *p, char **text, size_t *len);
+
+/**
+ * The bottleneck so far, only with queue_csv_path: the stage whose input queue was full in most samples
+ * while its output queue (the next stage's input, nothing for the last stage) was mostly empty
+ * @param p The pipeline
+ * @param stage Receives the stage index, -1 when no stage qualifies
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_bottleneck(pipeline_t *p, int *stage);
+
+/**
+ * Write the queue table (samples, average depth, % of samples full and empty, wait counts per stage) and
+ * the bottleneck verdict to fd, only with queue_csv_path. Safe while the pipeline runs
+ * @param p The pipeline
+ * @param fd Where to write
+ * @return NULL on success, error message on failure
+ */
+const char *pipeline_queue_report(pipeline_t *p, int fd);
+
+/**
+ * Queue one record for fd on the shared output writer thread, never interleaved with other records
+ * Results written here stay in order with the stages' own output
+ * @param fd Target file descriptor
+ * @param iov Pieces of the record (copied)
+ * @param iovcnt Number of pieces
+ */
+void pipeline_output_write(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * Block until every record queued so far is written (no-op when no pipeline ever ran)
+ */
+void pipeline_output_flush(void);
+
+/**
+ * With virtual_clock: how much plugin delay was skipped so far
+ * @return Skipped time in ns
+ */
+long long pipeline_clock_skipped_ns(void);
+
+#endif
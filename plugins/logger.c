@@ -1,7 +1,23 @@
 #include "plugin_common.h"
-#include <stdio.h>  // ok to use (By Piazza)
-#include <string.h> // ok to use (By Piazza)
-#include <stdlib.h> // ok to use (By Piazza)
+#include <string.h>  // ok to use (By Piazza)
+#include <stdlib.h>  // ok to use (By Piazza)
+
+#define LOGGER_TAG "[logger] "
+#define LOGGER_BUFFER_SIZE (64 * 1024)                   // lines are batched up to this many bytes
+#define LOGGER_FLUSH_ENV_VAR "ANALYZER_LOGGER_FLUSH_US" // max time a line may wait in the buffer
+#define LOGGER_DEFAULT_FLUSH_US 10000L                   // 10 ms
+
+// Output batch: lines collect here and go out in one write when the buffer fills, when the oldest
+// line has waited max_latency_ns, when the input queue runs dry, or at <END>.
+// Mid-chain the flush hook fires for every line, so downstream output never overtakes ours
+// and batching only kicks in when the logger is the last stage
+static struct
+{
+    char data[LOGGER_BUFFER_SIZE];
+    size_t len;
+    long long oldest_ns;      // when the first buffered line arrived
+    long long max_latency_ns; // from ANALYZER_LOGGER_FLUSH_US
+} batch;
 
 // Small helper that detects the line <END>
 static int is_end_line(const char *s)
@@ -9,6 +25,39 @@ static int is_end_line(const char *s)
     return s && strcmp(s, "<END>") == 0;
 }
 
+// send the batch plus (optionally) one extra record as one stdout record (one writev)
+static void flush_batch(const char *extra, size_t extra_len)
+{
+    struct iovec iov[4];
+    int iovcnt = 0;
+
+    if (batch.len)
+        iov[iovcnt++] = (struct iovec){.iov_base = batch.data, .iov_len = batch.len};
+    if (extra)
+    {
+        iov[iovcnt++] = (struct iovec){.iov_base = LOGGER_TAG, .iov_len = sizeof(LOGGER_TAG) - 1};
+        iov[iovcnt++] = (struct iovec){.iov_base = (void *)extra, .iov_len = extra_len};
+        iov[iovcnt++] = (struct iovec){.iov_base = "\n", .iov_len = 1};
+    }
+    if (iovcnt == 0)
+        return;
+
+    common_output_writev(iov, iovcnt);
+    batch.len = 0;
+}
+
+// flush / finish hooks: push out what we have
+static void flush_hook(void)
+{
+    flush_batch(NULL, 0);
+}
+
+static const char *flush_finish(void)
+{
+    flush_batch(NULL, 0);
+    return NULL;
+}
+
 // logger: Logs all strings that pass through to standard output
 static const char *plugin_transform(const char *input_str)
 {
@@ -20,11 +69,30 @@ static const char *plugin_transform(const char *input_str)
     if (is_end_line(input_str))
         return strdup(input_str);
 
-    // Print the string to stdout
-    fputs("[logger] ", stdout); // puts the tag like in the pdf
-    fputs(input_str, stdout);   // write the content
-    fputc('\n', stdout);        // newline so logs are separated
-    fflush(stdout);             // flush so it appears immediately
+    size_t input_len = strlen(input_str);
+    size_t record_len = sizeof(LOGGER_TAG) - 1 + input_len + 1; // tag + content + newline
+
+    if (batch.len + record_len > sizeof(batch.data))
+    {
+        // does not fit: batch and this line leave together, the line straight from the input
+        flush_batch(input_str, input_len);
+    }
+    else
+    {
+        if (batch.len == 0)
+            batch.oldest_ns = common_now_ns();
+
+        // append "[logger] <content>\n" to the batch
+        memcpy(batch.data + batch.len, LOGGER_TAG, sizeof(LOGGER_TAG) - 1);
+        batch.len += sizeof(LOGGER_TAG) - 1;
+        memcpy(batch.data + batch.len, input_str, input_len);
+        batch.len += input_len;
+        batch.data[batch.len++] = '\n';
+
+        // under steady load the queue never runs dry, so bound the wait here
+        if (common_now_ns() - batch.oldest_ns >= batch.max_latency_ns)
+            flush_batch(NULL, 0);
+    }
 
     // return a heap-allocated copy for the pipeline
     // common layer will free this after forwarding
@@ -34,5 +102,14 @@ static const char *plugin_transform(const char *input_str)
 // init details
 const char *plugin_init(int queue_size)
 {
+    const char *flush_us = getenv(LOGGER_FLUSH_ENV_VAR);
+    long max_latency_us = flush_us ? strtol(flush_us, NULL, 10) : LOGGER_DEFAULT_FLUSH_US;
+    if (max_latency_us < 0)
+        max_latency_us = 0;
+    batch.max_latency_ns = (long long)max_latency_us * 1000LL;
+    batch.len = 0;
+
+    common_plugin_set_flush_function(flush_hook);
+    common_plugin_set_finish_function(flush_finish);
     return common_plugin_init(plugin_transform, "logger", queue_size);
 }
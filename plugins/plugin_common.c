@@ -1,17 +1,26 @@
 #include "plugin_common.h"
+#include "sync/probes.h" // USDT probes around process_function
 #include <stdio.h>   // ok to use (by Piazza)
 #include <stdlib.h>  // ok to use (by Piazza)
 #include <string.h>  // ok to use (by Piazza)
 #include <pthread.h> // ok to use (by Piazza)
+#include <time.h>    // clock fallbacks when there are no host services
+#include <errno.h>   // EINTR
+#include <unistd.h>  // STDOUT_FILENO
 
 // static plugin context used by the plugin .so
 // one global state per plugin shared object
 static plugin_context_t global_plugin_context = {
-    .name = NULL,             // name used in logs
-    .queue = NULL,            // pointer to its input queue
-    .consumer_thread = 0,     // thread that consumes from the queue
-    .next_place_work = NULL,  // function pointer to next stages place_work
-    .process_function = NULL, // plugins transform function
+    .name = NULL,                 // name used in logs
+    .queue = NULL,                // pointer to its input queue
+    .consumer_thread = 0,         // thread that consumes from the queue
+    .next_place_work = NULL,      // function pointer to next stages place_work
+    .process_function = NULL,     // plugins transform function
+    .next_place_work_view = NULL, // next stages place_work_view, if it takes views
+    .view_function = NULL,        // rotation-offset transform (optional)
+    .finish_function = NULL,      // plugin hook run after <END> (optional)
+    .flush_function = NULL,       // plugin hook run before forwarding (optional)
+    .host = NULL,                 // host services, set by plugin_set_host
     .initialized = 0,
     .finished = 0};
 
@@ -38,6 +47,63 @@ const char *plugin_get_name(void)
     return global_plugin_context.name ? global_plugin_context.name : "";
 }
 
+// ---------- Runtime statistics ----------
+
+// host asked for stats (plugin_get_stats), otherwise the loop reads no clock
+static int stats_enabled(const plugin_context_t *plugin_ctx)
+{
+    return PLUGIN_HOST_HAS(plugin_ctx->host, collect_stats);
+}
+
+static unsigned long long stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+// the consumer thread is the only writer: a plain load + store, no locked add per message
+static void stats_add(atomic_ullong *counter, unsigned long long value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+// Times the steps of a message (get, process, put) back to back: the end of one is the start of the
+// next. Only reads the clock when the host asked for stats or for a timeline
+typedef struct
+{
+    int stats;
+    void (*trace_span)(const plugin_host_t *host, int kind, unsigned long long begin_ns, unsigned long long end_ns);
+    const plugin_host_t *host;
+    unsigned long long stamp; // when the current step began
+} step_clock_t;
+
+static step_clock_t step_clock_start(const plugin_context_t *plugin_ctx)
+{
+    const plugin_host_t *host = plugin_ctx->host;
+    step_clock_t clock = {
+        .stats = stats_enabled(plugin_ctx),
+        .trace_span = PLUGIN_HOST_HAS(host, trace_span) ? host->trace_span : NULL,
+        .host = host,
+    };
+    if (clock.stats || clock.trace_span)
+        clock.stamp = stats_now_ns();
+    return clock;
+}
+
+// the current step is over: add it to counter and to the timeline, the next one starts now
+static void step_done(step_clock_t *clock, int kind, atomic_ullong *counter)
+{
+    if (!clock->stats && !clock->trace_span)
+        return;
+    unsigned long long now = stats_now_ns();
+    if (clock->stats)
+        stats_add(counter, now - clock->stamp);
+    if (clock->trace_span)
+        clock->trace_span(clock->host, kind, clock->stamp, now);
+    clock->stamp = now;
+}
+
 // helper: propagate <END> downstream if were chained
 static void forward_end_if_attached(plugin_context_t *plugin_ctx)
 {
@@ -49,6 +115,36 @@ static void forward_end_if_attached(plugin_context_t *plugin_ctx)
     }
 }
 
+// helper: forward in as a circular view starting at view_function's offset
+// the next queue's copy is the only one made, and the last stage builds nothing at all
+static void forward_view(plugin_context_t *plugin_ctx, const char *in)
+{
+    if (!plugin_ctx->next_place_work_view)
+        return; // last stage: nobody reads the result
+
+    size_t len = strlen(in);
+    if (stats_enabled(plugin_ctx))
+    {
+        stats_add(&plugin_ctx->stats.messages_out, 1);
+        stats_add(&plugin_ctx->stats.bytes_out, len); // a rotation keeps the length
+    }
+    size_t offset = plugin_ctx->view_function(in, len);
+    const char *err = plugin_ctx->next_place_work_view(in, len, offset);
+    if (err)
+        log_error(plugin_ctx, err);
+}
+
+// helper: run the plugin's finish hook, if any
+static void run_finish_function(plugin_context_t *plugin_ctx)
+{
+    if (plugin_ctx->finish_function)
+    {
+        const char *err = plugin_ctx->finish_function();
+        if (err)
+            log_error(plugin_ctx, err);
+    }
+}
+
 // thread entry: consume, transform, forward
 void *plugin_consumer_thread(void *arg)
 {
@@ -61,6 +157,16 @@ void *plugin_consumer_thread(void *arg)
         return NULL;
     }
 
+    int stats = stats_enabled(plugin_ctx);
+    step_clock_t clock = step_clock_start(plugin_ctx);
+
+    // latency tracing: the host is told when each result is ready, numbered by its input (a dropped input's
+    // number is skipped)
+    const plugin_host_t *host = plugin_ctx->host;
+    void (*trace_exit)(const plugin_host_t *, unsigned long long) = PLUGIN_HOST_HAS(host, trace_exit) ? host->trace_exit : NULL;
+    unsigned long long seq = 0;
+    void (*message_dropped)(const plugin_host_t *) = PLUGIN_HOST_HAS(host, message_dropped) ? host->message_dropped : NULL;
+
     // main consumer loop
     for (;;)
     {
@@ -73,23 +179,63 @@ void *plugin_consumer_thread(void *arg)
             break; // exit the loop gracefully
         }
 
+        step_done(&clock, PLUGIN_SPAN_GET, &plugin_ctx->stats.get_wait_ns);
+
         // shutdown marker
         if (strcmp(in, "<END>") == 0)
         {
-            forward_end_if_attached(plugin_ctx); // pass END to next stage if exists
+            forward_end_if_attached(plugin_ctx); // pass END to next stage if exists (not counted)
             free(in);                            // done with the input copy
+            run_finish_function(plugin_ctx);     // let the plugin drain its own work before we report finished
             break;                               // exit loop
         }
 
+        // view transforms only move the start offset, the rotated string is built by the next queue's copy
+        // (a next stage without place_work_view gets the materialized string from process_function)
+        if (stats)
+        {
+            stats_add(&plugin_ctx->stats.messages_in, 1);
+            stats_add(&plugin_ctx->stats.bytes_in, strlen(in));
+        }
+
+        if (plugin_ctx->view_function && (plugin_ctx->next_place_work_view || !plugin_ctx->next_place_work))
+        {
+            if (trace_exit)
+                trace_exit(host, seq++);
+            forward_view(plugin_ctx, in); // all of it counts as put time, the transform is one modulo
+            free(in);
+            step_done(&clock, PLUGIN_SPAN_PUT, &plugin_ctx->stats.put_wait_ns);
+            continue;
+        }
+
         // We always free in and we free out only if (out != in) to avoid double free
+        PIPELINE_PROBE2(stage_process_start, plugin_ctx->name, in);
         const char *out = plugin_ctx->process_function(in);
+        PIPELINE_PROBE2(stage_process_done, plugin_ctx->name, out);
         if (!out)
         {
             log_error(plugin_ctx, "process_function returned NULL");
             free(in);
+            ++seq; // dropped, never reported: the host sees the gap
+            if (message_dropped)
+                message_dropped(host);
             continue;
         }
 
+        // input ran dry or the output moves on to a next stage: buffering plugins flush first
+        if (plugin_ctx->flush_function && (plugin_ctx->next_place_work || consumer_producer_count(plugin_ctx->queue) == 0))
+            plugin_ctx->flush_function();
+
+        step_done(&clock, PLUGIN_SPAN_PROCESS, &plugin_ctx->stats.process_ns);
+        if (stats)
+        {
+            stats_add(&plugin_ctx->stats.messages_out, 1);
+            stats_add(&plugin_ctx->stats.bytes_out, strlen(out));
+        }
+
+        if (trace_exit)
+            trace_exit(host, seq++);
+
         if (plugin_ctx->next_place_work)
         {
             const char *err = plugin_ctx->next_place_work(out);
@@ -102,6 +248,7 @@ void *plugin_consumer_thread(void *arg)
             free((char *)out);
         }
         free(in);
+        step_done(&clock, PLUGIN_SPAN_PUT, &plugin_ctx->stats.put_wait_ns);
     }
 
     plugin_ctx->finished = 1;                             // mark thread done
@@ -137,7 +284,9 @@ const char *common_plugin_init(const char *(*process_function)(const char *), co
     global_plugin_context.name = name ? name : "plugin";       // store name for logs
     global_plugin_context.process_function = process_function; // store transform function
     global_plugin_context.next_place_work = NULL;              // not attached yet
+    global_plugin_context.next_place_work_view = NULL;         // not attached yet
     global_plugin_context.finished = 0;                        // consumer not finished
+    global_plugin_context.stats = (plugin_stats_counters_t){0}; // counters start over
 
     // spawn consumer thread
     int return_code = pthread_create(&global_plugin_context.consumer_thread, NULL, plugin_consumer_thread, &global_plugin_context);
@@ -156,6 +305,165 @@ const char *common_plugin_init(const char *(*process_function)(const char *), co
     return NULL; // success
 }
 
+// view transform registered before common_plugin_init
+void common_plugin_set_view_function(size_t (*view_function)(const char *input, size_t len))
+{
+    global_plugin_context.view_function = view_function;
+}
+
+// finish hook registered before common_plugin_init
+void common_plugin_set_finish_function(const char *(*finish_function)(void))
+{
+    global_plugin_context.finish_function = finish_function;
+}
+
+// flush hook registered before common_plugin_init
+void common_plugin_set_flush_function(void (*flush_function)(void))
+{
+    global_plugin_context.flush_function = flush_function;
+}
+
+// write all iovecs to stdout, retrying short writes (fallback when the host has no output service)
+static void write_all(struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t written = writev(STDOUT_FILENO, iov, iovcnt);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return; // stdout is gone, nothing useful left to do
+        }
+
+        // skip what was written, including partially written iovecs
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= (ssize_t)iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+}
+
+// one stdout record: queued to the host writer thread, or written here under the host lock
+void common_output_writev(const struct iovec *iov, int iovcnt)
+{
+    const plugin_host_t *host = global_plugin_context.host;
+    if (PLUGIN_HOST_HAS(host, output_writev))
+    {
+        host->output_writev(&global_plugin_context, iov, iovcnt);
+        return;
+    }
+
+    struct iovec local[iovcnt > 0 ? iovcnt : 1]; // write_all advances through its own copy
+    memcpy(local, iov, sizeof(struct iovec) * (size_t)iovcnt);
+
+    int take_lock = PLUGIN_HOST_HAS(host, output_lock) && PLUGIN_HOST_HAS(host, output_unlock);
+    if (take_lock)
+        host->output_lock();
+    write_all(local, iovcnt);
+    if (take_lock)
+        host->output_unlock();
+}
+
+void common_output_write(const char *data, size_t len)
+{
+    struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+    common_output_writev(&iov, 1);
+}
+
+// session: the host holds back other stages' records. Without the output service there is none,
+// the stdout lock is only ever held for one record so a long session cannot stall the other stages
+void common_output_begin(void)
+{
+    const plugin_host_t *host = global_plugin_context.host;
+    if (PLUGIN_HOST_HAS(host, output_begin) && PLUGIN_HOST_HAS(host, output_end))
+        host->output_begin(&global_plugin_context);
+}
+
+void common_output_end(void)
+{
+    const plugin_host_t *host = global_plugin_context.host;
+    if (PLUGIN_HOST_HAS(host, output_begin) && PLUGIN_HOST_HAS(host, output_end))
+        host->output_end(&global_plugin_context);
+}
+
+// host clock, falls back to the real monotonic clock
+long long common_now_ns(void)
+{
+    const plugin_host_t *host = global_plugin_context.host;
+    if (PLUGIN_HOST_HAS(host, now_ns))
+        return host->now_ns();
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// host sleep (virtual in virtual-clock mode), falls back to an absolute real sleep
+void common_sleep_until_ns(long long deadline_ns)
+{
+    const plugin_host_t *host = global_plugin_context.host;
+    if (PLUGIN_HOST_HAS(host, sleep_until_ns))
+    {
+        host->sleep_until_ns(deadline_ns);
+        return;
+    }
+
+    struct timespec deadline = {.tv_sec = (time_t)(deadline_ns / 1000000000LL), .tv_nsec = (long)(deadline_ns % 1000000000LL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0)
+        ; // interrupted - sleep again until the same deadline
+}
+
+// copy the counters, the input queue's state and the thread's CPU time, only the members the caller's struct has
+const char *plugin_get_stats(plugin_stats_t *out)
+{
+    if (!out || out->size < sizeof(out->size))
+        return "stats struct has no size";
+
+    const plugin_stats_counters_t *c = &global_plugin_context.stats;
+    plugin_stats_t stats = {
+        .size = sizeof(plugin_stats_t),
+        .messages_in = atomic_load_explicit(&c->messages_in, memory_order_relaxed),
+        .messages_out = atomic_load_explicit(&c->messages_out, memory_order_relaxed),
+        .bytes_in = atomic_load_explicit(&c->bytes_in, memory_order_relaxed),
+        .bytes_out = atomic_load_explicit(&c->bytes_out, memory_order_relaxed),
+        .process_ns = atomic_load_explicit(&c->process_ns, memory_order_relaxed),
+        .get_wait_ns = atomic_load_explicit(&c->get_wait_ns, memory_order_relaxed),
+        .put_wait_ns = atomic_load_explicit(&c->put_wait_ns, memory_order_relaxed),
+    };
+    consumer_producer_snapshot_t queue;
+    if (global_plugin_context.queue && consumer_producer_snapshot(global_plugin_context.queue, &queue) == 0)
+    {
+        stats.queue_depth = queue.count;
+        stats.queue_capacity = queue.capacity;
+        stats.queue_full_waits = queue.full_waits;
+        stats.queue_empty_waits = queue.empty_waits;
+    }
+    // the thread's clock stays valid until it is joined in plugin_fini
+    clockid_t cpu_clock;
+    struct timespec cpu;
+    if (global_plugin_context.consumer_thread && pthread_getcpuclockid(global_plugin_context.consumer_thread, &cpu_clock) == 0 &&
+        clock_gettime(cpu_clock, &cpu) == 0)
+        stats.cpu_ns = (unsigned long long)cpu.tv_sec * 1000000000ULL + (unsigned long long)cpu.tv_nsec;
+    size_t size = out->size < sizeof(stats) ? out->size : sizeof(stats);
+    memcpy((char *)out + sizeof(out->size), (char *)&stats + sizeof(stats.size), size - sizeof(out->size));
+    return NULL;
+}
+
+// keep the host services for the helpers above
+const char *plugin_set_host(const plugin_host_t *host)
+{
+    global_plugin_context.host = host;
+    return NULL;
+}
+
 // destroy queue and join consumer
 const char *plugin_fini(void)
 {
@@ -171,6 +479,9 @@ const char *plugin_fini(void)
         global_plugin_context.consumer_thread = 0;
     }
 
+    // normally already done after <END>, this covers a rollback without <END>
+    run_finish_function(&global_plugin_context);
+
     consumer_producer_destroy(global_plugin_context.queue); // tear down queue internals
     free(global_plugin_context.queue);                      // free queue object
     global_plugin_context.queue = NULL;
@@ -178,10 +489,26 @@ const char *plugin_fini(void)
     // clear pointers/flags
     global_plugin_context.process_function = NULL;
     global_plugin_context.next_place_work = NULL;
+    global_plugin_context.next_place_work_view = NULL;
+    global_plugin_context.view_function = NULL;
+    global_plugin_context.finish_function = NULL;
+    global_plugin_context.flush_function = NULL;
     global_plugin_context.initialized = 0;
     return NULL; // success
 }
 
+// the transform alone, on the caller's thread
+const char *plugin_process(const char *str, const char **out)
+{
+    if (!global_plugin_context.initialized || !global_plugin_context.process_function)
+        return "plugin not initialized";
+    if (!str || !out)
+        return "invalid argument";
+
+    *out = global_plugin_context.process_function(str);
+    return *out ? NULL : "process_function returned NULL";
+}
+
 // enqueue work for this plugin
 const char *plugin_place_work(const char *str)
 {
@@ -194,6 +521,23 @@ const char *plugin_place_work(const char *str)
     return consumer_producer_put(global_plugin_context.queue, str);
 }
 
+// enqueue a circular view, the queue copy materializes it
+const char *plugin_place_work_view(const char *base, size_t len, size_t offset)
+{
+    if (!global_plugin_context.initialized)
+        return "plugin not initialized";
+    if (!global_plugin_context.queue)
+        return "queue not available";
+
+    return consumer_producer_put_view(global_plugin_context.queue, base, len, offset);
+}
+
+// set/clear the view forwarding function (used instead of next_place_work for view transforms)
+void plugin_attach_view(const char *(*next_place_work_view)(const char *, size_t, size_t))
+{
+    global_plugin_context.next_place_work_view = next_place_work_view;
+}
+
 // set/clear forwarding function to next plugin’s put()
 void plugin_attach(const char *(*next_place_work)(const char *))
 {
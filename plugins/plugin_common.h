@@ -1,9 +1,41 @@
 #ifndef PLUGIN_COMMON_H
 #define PLUGIN_COMMON_H
 
+// Static registry build (./build.sh static): every in-tree plugin is linked into one binary, so the
+// names below get the plugin's name as prefix (-DPLUGIN_STATIC_NAME=logger: logger_plugin_init, ...).
+// Each plugin keeps its own copy of plugin_common.c and with it its own state
+#ifdef PLUGIN_STATIC_NAME
+#define PLUGIN_STATIC_CONCAT(prefix, symbol) prefix##_##symbol
+#define PLUGIN_STATIC_SYMBOL(prefix, symbol) PLUGIN_STATIC_CONCAT(prefix, symbol)
+#define plugin_get_name PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_get_name)
+#define plugin_init PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_init)
+#define plugin_fini PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_fini)
+#define plugin_place_work PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_place_work)
+#define plugin_attach PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_attach)
+#define plugin_wait_finished PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_wait_finished)
+#define plugin_set_param PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_set_param)
+#define plugin_set_host PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_set_host)
+#define plugin_place_work_view PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_place_work_view)
+#define plugin_attach_view PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_attach_view)
+#define plugin_get_stats PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_get_stats)
+#define plugin_process PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_process)
+#define plugin_consumer_thread PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, plugin_consumer_thread)
+#define common_plugin_init PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_plugin_init)
+#define common_plugin_set_view_function PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_plugin_set_view_function)
+#define common_plugin_set_finish_function PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_plugin_set_finish_function)
+#define common_plugin_set_flush_function PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_plugin_set_flush_function)
+#define common_output_writev PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_output_writev)
+#define common_output_write PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_output_write)
+#define common_output_begin PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_output_begin)
+#define common_output_end PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_output_end)
+#define common_now_ns PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_now_ns)
+#define common_sleep_until_ns PLUGIN_STATIC_SYMBOL(PLUGIN_STATIC_NAME, common_sleep_until_ns)
+#endif
+
 #include "sync/consumer_producer.h"
 #include "plugin_sdk.h"
 #include <pthread.h> // ok to use (by Piazza)
+#include <stdatomic.h>
 
 #ifndef log_info
 #define log_info(...) ((void)0)
@@ -17,16 +49,34 @@
  * Common SDK structures and functions for plugin implementation
  */
 
+// Stage counters behind plugin_get_stats: written by the consumer thread only, read from any thread
+typedef struct
+{
+    atomic_ullong messages_in;
+    atomic_ullong messages_out;
+    atomic_ullong bytes_in;
+    atomic_ullong bytes_out;
+    atomic_ullong process_ns;
+    atomic_ullong get_wait_ns;
+    atomic_ullong put_wait_ns;
+} plugin_stats_counters_t;
+
 // Plugin context structure
 typedef struct
 {
-    const char *name;                              // Plugin name (for diagnosis)
-    consumer_producer_t *queue;                    // A pointer to its input queue
-    pthread_t consumer_thread;                     // Consumer thread
-    const char *(*next_place_work)(const char *);  // Next plugin's place_work function
-    const char *(*process_function)(const char *); // Plugin-specific processing function
-    int initialized;                               // Initialization flag
-    int finished;                                  // Finished processing flag
+    const char *name;                                                  // Plugin name (for diagnosis)
+    consumer_producer_t *queue;                                        // A pointer to its input queue
+    pthread_t consumer_thread;                                         // Consumer thread
+    const char *(*next_place_work)(const char *);                      // Next plugin's place_work function
+    const char *(*process_function)(const char *);                     // Plugin-specific processing function
+    const char *(*next_place_work_view)(const char *, size_t, size_t); // Next plugin's place_work_view (optional)
+    size_t (*view_function)(const char *, size_t);                     // Optional view transform: rotation offset instead of a new string
+    const char *(*finish_function)(void);                              // Optional hook run once the input is done (<END> or fini)
+    void (*flush_function)(void);                                       // Optional hook run before forwarding when a batch must go out
+    const plugin_host_t *host;                                         // Host services (NULL when the host offers none)
+    plugin_stats_counters_t stats;                                     // Runtime statistics (only counted when the host asks)
+    int initialized;                                                   // Initialization flag
+    int finished;                                                      // Finished processing flag
 } plugin_context_t;
 
 /**
@@ -67,6 +117,16 @@ const char *plugin_get_name(void) __attribute__((visibility("default")));
  */
 const char *common_plugin_init(const char *(*process_function)(const char *), const char *name, int queue_size);
 
+/**
+ * Register a view transform - call before common_plugin_init
+ * A view transform does not build a new string, it returns the offset at which the output
+ * starts inside the input read as a circular buffer (output = input[offset..len) + input[0..offset)).
+ * The rotated view is only materialized when it is copied into the next plugin's queue.
+ * process_function is still required: it is used when the next plugin cannot take views.
+ * @param view_function Returns the rotation offset (0 <= offset <= len) for an input of len bytes
+ */
+void common_plugin_set_view_function(size_t (*view_function)(const char *input, size_t len));
+
 /**
  * Initialize the plugin with the specified queue size - calls common_plugin_init
  * This function should be implemented by each plugin
@@ -101,4 +161,112 @@ void plugin_attach(const char *(*next_place_work)(const char *)) __attribute__((
  */
 const char *plugin_wait_finished(void) __attribute__((visibility("default")));
 
+/**
+ * Register a finish hook - call before common_plugin_init
+ * Runs on the consumer thread after <END> was forwarded and before the plugin reports finished,
+ * and again from plugin_fini (so it must be safe to call twice). Use it to drain plugin-owned threads.
+ * @param finish_function Returns NULL on success, error message on failure
+ */
+void common_plugin_set_finish_function(const char *(*finish_function)(void));
+
+/**
+ * Register a flush hook - call before common_plugin_init
+ * Runs on the consumer thread after an item was processed and before it is forwarded, when no
+ * further input is queued (nothing more would join a batch) or when a next stage is attached
+ * (its output must not overtake ours). Buffering plugins write out their batch here.
+ * @param flush_function Hook to run
+ */
+void common_plugin_set_flush_function(void (*flush_function)(void));
+
+/**
+ * Write one stdout record, never interleaved with other stages' records
+ * Goes through the host output service when there is one (queued, does not block on stdout),
+ * otherwise it is written directly under the host stdout lock
+ * @param iov Pieces of the record
+ * @param iovcnt Number of pieces
+ */
+void common_output_writev(const struct iovec *iov, int iovcnt);
+
+/**
+ * Write one stdout record from a single buffer (see common_output_writev)
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+void common_output_write(const char *data, size_t len);
+
+/**
+ * Start an output session: until common_output_end, only this stage's records reach stdout
+ * (other stages' records are held back, not blocked). Used for output spread over time, e.g. typing
+ * Needs the host output service: without it records stay whole but other stages' records may land
+ * between them (the stdout lock is never held across a whole session)
+ */
+void common_output_begin(void);
+
+/**
+ * End the session started by common_output_begin
+ */
+void common_output_end(void);
+
+/**
+ * Current time in ns from the host clock (CLOCK_MONOTONIC when the host offers none)
+ * Use this instead of reading the clock directly so the host's virtual-clock mode applies
+ * @return Time in ns
+ */
+long long common_now_ns(void);
+
+/**
+ * Sleep until common_now_ns() >= deadline_ns, through the host clock when there is one
+ * Use this instead of usleep/nanosleep: in virtual-clock mode the delay is accounted but not slept
+ * @param deadline_ns Absolute deadline on the common_now_ns() timeline
+ */
+void common_sleep_until_ns(long long deadline_ns);
+
+/**
+ * Optional - receive the host services, called after loading and before plugin_init
+ * @param host Host services, valid until the plugin is unloaded
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_set_host(const plugin_host_t *host) __attribute__((visibility("default")));
+
+/**
+ * Optional - place a circular view (base[offset..len) + base[0..offset)) into the plugin's queue
+ * The view is copied once into the queue as a contiguous string
+ * @param base Buffer holding len bytes (does not need to be NUL terminated)
+ * @param len Number of bytes in base
+ * @param offset Start of the view inside base
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_place_work_view(const char *base, size_t len, size_t offset) __attribute__((visibility("default")));
+
+/**
+ * Optional - attach this plugin to the next plugin's place_work_view so views are forwarded without copying
+ * @param next_place_work_view Function pointer to the next plugin's place_work_view function
+ */
+void plugin_attach_view(const char *(*next_place_work_view)(const char *, size_t, size_t)) __attribute__((visibility("default")));
+
+/**
+ * Optional - set a plugin-specific parameter before plugin_init is called
+ * Only plugins that take parameters implement this (the loader treats it as optional)
+ * @param key Parameter name
+ * @param value Parameter value
+ * @return NULL on success, error message on failure (unknown key or bad value)
+ */
+const char *plugin_set_param(const char *key, long value) __attribute__((visibility("default")));
+
+/**
+ * Read this stage's runtime statistics (counted only when the host sets collect_stats)
+ * @param out Receives the statistics, out->size must be set by the caller
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_get_stats(plugin_stats_t *out) __attribute__((visibility("default")));
+
+/**
+ * Optional - run the transform on the calling thread, bypassing the queue and the consumer thread
+ * (benchmarks). Nothing is counted or forwarded, own output (logger) still goes through the host
+ * @param str The input string
+ * @param out Receives the result the stage would forward (malloc'd, the caller frees it)
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_process(const char *str, const char **out) __attribute__((visibility("default")));
+
 #endif // PLUGIN_COMMON_H
@@ -1,3 +1,76 @@
+#include <stddef.h>  // size_t
+#include <sys/uio.h> // struct iovec
+
+/**
+ * Services the host offers to every plugin
+ * Plugins loaded with dlmopen have their own libc (and their own stdout FILE), so anything that
+ * has to be shared between stages lives in the host and is reached through these pointers.
+ * New members are only ever appended, check size before using a member.
+ */
+typedef struct plugin_host plugin_host_t;
+struct plugin_host
+{
+    size_t size;                                   // sizeof(plugin_host_t) as compiled into the host
+    void (*output_lock)(void);                     // serialize stdout writes between stages (held for a whole record)
+    void (*output_unlock)(void);                   // release output_lock
+    long long (*now_ns)(void);                     // host clock in ns (CLOCK_MONOTONIC, or the virtual clock)
+    void (*sleep_until_ns)(long long deadline_ns); // block until now_ns() >= deadline_ns (only accounted in virtual mode)
+
+    // Output service: one host thread owns stdout, stages queue records without blocking.
+    // source identifies the submitting stage (any address unique to it)
+    void (*output_writev)(const void *source, const struct iovec *iov, int iovcnt); // queue one record (copied, written whole)
+    void (*output_begin)(const void *source); // hold back other sources' records until output_end
+    void (*output_end)(const void *source);   // end the output_begin session
+    void (*output_flush)(void);               // block until every record queued so far is written
+
+    int collect_stats; // stages count and time their work for plugin_get_stats (costs clock reads per message)
+
+    // Latency tracing: a stage calls trace_exit(host, n) when the result of its n-th input (counting from 0,
+    // <END> not counted) is ready to be handed on, before handing it on. A dropped input is not reported, its
+    // number is skipped. host is the pointer from plugin_set_host
+    void (*trace_exit)(const plugin_host_t *host, unsigned long long seq);
+
+    // Timeline: a stage reports every step of its loop as a span [begin_ns, end_ns) on CLOCK_MONOTONIC,
+    // kind is a plugin_span_kind_t (other values are not recorded). Called from the stage's thread only
+    void (*trace_span)(const plugin_host_t *host, int kind, unsigned long long begin_ns, unsigned long long end_ns);
+
+    // A stage calls message_dropped(host) for every input it gives no result for, so the host stops waiting
+    // for that result (pipeline_flush). host is the pointer from plugin_set_host
+    void (*message_dropped)(const plugin_host_t *host);
+};
+
+// Steps of a stage's loop, see trace_span
+typedef enum
+{
+    PLUGIN_SPAN_GET,     // waiting for input
+    PLUGIN_SPAN_PROCESS, // transforming (and flushing own output)
+    PLUGIN_SPAN_PUT,     // handing the result to the next stage
+} plugin_span_kind_t;
+
+// true when host is set, was built with member and filled it in
+#define PLUGIN_HOST_HAS(host, member) \
+    ((host) && (host)->size >= offsetof(plugin_host_t, member) + sizeof((host)->member) && (host)->member)
+
+// Runtime statistics of one stage, see plugin_get_stats. The counters are zero unless the host sets collect_stats.
+// New members are only ever appended, the caller sets size and the plugin fills what fits
+typedef struct
+{
+    size_t size;                     // sizeof(plugin_stats_t) as compiled into the caller
+    unsigned long long messages_in;  // messages taken from the input queue (<END> not counted)
+    unsigned long long messages_out; // results produced (forwarded, or dropped by a last stage)
+    unsigned long long bytes_in;     // bytes of the messages taken
+    unsigned long long bytes_out;    // bytes of the results
+    unsigned long long process_ns;   // time spent transforming (process_function and flushing output)
+    unsigned long long get_wait_ns;  // time blocked waiting for input
+    unsigned long long put_wait_ns;  // time spent handing results to the next stage (blocks while its queue is full)
+    // the input queue, filled in whether or not the host sets collect_stats
+    int queue_depth;                 // items in it right now
+    int queue_capacity;              // its size, 0 when the plugin is not initialized
+    unsigned long long queue_full_waits;  // puts into it that had to wait for space
+    unsigned long long queue_empty_waits; // gets from it that had to wait for an item
+    unsigned long long cpu_ns;            // CPU time of the stage thread so far (always filled in)
+} plugin_stats_t;
+
 /**
  * Get the plugin's name
  * @return The plugin's name (should not be modified or freed)
@@ -36,3 +109,52 @@ void plugin_attach(const char *(*next_place_work)(const char *));
  * @return NULL on success, error message on failure
  */
 const char *plugin_wait_finished(void);
+
+
+/**
+ * Optional - place a circular view (base[offset..len) + base[0..offset)) into the plugin's queue
+ * @param base Buffer holding len bytes (does not need to be NUL terminated)
+ * @param len Number of bytes in base
+ * @param offset Start of the view inside base
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_place_work_view(const char *base, size_t len, size_t offset);
+
+/**
+ * Optional - attach this plugin to the next plugin's place_work_view function
+ * When both sides export the view symbols, rotations are forwarded as views and copied only once
+ * @param next_place_work_view Function pointer to the next plugin's place_work_view function
+ */
+void plugin_attach_view(const char *(*next_place_work_view)(const char *, size_t, size_t));
+
+/**
+ * Optional - receive the host services, called after loading and before plugin_init
+ * @param host Host services, valid until the plugin is unloaded
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_set_host(const plugin_host_t *host);
+
+/**
+ * Optional - set a plugin-specific parameter before plugin_init is called
+ * The loader resolves it with dlsym and only calls it when the chain needs it
+ * @param key Parameter name
+ * @param value Parameter value
+ * @return NULL on success, error message on failure (unknown key or bad value)
+ */
+const char *plugin_set_param(const char *key, long value);
+
+/**
+ * Optional - read the stage's runtime statistics, safe to call while it runs (counters are read one by one)
+ * @param out Receives the statistics, out->size must be set by the caller
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_get_stats(plugin_stats_t *out);
+
+/**
+ * Optional - run the transform once on the calling thread, without the queue (used by bench/transform_bench)
+ * Only valid between plugin_init and plugin_fini, not thread-safe against the stage's own thread
+ * @param str The input string
+ * @param out Receives the result the stage would forward (malloc'd, the caller frees it)
+ * @return NULL on success, error message on failure
+ */
+const char *plugin_process(const char *str, const char **out);
\ No newline at end of file
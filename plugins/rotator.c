@@ -2,6 +2,9 @@
 #include <string.h> // ok to use (By Piazza)
 #include <stdlib.h> // ok to use (By Piazza)
 
+// how many positions to rotate right, the optimizer merges k rotators into one with steps=k
+static long rotate_steps = 1;
+
 // Small helper that detects the line <END>
 static int is_end_line(const char *s)
 {
@@ -25,21 +28,53 @@ static const char *plugin_transform(const char *input_str)
     if (input_len <= 1)
         return strdup(input_str);
 
+    // reduce steps to [0, len), negative steps rotate left
+    size_t shift = (size_t)(((rotate_steps % (long)input_len) + (long)input_len) % (long)input_len);
+
     // Allocate space for the result
     char *output_str = (char *)malloc(input_len + 1);
     // out of memory safe
     if (!output_str)
         return NULL;
 
-    output_str[0] = input_str[input_len - 1];         // last moves to first
-    memcpy(output_str + 1, input_str, input_len - 1); // shift original letters right
-    output_str[input_len] = '\0';                     // NUL terminate
+    memcpy(output_str, input_str + input_len - shift, shift); // last shift chars move to the front
+    memcpy(output_str + shift, input_str, input_len - shift); // shift original letters right
+    output_str[input_len] = '\0';                             // NUL terminate
 
     return output_str; // heap string
 }
 
+// rotation as a view: the output starts len - shift bytes into the input and wraps around
+static size_t plugin_view(const char *input_str, size_t input_len)
+{
+    (void)input_str;
+    if (input_len <= 1)
+        return 0;
+
+    size_t shift = (size_t)(((rotate_steps % (long)input_len) + (long)input_len) % (long)input_len);
+    return (input_len - shift) % input_len;
+}
+
+// "steps" - rotate by this many positions instead of one
+const char *plugin_set_param(const char *key, long value)
+{
+    if (!key || strcmp(key, "steps") != 0)
+        return "unknown parameter";
+    rotate_steps = value;
+    return NULL;
+}
+
+// finish hook: back to one step, a linked-in rotator (./build.sh static) serves the next pipeline too
+static const char *reset_steps(void)
+{
+    rotate_steps = 1;
+    return NULL;
+}
+
 // init details
 const char *plugin_init(int queue_size)
 {
+    common_plugin_set_view_function(plugin_view); // rotate by moving the start offset only
+    common_plugin_set_finish_function(reset_steps);
     return common_plugin_init(plugin_transform, "rotator", queue_size);
 }
@@ -1,5 +1,6 @@
 #include "consumer_producer.h"
 #include "monitor.h"
+#include "probes.h"
 #include <stdlib.h>  // ok by Piazza - calloc malloc etc
 #include <string.h>  // ok by Piazza - memset memcpy
 #include <pthread.h> // ok by PDF - mutex
@@ -111,6 +112,8 @@ const char *consumer_producer_init(consumer_producer_t *q, int capacity)
 
     q->capacity = capacity; // set capacity
     q->count = 0;           // empty in the start
+    q->full_waits = 0;
+    q->empty_waits = 0;
     q->head = 0;            // read index
     q->tail = 0;            // write index
 
@@ -195,20 +198,22 @@ void consumer_producer_destroy(consumer_producer_t *q)
     cp_destroy_lock(q);
 }
 
-// add an item to the queue (producer), blocks if full. Null for success, error message for failure
-// Copies the contents of the string internally (deep copy). The caller retains ownership
-const char *consumer_producer_put(consumer_producer_t *q, const char *item)
+// add the concatenation first[0..first_len) + second[0..second_len) as one item, blocks if full
+// Null for success, error message for failure. Copies the bytes internally, the caller retains ownership
+static const char *cp_put_parts(consumer_producer_t *q, const char *first, size_t first_len, const char *second, size_t second_len)
 {
-    // validate inputs
-    if (!q || !item)
-        return "invalid args";
-
     pthread_mutex_t *queue_lock = cp_get_lock(q); // get per-queue mutex
     // for safety - should not happen after init
     if (!queue_lock)
         return "queue lock missing";
 
+    PIPELINE_PROBE1(queue_put_start, q);
     pthread_mutex_lock(queue_lock); // begin critical section
+    if (q->count == q->capacity)
+    {
+        q->full_waits++; // once per put, however often it wakes up
+        PIPELINE_PROBE1(queue_put_block, q);
+    }
     // full - must wait
     while (q->count == q->capacity)
     {
@@ -223,7 +228,7 @@ const char *consumer_producer_put(consumer_producer_t *q, const char *item)
         pthread_mutex_lock(queue_lock); // reacquire and recheck loop condition
     }
 
-    size_t L = strlen(item) + 1;           // compute bytes to copy (include '\0')
+    size_t L = first_len + second_len + 1; // compute bytes to copy (include '\0')
     q->items[q->tail] = (char *)malloc(L); // allocate storage for the copy
 
     // handle out of memory errors
@@ -233,9 +238,12 @@ const char *consumer_producer_put(consumer_producer_t *q, const char *item)
         return "out of memory";           // signal failure
     }
 
-    memcpy(q->items[q->tail], item, L);    // copy string into ring slot
-    q->tail = (q->tail + 1) % q->capacity; // advance tail (wrap around)
-    q->count++;                            // increment count
+    memcpy(q->items[q->tail], first, first_len);               // copy first part into ring slot
+    memcpy(q->items[q->tail] + first_len, second, second_len); // then the wrapped part (empty for plain puts)
+    q->items[q->tail][L - 1] = '\0';                           // NUL terminate
+    q->tail = (q->tail + 1) % q->capacity;                     // advance tail (wrap around)
+    q->count++;                                                // increment count
+    PIPELINE_PROBE2(queue_put_done, q, q->count);
 
     monitor_signal(&q->not_empty_monitor); // Wake a potential getter
     pthread_mutex_unlock(queue_lock);      // end critical section
@@ -243,6 +251,27 @@ const char *consumer_producer_put(consumer_producer_t *q, const char *item)
     return NULL; // success
 }
 
+// add an item to the queue (producer), blocks if full. Null for success, error message for failure
+// Copies the contents of the string internally (deep copy). The caller retains ownership
+const char *consumer_producer_put(consumer_producer_t *q, const char *item)
+{
+    // validate inputs
+    if (!q || !item)
+        return "invalid args";
+
+    return cp_put_parts(q, item, strlen(item), "", 0);
+}
+
+// add a circular view (base rotated to start at offset) to the queue, materialized by the copy put makes anyway
+const char *consumer_producer_put_view(consumer_producer_t *q, const char *base, size_t len, size_t offset)
+{
+    // validate inputs
+    if (!q || !base || offset > len)
+        return "invalid args";
+
+    return cp_put_parts(q, base + offset, len - offset, base, offset);
+}
+
 // Remove an item from the queue (consumer) and returns it, blocks if empty.
 // string item if good, wait if empty
 // Returns a newly heap-allocated string that the caller must free
@@ -259,6 +288,8 @@ char *consumer_producer_get(consumer_producer_t *q)
     if (!queue_lock)
         return NULL;
 
+    PIPELINE_PROBE1(queue_get_start, q);
+    int waited = 0;
     for (;;) // block until non-empty loop
     {
         pthread_mutex_lock(queue_lock); // begin critical section
@@ -267,10 +298,17 @@ char *consumer_producer_get(consumer_producer_t *q)
             char *s = q->items[q->head];           // take pointer to front item (ownership to caller)
             q->head = (q->head + 1) % q->capacity; // advance head
             q->count--;                            // decrement count
+            PIPELINE_PROBE2(queue_get_done, q, q->count);
             monitor_signal(&q->not_full_monitor);  // wake a producer waiting for space
             pthread_mutex_unlock(queue_lock);      // leave critical section
             return s;                              // return the dequeued string
         }
+        if (!waited)
+        {
+            q->empty_waits++; // once per get, however often it wakes up
+            PIPELINE_PROBE1(queue_get_block, q);
+        }
+        waited = 1;
         monitor_reset(&q->not_empty_monitor);
         pthread_mutex_unlock(queue_lock); // empty - leave critical section
 
@@ -281,6 +319,41 @@ char *consumer_producer_get(consumer_producer_t *q)
     }
 }
 
+// snapshot of the current item count, taken under the per-queue mutex
+int consumer_producer_count(consumer_producer_t *q)
+{
+    if (!q)
+        return -1;
+
+    pthread_mutex_t *queue_lock = cp_get_lock(q);
+    if (!queue_lock)
+        return -1;
+
+    pthread_mutex_lock(queue_lock);
+    int count = q->count;
+    pthread_mutex_unlock(queue_lock);
+    return count;
+}
+
+// occupancy and wait counts in one critical section, so they agree with each other
+int consumer_producer_snapshot(consumer_producer_t *q, consumer_producer_snapshot_t *out)
+{
+    if (!q || !out)
+        return -1;
+
+    pthread_mutex_t *queue_lock = cp_get_lock(q);
+    if (!queue_lock)
+        return -1;
+
+    pthread_mutex_lock(queue_lock);
+    out->count = q->count;
+    out->capacity = q->capacity;
+    out->full_waits = q->full_waits;
+    out->empty_waits = q->empty_waits;
+    pthread_mutex_unlock(queue_lock);
+    return 0;
+}
+
 // Notify anyone waiting for finished that production is done
 void consumer_producer_signal_finished(consumer_producer_t *q)
 {
@@ -1,6 +1,7 @@
 #ifndef CONSUMER_PRODUCER_H
 #define CONSUMER_PRODUCER_H
 #include "monitor.h" // So we dont use busy waiting
+#include <stddef.h>  // size_t
 
 /**
  * Consumer-Producer queue structure for thread-safe producer-consumer pattern
@@ -13,6 +14,8 @@ typedef struct
     int count;                   /* Current number of items */
     int head;                    /* Index of first item */
     int tail;                    /* Index of next insertion point */
+    unsigned long long full_waits;  /* Puts that had to wait for space */
+    unsigned long long empty_waits; /* Gets that had to wait for an item */
     monitor_t not_full_monitor;  /* Monitor for "not full" state */
     monitor_t not_empty_monitor; /* Monitor for "not empty" state */
     monitor_t finished_monitor;  /* Monitor for finished signal */
@@ -41,6 +44,19 @@ void consumer_producer_destroy(consumer_producer_t *queue);
  */
 const char *consumer_producer_put(consumer_producer_t *queue, const char *item); // check later if * is in good place
 
+/**
+ * Add a circular view of a buffer to the queue (producer).
+ * The stored item is base[offset..len) followed by base[0..offset), copied once into
+ * a contiguous string - this is where a rotated view gets materialized.
+ * Blocks if queue is full.
+ * @param queue Pointer to queue structure
+ * @param base Buffer holding len bytes (does not need to be NUL terminated)
+ * @param len Number of bytes in base
+ * @param offset Start of the view inside base (0 <= offset <= len)
+ * @return NULL on success, error message on failure
+ */
+const char *consumer_producer_put_view(consumer_producer_t *queue, const char *base, size_t len, size_t offset);
+
 /**
  * Remove an item from the queue (consumer) and returns it.
  * Blocks if queue is empty.
@@ -49,6 +65,30 @@ const char *consumer_producer_put(consumer_producer_t *queue, const char *item);
  */
 char *consumer_producer_get(consumer_producer_t *queue);
 
+/**
+ * Number of items currently in the queue (a snapshot, it may change right after)
+ * @param queue Pointer to queue structure
+ * @return Item count, or -1 if queue is NULL
+ */
+int consumer_producer_count(consumer_producer_t *queue);
+
+/** Occupancy of a queue at one moment, see consumer_producer_snapshot */
+typedef struct
+{
+    int count;                      /* Items in the queue */
+    int capacity;                   /* Maximum number of items */
+    unsigned long long full_waits;  /* Puts so far that found the queue full and waited */
+    unsigned long long empty_waits; /* Gets so far that found the queue empty and waited */
+} consumer_producer_snapshot_t;
+
+/**
+ * Read the occupancy and wait counts, taken together under the per-queue mutex
+ * @param queue Pointer to queue structure
+ * @param out Receives the snapshot
+ * @return 0 on success, -1 if queue is NULL or not initialized
+ */
+int consumer_producer_snapshot(consumer_producer_t *queue, consumer_producer_snapshot_t *out);
+
 /**
  * Signal that processing is finished
  * @param queue Pointer to queue structure
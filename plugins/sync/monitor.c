@@ -1,4 +1,5 @@
 #include "monitor.h"
+#include "probes.h"
 #include <errno.h> // ok by Piazza
 
 /* Helper: convert pthread error code to errno and return -1 on fail */
@@ -77,6 +78,8 @@ int monitor_wait(monitor_t *m)
         return -1;
     }
 
+    PIPELINE_PROBE1(monitor_wait_start, m);
+
     // lock before taking action
     int return_code = pthread_mutex_lock(&m->mutex);
     if (return_code != 0)
@@ -97,5 +100,6 @@ int monitor_wait(monitor_t *m)
     return_code = pthread_mutex_unlock(&m->mutex);
     if (return_code != 0)
         return fail_with_errno(return_code);
+    PIPELINE_PROBE1(monitor_wait_done, m);
     return 0; // return 0 for success
 }
@@ -0,0 +1,31 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes (SystemTap SDT notes) on the queue and stage hot paths, for bpftrace / perf / stap.
+// Each probe is a single nop plus an ELF note naming it, its arguments are only read while a tracer
+// is attached. Provider "pipeline" (list them with: bpftrace -l 'usdt:./output/uppercaser.so:*'):
+//   queue_put_start(queue)        queue_put_block(queue)        queue_put_done(queue, count)
+//   queue_get_start(queue)        queue_get_block(queue)        queue_get_done(queue, count)
+//   monitor_wait_start(monitor)   monitor_wait_done(monitor)
+//   stage_process_start(name, in) stage_process_done(name, out)
+// Built in when <sys/sdt.h> is installed (systemtap-sdt-dev) unless -DPIPELINE_PROBES=0 is given,
+// otherwise every probe compiles to nothing
+
+#ifndef PIPELINE_PROBES
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PIPELINE_PROBES 1
+#endif
+#endif
+#endif
+
+#if defined(PIPELINE_PROBES) && PIPELINE_PROBES
+#include <sys/sdt.h>
+#define PIPELINE_PROBE1(name, a) DTRACE_PROBE1(pipeline, name, a)
+#define PIPELINE_PROBE2(name, a, b) DTRACE_PROBE2(pipeline, name, a, b)
+#else
+#define PIPELINE_PROBE1(name, a) ((void)0)
+#define PIPELINE_PROBE2(name, a, b) ((void)0)
+#endif
+
+#endif // PROBES_H
@@ -1,8 +1,34 @@
 #include "plugin_common.h"
-#include <stdio.h>  // ok to use (By Piazza)
-#include <string.h> // ok to use (By Piazza)
-#include <stdlib.h> // ok to use (By Piazza)
-#include <unistd.h> // ok to use (By Piazza)
+#include <string.h>  // ok to use (By Piazza)
+#include <stdlib.h>  // ok to use (By Piazza)
+#include <pthread.h> // ok to use (By Piazza)
+
+#define TYPEWRITER_CHAR_DELAY_NS 100000000LL // 100-ms delay per character
+
+// One line waiting for the emitter thread
+typedef struct typed_line
+{
+    char *text;
+    struct typed_line *next;
+} typed_line_t;
+
+// Emitter state: lines are handed over here and typed out by a separate thread,
+// so the stage thread forwards every line downstream right away.
+// The FIFO holds at most cap lines (the queue size): typing is far slower than forwarding, so past
+// that the stage thread waits for the emitter and the queues before it fill up as usual
+static struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    typed_line_t *head; // FIFO of lines still to type
+    typed_line_t *tail;
+    int pending; // lines in the FIFO
+    int cap;
+    int stopping; // set by the finish hook, the emitter drains the FIFO and exits
+    int running;  // emitter thread exists
+    pthread_t thread;
+} emitter = {.mutex = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER};
 
 // Small helper that detects the line <END>
 static int is_end_line(const char *s)
@@ -10,7 +36,78 @@ static int is_end_line(const char *s)
     return s && strcmp(s, "<END>") == 0;
 }
 
-// typewriter: Simulates a typewriter effect by printing each character with a 100ms delay (you can use the usleep function).
+// type one line: every character gets its own absolute deadline, so printing time does not add drift
+static void type_line(const char *text)
+{
+    // one output session per line so other stages do not print into it (the host parks their records,
+    // nothing is locked while we sleep between characters)
+    common_output_begin();
+
+    // host clock, so a virtual-clock run accounts the delays instead of sleeping them
+    long long deadline_ns = common_now_ns();
+
+    // puts the tag
+    common_output_write("[typewriter] ", sizeof("[typewriter] ") - 1);
+
+    // iterate each char
+    for (const char *p = text; *p; ++p)
+    {
+        common_output_write(p, 1); // print every char with delay
+        deadline_ns += TYPEWRITER_CHAR_DELAY_NS;
+        common_sleep_until_ns(deadline_ns);
+    }
+
+    common_output_write("\n", 1); // add newline
+    common_output_end();
+}
+
+// emitter thread: pop lines in order and type them until stopped and drained
+static void *emitter_thread(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&emitter.mutex);
+        while (!emitter.head && !emitter.stopping)
+            pthread_cond_wait(&emitter.not_empty, &emitter.mutex);
+
+        typed_line_t *line = emitter.head;
+        if (!line) // stopping and nothing left
+        {
+            pthread_mutex_unlock(&emitter.mutex);
+            break;
+        }
+        emitter.head = line->next;
+        if (!emitter.head)
+            emitter.tail = NULL;
+        --emitter.pending;
+        pthread_cond_signal(&emitter.not_full);
+        pthread_mutex_unlock(&emitter.mutex);
+
+        type_line(line->text);
+        free(line->text);
+        free(line);
+    }
+    return NULL;
+}
+
+// finish hook: let the emitter type everything it was given, then join it (safe to call twice)
+static const char *emitter_stop(void)
+{
+    pthread_mutex_lock(&emitter.mutex);
+    int running = emitter.running;
+    emitter.stopping = 1;
+    emitter.running = 0;
+    pthread_cond_signal(&emitter.not_empty);
+    pthread_mutex_unlock(&emitter.mutex);
+
+    if (running && pthread_join(emitter.thread, NULL) != 0)
+        return "pthread_join failed for typewriter emitter";
+    return NULL;
+}
+
+// typewriter: Simulates a typewriter effect by printing each character with a 100ms delay.
+// The typing happens on the emitter thread, this only queues a copy and passes the line on.
 static const char *plugin_transform(const char *input_str)
 {
     // if the input pointer is NULL return empty string so the pipeline keeps running
@@ -24,20 +121,28 @@ static const char *plugin_transform(const char *input_str)
     // empty inputs produce no partial tag
     if (*input_str)
     {
-        // puts the tag
-        fputs("[typewriter] ", stdout);
-        fflush(stdout);
-
-        // // iterate each char
-        for (const char *p = input_str; *p; ++p)
+        typed_line_t *line = (typed_line_t *)malloc(sizeof(*line));
+        char *text = strdup(input_str);
+        if (!line || !text)
         {
-            fputc(*p, stdout); // print char
-            fflush(stdout);    // print every char with delay
-            usleep(100000);    // 100-ms delay
+            free(line);
+            free(text);
+            return NULL;
         }
+        line->text = text;
+        line->next = NULL;
 
-        fputc('\n', stdout); // add newline
-        fflush(stdout);      // print instantly
+        pthread_mutex_lock(&emitter.mutex);
+        while (emitter.pending >= emitter.cap)
+            pthread_cond_wait(&emitter.not_full, &emitter.mutex);
+        if (emitter.tail)
+            emitter.tail->next = line;
+        else
+            emitter.head = line;
+        emitter.tail = line;
+        ++emitter.pending;
+        pthread_cond_signal(&emitter.not_empty);
+        pthread_mutex_unlock(&emitter.mutex);
     }
 
     return strdup(input_str); // pass-through
@@ -46,5 +151,26 @@ static const char *plugin_transform(const char *input_str)
 // init details
 const char *plugin_init(int queue_size)
 {
-    return common_plugin_init(plugin_transform, "typewriter", queue_size);
+    // start the emitter first so no line can arrive before it exists
+    pthread_mutex_lock(&emitter.mutex);
+    if (emitter.running)
+    {
+        pthread_mutex_unlock(&emitter.mutex);
+        return "plugin already initialized";
+    }
+    emitter.stopping = 0;
+    emitter.cap = queue_size > 0 ? queue_size : 1;
+    if (pthread_create(&emitter.thread, NULL, emitter_thread, NULL) != 0)
+    {
+        pthread_mutex_unlock(&emitter.mutex);
+        return "failed to create typewriter emitter thread";
+    }
+    emitter.running = 1;
+    pthread_mutex_unlock(&emitter.mutex);
+
+    common_plugin_set_finish_function(emitter_stop);
+    const char *err = common_plugin_init(plugin_transform, "typewriter", queue_size);
+    if (err)
+        emitter_stop();
+    return err;
 }
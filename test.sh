@@ -118,13 +118,17 @@ fi
 
 # --------------------------------------- Build the project ---------------------------------------
 
-print_info "Building project with ./build.sh"
+print_info "Building project with ./build.sh static bench"
 require_file "${ROOT_DIR}/build.sh"
-( cd "$ROOT_DIR" && ./build.sh )
+( cd "$ROOT_DIR" && ./build.sh static bench )
 
 mkdir -p "${OUT}/tests"
 
 require_exec "${ANALYZER}"
+require_exec "${OUT}/analyzer_static"
+require_exec "${OUT}/bench/queue_bench"
+require_exec "${OUT}/bench/transform_bench"
+require_exec "${OUT}/bench/analyzer_bench"
 for so in logger uppercaser rotator flipper expander typewriter; do
   require_file "${OUT}/${so}.so"
 done
@@ -505,6 +509,18 @@ static int t15_no_spurious_null_get(){
   consumer_producer_destroy(&q);
   return !ok;
 }
+static int t16_put_view_rotates(){
+  consumer_producer_t q; consumer_producer_init(&q,4);
+  consumer_producer_put_view(&q,"hello",5,4);
+  consumer_producer_put_view(&q,"hello",5,0);
+  consumer_producer_put_view(&q,"hello",5,5);
+  int bad = consumer_producer_put_view(&q,"hello",5,6)==NULL;
+  char *a=consumer_producer_get(&q), *b=consumer_producer_get(&q), *c=consumer_producer_get(&q);
+  int ok = !bad && a && strcmp(a,"ohell")==0 && b && strcmp(b,"hello")==0 && c && strcmp(c,"hello")==0;
+  free(a); free(b); free(c);
+  consumer_producer_destroy(&q);
+  return !ok;
+}
 
 int main(int argc, char**argv){
   if (argc<2){ fprintf(stderr,"need test name\n"); return 2; }
@@ -525,6 +541,7 @@ int main(int argc, char**argv){
     {"t13_capacity_wraparound",t13_capacity_wraparound},
     {"t14_many_small_ops",t14_many_small_ops},
     {"t15_no_spurious_null_get",t15_no_spurious_null_get},
+    {"t16_put_view_rotates",t16_put_view_rotates},
   };
   for (size_t i=0;i<sizeof(cases)/sizeof(cases[0]);++i){
     if (strcmp(t,cases[i].name)==0) return cases[i].fn();
@@ -546,6 +563,357 @@ EOF
 
 
 
+# ---- pipeline library test ----
+cat > "${OUT}/tests/pipeline_test.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+static const char* g_dir;
+
+static pipeline_options_t opts(int qs){
+  pipeline_options_t o = PIPELINE_OPTIONS_INIT;
+  o.queue_size = qs; o.plugin_dir = g_dir;
+  return o;
+}
+static int pop_is(pipeline_t* p, const char* want){
+  char* s = NULL; size_t n = 0;
+  if (pipeline_pop(p, &s, &n) != NULL) return 0;
+  int ok = want ? (s && n == strlen(want) && strcmp(s, want) == 0) : (s == NULL);
+  free(s);
+  return ok;
+}
+
+static int t01_push_pop_order(){
+  const char* chain[] = {"uppercaser", "flipper"};
+  pipeline_options_t o = opts(2); pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  char buf[32];
+  for (int i = 0; i < 100; ++i){ snprintf(buf, sizeof buf, "ab%d", i); if (pipeline_push(p, buf, strlen(buf))) return 1; }
+  if (pipeline_end(p)) return 1;
+  for (int i = 0; i < 100; ++i){
+    char want[32]; snprintf(buf, sizeof buf, "AB%d", i);
+    size_t n = strlen(buf); for (size_t k = 0; k < n; ++k) want[k] = buf[n - 1 - k]; want[n] = '\0';
+    if (!pop_is(p, want)) return 1;
+  }
+  if (!pop_is(p, NULL)) return 1;
+  return pipeline_destroy(p) != NULL;
+}
+
+static int g_calls, g_ended;
+static void on_result(void* ctx, const char* data, size_t len){
+  (void)len;
+  if (!data) g_ended = 1;
+  else if (strcmp(data, (const char*)ctx) == 0) ++g_calls;
+}
+static int t02_callback_and_flush(){
+  const char* chain[] = {"rotator"};
+  pipeline_options_t o = opts(4); o.on_result = on_result; o.result_ctx = "cab"; pipeline_t* p;
+  if (pipeline_create(&p, chain, 1, &o)) return 1;
+  for (int i = 0; i < 50; ++i) if (pipeline_push(p, "abc", 3)) return 1;
+  if (pipeline_flush(p) || g_calls != 50 || g_ended) return 1;
+  if (pipeline_destroy(p) || !g_ended) return 1;
+  return 0;
+}
+
+static int t03_two_pipelines(){
+  const char* a[] = {"uppercaser"}; const char* b[] = {"flipper"};
+  pipeline_options_t o = opts(1); pipeline_t *p, *q;
+  if (pipeline_create(&p, a, 1, &o) || pipeline_create(&q, b, 1, &o)) return 1;
+  if (pipeline_push(p, "xy", 2) || pipeline_push(q, "xy", 2)) return 1;
+  if (!pop_is(p, "XY") || !pop_is(q, "yx")) return 1;
+  return pipeline_destroy(q) != NULL || pipeline_destroy(p) != NULL;
+}
+
+static int t04_load_failure(){
+  const char* chain[] = {"uppercaser", "no_such_plugin"};
+  pipeline_options_t o = opts(4); pipeline_t* p = NULL;
+  const char* err = pipeline_create(&p, chain, 2, &o);
+  return !(err && strstr(err, "no_such_plugin") && p == NULL && pipeline_failed_step() == PIPELINE_STEP_LOAD);
+}
+
+static int t05_end_reserved(){
+  const char* chain[] = {"expander"};
+  pipeline_options_t o = opts(4); pipeline_t* p;
+  if (pipeline_create(&p, chain, 1, &o)) return 1;
+  if (pipeline_push(p, "<END>", 5) == NULL) return 1;
+  if (pipeline_push(p, "ok", 2) || !pop_is(p, "o k")) return 1;
+  if (pipeline_end(p) || pipeline_push(p, "late", 4) == NULL) return 1;
+  return pipeline_destroy(p) != NULL; // already ended, destroy only waits
+}
+
+static int t06_stage_stats(){
+  const char* chain[] = {"uppercaser", "flipper"};
+  pipeline_options_t o = opts(4); o.stats = 1; o.no_optimize = 1; pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  for (int i = 0; i < 10; ++i) if (pipeline_push(p, "abc", 3)) return 1;
+  for (int i = 0; i < 10; ++i) if (!pop_is(p, "CBA")) return 1;
+  pipeline_stage_stats_t st;
+  if (pipeline_stage_count(p) != 2 || pipeline_stage_stats(p, 2, &st) == NULL) return 1;
+  for (int i = 0; i < 2; ++i){
+    if (pipeline_stage_stats(p, i, &st) || strcmp(st.name, chain[i]) != 0) return 1;
+    if (st.messages_in != 10 || st.messages_out != 10 || st.bytes_in != 30 || st.bytes_out != 30) return 1;
+  }
+  return pipeline_destroy(p) != NULL;
+}
+
+static int t07_latency(){
+  const char* chain[] = {"rotator", "uppercaser"};
+  pipeline_options_t o = opts(2); o.trace_latency = 1; o.no_optimize = 1; pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  for (int i = 0; i < 50; ++i) if (pipeline_push(p, "abc", 3)) return 1;
+  if (pipeline_flush(p)) return 1;
+  unsigned long long e2e, stage, max;
+  if (pipeline_stage_latency(p, -1, 0.5, &e2e) || pipeline_stage_latency(p, -1, 1.0, &max) || e2e == 0 || max < e2e) return 1;
+  for (int i = 0; i < 2; ++i)  // every message spends at least its stage time end to end
+    if (pipeline_stage_latency(p, i, 0.5, &stage) || stage == 0 || stage > e2e) return 1;
+  if (pipeline_stage_latency(p, 2, 0.5, &stage) == NULL) return 1;
+  for (int i = 0; i < 50; ++i) if (!pop_is(p, "CAB")) return 1;
+  return pipeline_destroy(p) != NULL;
+}
+
+// tests/dropper.so drops "drop", tests/foreign.so has no plugin_set_host: every stage still measures its own
+// inputs (the dropper's first result is message 1, not 0) and the stage after the foreign one starts at the
+// stage before it, not at time 0
+static int t10_latency_drops_and_silent(){
+  char dropper[512], foreign[512];
+  snprintf(dropper, sizeof dropper, "%s/tests/dropper.so", g_dir);
+  snprintf(foreign, sizeof foreign, "%s/tests/foreign.so", g_dir);
+  const char* chain[] = {dropper, "uppercaser", foreign, "rotator"};
+  pipeline_options_t o = opts(4); o.trace_latency = 1; o.no_optimize = 1; pipeline_t* p;
+  if (pipeline_create(&p, chain, 4, &o)) return 1;
+  if (pipeline_push(p, "drop", 4)) return 1;
+  struct timespec ts = {0, 300000000};
+  nanosleep(&ts, NULL);
+  for (int i = 0; i < 5; ++i) if (pipeline_push(p, "abc", 3)) return 1;
+  if (pipeline_end(p)) return 1;
+  for (int i = 0; i < 5; ++i) if (!pop_is(p, "CAB")) return 1;
+  if (!pop_is(p, NULL)) return 1;
+  unsigned long long ns;
+  for (int i = -1; i < 4; ++i){
+    if (pipeline_stage_latency(p, i, 1.0, &ns)) return 1;
+    if (i == 2 ? ns != 0 : (ns == 0 || ns >= 200000000ULL)) return 1;
+  }
+  return pipeline_destroy(p) != NULL;
+}
+
+// collect_stats belongs to each pipeline: a first pipeline without statistics does not turn them off for the next
+static int t11_stats_per_pipeline(){
+  const char* a[] = {"uppercaser"}; const char* b[] = {"flipper"};
+  pipeline_options_t quiet = opts(4), counted = opts(4); counted.metrics = 1; pipeline_t *p, *q;
+  if (pipeline_create(&p, a, 1, &quiet) || pipeline_create(&q, b, 1, &counted)) return 1;
+  for (int i = 0; i < 10; ++i) if (pipeline_push(p, "abc", 3) || pipeline_push(q, "abc", 3)) return 1;
+  for (int i = 0; i < 10; ++i) if (!pop_is(p, "ABC") || !pop_is(q, "cba")) return 1;
+  pipeline_stage_stats_t st;
+  if (pipeline_stage_stats(p, 0, &st) || st.messages_in != 0) return 1;
+  if (pipeline_stage_stats(q, 0, &st) || st.messages_in != 10) return 1;
+  return pipeline_destroy(q) != NULL || pipeline_destroy(p) != NULL;
+}
+
+// a dropped message is reported, so pipeline_flush does not wait for its result
+static int t12_flush_after_drop(){
+  char dropper[512];
+  snprintf(dropper, sizeof dropper, "%s/tests/dropper.so", g_dir);
+  const char* chain[] = {dropper, "uppercaser"};
+  pipeline_options_t o = opts(4); o.metrics = 1; o.no_optimize = 1; pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  if (pipeline_push(p, "abc", 3) || pipeline_push(p, "drop", 4) || pipeline_flush(p)) return 1;
+  char* text; size_t len;
+  if (pipeline_metrics(p, &text, &len)) return 1;
+  int counted = strstr(text, "\npipeline_messages_dropped_total 1\n") != NULL &&
+                strstr(text, "\npipeline_output_records_lost_total 0\n") != NULL;
+  free(text);
+  if (!counted || !pop_is(p, "ABC")) return 1;
+  return pipeline_destroy(p) != NULL;
+}
+
+static void slow_result(void* ctx, const char* data, size_t len){
+  (void)ctx; (void)data; (void)len;
+  struct timespec ts = {0, 2000000};
+  nanosleep(&ts, NULL);
+}
+static int t08_queue_bottleneck(){
+  const char* chain[] = {"uppercaser", "flipper"};
+  char csv[512]; snprintf(csv, sizeof csv, "%s/tests/queues.csv", g_dir);
+  pipeline_options_t o = opts(2); o.no_optimize = 1; o.on_result = slow_result;
+  o.queue_csv_path = csv; o.queue_sample_ms = 1; pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  for (int i = 0; i < 200; ++i) if (pipeline_push(p, "abc", 3)) return 1;
+  // the callback holds up the last stage: its queue stays full and nothing comes after it
+  int stage; pipeline_stage_stats_t st;
+  if (pipeline_bottleneck(p, &stage) || stage != 1) return 1;
+  if (pipeline_stage_stats(p, 1, &st) || st.queue_capacity != 2 || st.queue_full_waits == 0) return 1;
+  if (pipeline_destroy(p)) return 1;
+  FILE* f = fopen(csv, "r"); char line[256]; int rows = 0;
+  if (!f || !fgets(line, sizeof line, f) || strcmp(line, "time_ms,stage,name,depth,capacity,full_waits,empty_waits\n") != 0) return 1;
+  while (fgets(line, sizeof line, f)) ++rows;
+  fclose(f);
+  return rows < 2;
+}
+
+static int t09_metrics(){
+  const char* chain[] = {"uppercaser", "flipper"};
+  pipeline_options_t o = opts(4); o.metrics = 1; o.no_optimize = 1; pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  for (int i = 0; i < 10; ++i) if (pipeline_push(p, "abc", 3)) return 1;
+  for (int i = 0; i < 10; ++i) if (!pop_is(p, "CBA")) return 1;
+  char* text; size_t len;
+  if (pipeline_metrics(p, &text, &len) || strlen(text) != len) return 1;
+  int ok = strstr(text, "pipeline_stage_messages_out_total{stage=\"1\",name=\"flipper\"} 10\n")
+        && strstr(text, "# TYPE pipeline_queue_depth gauge\n")
+        && strstr(text, "pipeline_latency_seconds{quantile=\"0.99\"} ")
+        && strstr(text, "# TYPE pipeline_latency_seconds summary\n")
+        && strstr(text, "\npipeline_latency_seconds_sum 0.")
+        && strstr(text, "\npipeline_latency_seconds_count 10\n")
+        && strstr(text, "# TYPE pipeline_stage_latency_seconds summary\n")
+        && strstr(text, "pipeline_stage_latency_seconds_count{stage=\"1\",name=\"flipper\"} 10\n")
+        && strstr(text, "pipeline_messages_pushed_total 10\n");
+  free(text);
+  return !ok || pipeline_destroy(p) != NULL;
+}
+
+// an init failure in the middle of the chain (dlmopen, a namespace per stage) shuts down and unloads the
+// stages already up: repeated, leaked namespaces or slots would make a later pipeline fail to load
+static int t14_init_failure_rollback(){
+  char failing[512];
+  snprintf(failing, sizeof failing, "%s/tests/failinit.so", g_dir);
+  const char* chain[] = {"uppercaser", "logger", failing, "flipper"};
+  pipeline_options_t o = opts(4); o.no_optimize = 1;
+  for (int i = 0; i < 20; ++i){
+    pipeline_t* p = NULL;
+    const char* err = pipeline_create(&p, chain, 4, &o);
+    if (!err || !strstr(err, "plugin_init(") || !strstr(err, "refused") || p || pipeline_failed_step() != PIPELINE_STEP_INIT) return 1;
+  }
+  pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  if (pipeline_push(p, "ok", 2) || !pop_is(p, "OK")) return 1;
+  return pipeline_destroy(p) != NULL;
+}
+
+// spans of no plugin_span_kind_t are counted as dropped, not written out with a name read out of bounds
+static int t15_bad_span_kind(){
+  char badspan[512], path[] = "/tmp/pipeline_trace.XXXXXX";
+  snprintf(badspan, sizeof badspan, "%s/tests/badspan.so", g_dir);
+  int fd = mkstemp(path);
+  if (fd < 0) return 1;
+  close(fd);
+  const char* chain[] = {badspan, "uppercaser"};
+  pipeline_options_t o = opts(4); o.no_optimize = 1; o.trace_path = path; pipeline_t* p;
+  if (pipeline_create(&p, chain, 2, &o)) return 1;
+  if (pipeline_push(p, "x", 1) || !pop_is(p, "X") || pipeline_destroy(p)) return 1;
+  char text[1 << 16]; FILE* f = fopen(path, "r");
+  size_t n = f ? fread(text, 1, sizeof text - 1, f) : 0;
+  if (f) fclose(f);
+  unlink(path);
+  text[n] = '\0';
+  return !strstr(text, "\"2 spans dropped\"");
+}
+
+// fd 0 is a valid output: the logger's records have to arrive there, not on stdout
+static int t13_output_to_fd0(){
+  const char* chain[] = {"logger"};
+  int fds[2];
+  if (pipe(fds) || dup2(fds[1], 0) < 0) return 1;
+  close(fds[1]);
+  pipeline_options_t o = opts(4); o.stage_output_fd = 0; pipeline_t* p;
+  if (pipeline_create(&p, chain, 1, &o)) return 1;
+  if (pipeline_push(p, "to fd0", 6) || !pop_is(p, "to fd0") || pipeline_destroy(p)) return 1;
+  close(0);
+  char buf[64]; ssize_t n = read(fds[0], buf, sizeof buf - 1);
+  if (n <= 0) return 1;
+  buf[n] = '\0';
+  return strcmp(buf, "[logger] to fd0\n") != 0;
+}
+
+int main(int argc, char** argv){
+  if (argc < 3){ fprintf(stderr,"usage: %s <test> <plugin_dir>\n", argv[0]); return 2; }
+  const char* t = argv[1]; g_dir = argv[2];
+  struct { const char* name; int (*fn)(void); } cases[] = {
+    {"t01_push_pop_order",t01_push_pop_order},
+    {"t02_callback_and_flush",t02_callback_and_flush},
+    {"t03_two_pipelines",t03_two_pipelines},
+    {"t04_load_failure",t04_load_failure},
+    {"t05_end_reserved",t05_end_reserved},
+    {"t06_stage_stats",t06_stage_stats},
+    {"t07_latency",t07_latency},
+    {"t08_queue_bottleneck",t08_queue_bottleneck},
+    {"t09_metrics",t09_metrics},
+    {"t10_latency_drops_and_silent",t10_latency_drops_and_silent},
+    {"t11_stats_per_pipeline",t11_stats_per_pipeline},
+    {"t12_flush_after_drop",t12_flush_after_drop},
+    {"t13_output_to_fd0",t13_output_to_fd0},
+    {"t14_init_failure_rollback",t14_init_failure_rollback},
+    {"t15_bad_span_kind",t15_bad_span_kind},
+  };
+  for (size_t i=0;i<sizeof(cases)/sizeof(cases[0]);++i){
+    if (strcmp(t,cases[i].name)==0) return cases[i].fn();
+  }
+  fprintf(stderr,"unknown test: %s\n", t);
+  return 2;
+}
+EOF
+
+# test plugins: one that drops a message, one written without the SDK (no plugin_set_host), one whose init fails,
+# one that reports spans of unknown kinds
+cat > "${OUT}/tests/dropper.c" <<'EOF'
+#include "plugin_common.h"
+#include <string.h>
+static const char* drop(const char* s){ return strcmp(s, "drop") == 0 ? NULL : strdup(s); }
+const char* plugin_init(int queue_size){ return common_plugin_init(drop, "dropper", queue_size); }
+EOF
+cat > "${OUT}/tests/foreign.c" <<'EOF'
+#include <stddef.h>
+static const char* (*g_next)(const char*);
+const char* plugin_init(int queue_size){ (void)queue_size; return NULL; }
+const char* plugin_fini(void){ return NULL; }
+void plugin_attach(const char* (*next)(const char*)){ g_next = next; }
+const char* plugin_place_work(const char* s){ return g_next ? g_next(s) : NULL; } // on the caller's thread
+const char* plugin_wait_finished(void){ return NULL; }
+EOF
+"${CC}" -fPIC -shared ${CFLAGS} -I"${ROOT_DIR}/plugins" -o "${OUT}/tests/dropper.so" "${OUT}/tests/dropper.c" \
+  "${ROOT_DIR}/plugins/plugin_common.c" "${ROOT_DIR}/plugins/sync/monitor.c" "${ROOT_DIR}/plugins/sync/consumer_producer.c" \
+  -ldl -lpthread
+cat > "${OUT}/tests/failinit.c" <<'EOF'
+#include <stddef.h>
+const char* plugin_init(int queue_size){ (void)queue_size; return "refused"; }
+const char* plugin_fini(void){ return NULL; }
+void plugin_attach(const char* (*next)(const char*)){ (void)next; }
+const char* plugin_place_work(const char* s){ (void)s; return NULL; }
+const char* plugin_wait_finished(void){ return NULL; }
+EOF
+"${CC}" -fPIC -shared ${CFLAGS} -o "${OUT}/tests/foreign.so" "${OUT}/tests/foreign.c"
+cat > "${OUT}/tests/badspan.c" <<'EOF'
+#include "plugin_sdk.h"
+#include <string.h>
+static const plugin_host_t* g_host;
+static const char* (*g_next)(const char*);
+const char* plugin_set_host(const plugin_host_t* host){ g_host = host; return NULL; }
+const char* plugin_init(int queue_size){ (void)queue_size; return NULL; }
+const char* plugin_fini(void){ return NULL; }
+void plugin_attach(const char* (*next)(const char*)){ g_next = next; }
+const char* plugin_place_work(const char* s){
+  if (strcmp(s, "<END>") != 0 && PLUGIN_HOST_HAS(g_host, trace_span)){ g_host->trace_span(g_host, 99, 1, 2); g_host->trace_span(g_host, -1, 1, 2); }
+  return g_next ? g_next(s) : NULL;
+}
+const char* plugin_wait_finished(void){ return NULL; }
+EOF
+"${CC}" -fPIC -shared ${CFLAGS} -o "${OUT}/tests/failinit.so" "${OUT}/tests/failinit.c"
+"${CC}" -fPIC -shared ${CFLAGS} -I"${ROOT_DIR}/plugins" -o "${OUT}/tests/badspan.so" "${OUT}/tests/badspan.c"
+
+# pipeline library test — link with libpipeline.so like the analyzer
+"${CC}" ${CFLAGS} -I"${ROOT_DIR}" \
+  -o "${OUT}/pipeline_test" \
+  "${OUT}/tests/pipeline_test.c" \
+  -L"${OUT}" -lpipeline -Wl,-rpath,"${OUT}" \
+  -pthread
+
+
+
+
+
 # --------------------------------------- Run monitor unit tests (15) ---------------------------------------
 print_info "Running monitor unit tests"
 for t in \
@@ -580,7 +948,7 @@ done
 
 
 
-# --------------------------------------- Run consumer_producer unit tests (15) ---------------------------------------
+# --------------------------------------- Run consumer_producer unit tests (16) ---------------------------------------
 print_info "Running consumer_producer unit tests"
 for t in \
   t01_init_invalid_args \
@@ -597,7 +965,8 @@ for t in \
   t12_null_put_fails \
   t13_capacity_wraparound \
   t14_many_small_ops \
-  t15_no_spurious_null_get
+  t15_no_spurious_null_get \
+  t16_put_view_rotates
 do
   set +e
   "${OUT}/consumer_producer_test" "$t"
@@ -614,6 +983,40 @@ done
 
 
 
+# --------------------------------------- Run pipeline library tests (15) ---------------------------------------
+print_info "Running pipeline library tests"
+for t in \
+  t01_push_pop_order \
+  t02_callback_and_flush \
+  t03_two_pipelines \
+  t04_load_failure \
+  t05_end_reserved \
+  t06_stage_stats \
+  t07_latency \
+  t08_queue_bottleneck \
+  t09_metrics \
+  t10_latency_drops_and_silent \
+  t11_stats_per_pipeline \
+  t12_flush_after_drop \
+  t13_output_to_fd0 \
+  t14_init_failure_rollback \
+  t15_bad_span_kind
+do
+  set +e
+  timeout 10 "${OUT}/pipeline_test" "$t" "${OUT}"
+  rc=$?
+  set -e
+  if [[ $rc -eq 0 ]]; then
+    print_status "pipeline.$t: PASS"
+  else
+    print_error "pipeline.$t: FAIL (exit $rc)"
+  fi
+done
+
+
+
+
+
 # pipeline helpers -------------------------------------------------
 
 grep_first(){
@@ -867,8 +1270,8 @@ assert_eq "2" "$LINES" "duplicate typewriter prints twice"
 
 
 
-# --------------------------------------- Run edge cases usage tests (38) ---------------------------------------
-print_info "Running 38 edge-cases tests"
+# --------------------------------------- Run edge cases usage tests (49) ---------------------------------------
+print_info "Running 49 edge-cases tests"
 
 # Helper
  assert_cli_error() {
@@ -1142,6 +1545,84 @@ STRESS_OUT="$(run_ana_checked "concurrency stress test" "$STRESS_INPUT" 1 upperc
 STRESS_CNT="$(printf '%s\n' "$STRESS_OUT" | grep -c '^\[logger\]' || true)"
 assert_eq "100" "$STRESS_CNT" "concurrency stress test line count"
 
+# F37) typewriter forwards right away, host stdout lock keeps both records whole
+OUT_ALL="$(run_ana_checked "typewriter then logger records intact(run)" $'hey\nyou\n<END>\n' 10 typewriter logger)"
+TW_LINES="$(printf '%s\n' "$OUT_ALL" | grep -cE '^\[typewriter\] (hey|you)$' || true)"
+LOG_LINES="$(printf '%s\n' "$OUT_ALL" | grep -cE '^\[logger\] (hey|you)$' || true)"
+assert_eq "2 2" "$TW_LINES $LOG_LINES" "typewriter then logger records intact"
+
+# F38) output writer: two typewriters and a logger share stdout, every record whole, shutdown line last
+INPUT="$( { seq 1 20 | sed 's/^/line-/'; echo '<END>'; } )"
+OUT_ALL="$(run_ana_checked "output writer records intact(run)" "$INPUT" --virtual-clock 10 typewriter uppercaser typewriter logger)"
+BAD_LINES="$(printf '%s\n' "$OUT_ALL" | grep -vcE '^\[typewriter\] (line|LINE)-[0-9]+$|^\[logger\] LINE-[0-9]+$|^Pipeline shutdown complete$|^\[clock\]' || true)"
+RECORDS="$(printf '%s\n' "$OUT_ALL" | grep -cE '^\[(typewriter|logger)\]' || true)"
+LAST_LINE="$(printf '%s\n' "$OUT_ALL" | grep -v '^\[clock\]' | tail -n 1)"
+assert_eq "0 60 Pipeline shutdown complete" "$BAD_LINES $RECORDS $LAST_LINE" "output writer records intact"
+
+# F48) typewriter keeps at most queue_size lines waiting to be typed: with queue 2 the logger behind it
+# gets line K only once the typewriter is done with line K-4 (else the logger runs ahead and the copies pile up)
+INPUT="$( { seq 1 60 | sed 's/$/-xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx/'; echo '<END>'; } )"
+OUT_ALL="$(run_ana_checked "typewriter_pending_capped(run)" "$INPUT" --virtual-clock 2 typewriter logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | awk -F'[] -]' '/^\[typewriter\]/ { ++typed } /^\[logger\]/ { ++logged; if (typed < $3 - 4) ++ahead } END { printf "%d %d %d", typed, logged, ahead }')"
+assert_eq "60 60 0" "$ACTUAL" "typewriter_pending_capped"
+
+# F39) with --max-line 1024 a longer line goes in 1024-byte segments (2500 -> 1024 1024 452), --output raw
+# joins their results into one line again
+INPUT="$(head -c 2500 </dev/zero | tr '\0' 'x')"$'\n<END>\n'
+OUT_ALL="$(run_ana_checked "edge_long_line_chunks(run)" "$INPUT" --max-line 1024 10 logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' | awk '{ printf "%d ", length($0) - 9 }')"
+OUT_ALL="$(run_ana_checked "edge_long_line_chunks_raw(run)" "$INPUT" --max-line 1024 --output raw 10 uppercaser)"
+ACTUAL="$ACTUAL$(printf '%s\n' "$OUT_ALL" | awk '/^X/ { printf "raw %d", length($0) }')"
+assert_eq "1024 1024 452 raw 2500" "$ACTUAL" "edge_long_line_chunks"
+
+# F40) input much larger than one read() block, lines cut at block edges stay whole
+INPUT="$( { seq 100000 199999; echo '<END>'; } )"
+EXPECTED="$(seq 100000 199999 | sed 's/^/[logger] /' | md5sum)"
+OUT_ALL="$(run_ana_checked "edge_block_boundaries(run)" "$INPUT" 64 logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' | md5sum)"
+assert_eq "$EXPECTED" "$ACTUAL" "edge_block_boundaries"
+
+# F41) lines have no length limit: a 1 MB line (several read() blocks) arrives whole
+INPUT="$( { head -c 1000000 </dev/zero | tr '\0' 'x'; printf '\nshort\n<END>\n'; } )"
+OUT_ALL="$(run_ana_checked "edge_unbounded_line(run)" "$INPUT" 10 uppercaser logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' | awk '{ printf "%d ", length($0) - 9 }')"
+assert_eq "1000000 5 " "$ACTUAL" "edge_unbounded_line"
+
+# F42) --max-line needs a positive number - exit 1 (usage)
+assert_cli_error "cli_bad_max_line" 1 "Usage:" "invalid --max-line" "${ANALYZER}" --max-line 0 10 logger
+
+# F43) a failing plugin_init exits 2 after shutting down the stages already running (no hang)
+# (with dlopen a plugin listed twice is one object, so its second init fails)
+RC=0
+OUT_ALL="$(printf 'hi\n<END>\n' | ANALYZER_DLMOPEN=0 timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --no-optimize 4 uppercaser logger logger 2>&1)" || RC=$?
+assert_eq "2 yes" "$RC $(grep -q 'plugin_init(logger) error' <<<"$OUT_ALL" && echo yes || echo no)" "init_failure_rollback"
+
+# F44) --max-line only ends on a whole <END> line: a segment reading <END> is cut one character earlier
+INPUT=$'12345<END>\nabc\n<END>\nlost\n'
+OUT_ALL="$(run_ana_checked "edge_segment_not_end(run)" "$INPUT" --max-line 5 4 logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' | tr '\n' '|')"
+assert_eq '[logger] 1234|[logger] 5<END|[logger] >|[logger] abc|' "$ACTUAL" "edge_segment_not_end"
+
+# F45) --max-line cuts between UTF-8 characters, stdin and a mapped --input alike
+INPUT=$'\xc3\xa9\xc3\xa9\xc3\xa9\nab\xe2\x82\xac\n<END>\n'
+EXPECTED=$'[logger] \xc3\xa9|[logger] \xc3\xa9|[logger] \xc3\xa9|[logger] ab|[logger] \xe2\x82\xac|'
+OUT_ALL="$(run_ana_checked "edge_segment_utf8(run)" "$INPUT" --max-line 3 4 logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' | tr '\n' '|')"
+SEGMENT_FILE="$(mktemp -t segments.XXXXXX)"
+printf '%s' "$INPUT" > "$SEGMENT_FILE"
+OUT_ALL="$(run_ana_checked "edge_segment_utf8_mapped(run)" "" --input "$SEGMENT_FILE" --max-line 3 4 logger)"
+rm -f "$SEGMENT_FILE"
+ACTUAL="$ACTUAL $(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' | tr '\n' '|')"
+assert_eq "$EXPECTED $EXPECTED" "$ACTUAL" "edge_segment_utf8"
+
+# F49) a segment's "line goes on" travels beside it, not in it: lines ending in '\' keep it through flipper,
+# --output raw joins the segments of a line and --output framed puts a CONTINUES frame (05) before one
+INPUT=$'ab\\\ncdefg\\\nxy\n<END>\n'
+OUT_ALL="$(run_ana_checked "edge_segment_flag(run)" "$INPUT" --max-line 3 --output raw 4 flipper)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep -v '^Pipeline shutdown complete$' | tr '\n' '|')"
+ACTUAL="$ACTUAL $(printf 'abcd\n<END>\n' | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --max-line 3 --output framed 4 flipper 2>/dev/null | od -An -tx1 | xargs)"
+assert_eq '\ba|edc\gf|yx| 05 06 63 62 61 02 64 01' "$ACTUAL" "edge_segment_flag"
+
 # re-enable -e for the rest of the script
 set -e
 
@@ -1149,6 +1630,486 @@ set -e
 
 
 
+# --------------------------------------- Run analyzer option tests (34) ---------------------------------------
+print_info "Running 32 analyzer option tests"
+set +e
+
+# run analyzer with options before the queue size, stdout+stderr merged
+run_ana_opts() {
+  local input="$1"; shift
+  printf "%s" "$input" | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" "$@" 2>&1
+}
+
+# O1) k rotators merge into one rotation by k
+EXPECTED="[logger] llohe"
+OUT_ALL="$(run_ana_checked "opt_rotators_merge(run)" $'hello\n<END>\n' 10 rotator rotator rotator logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[logger\]')"
+assert_eq "$EXPECTED" "$ACTUAL" "opt_rotators_merge"
+
+# O2) plan shows the merged rotator
+OUT_ALL="$(run_ana_opts $'hello\n<END>\n' --verbose 10 rotator rotator rotator logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[optimizer\]')"
+assert_eq "[optimizer] 4 -> 2 stages: rotator(steps=3) -> logger" "$ACTUAL" "opt_plan_rotators"
+
+# O3) flipper flipper cancels out
+OUT_ALL="$(run_ana_opts $'hello\n<END>\n' --verbose 10 flipper flipper logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[optimizer\]')"
+assert_eq "[optimizer] 3 -> 1 stages: logger" "$ACTUAL" "opt_plan_flipper_cancels"
+
+# O4) uppercaser is idempotent and moves ahead of the expander
+OUT_ALL="$(run_ana_opts $'hello\n<END>\n' --verbose 10 expander uppercaser uppercaser logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[optimizer\]')"
+assert_eq "[optimizer] 4 -> 3 stages: uppercaser -> expander -> logger" "$ACTUAL" "opt_plan_uppercaser_hoisted"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[logger\]')"
+assert_eq "[logger] H E L L O" "$ACTUAL" "opt_uppercaser_hoisted_output"
+
+# O5) flip, rotate, flip folds into one left rotation
+EXPECTED="[logger] bcda"
+OUT_ALL="$(run_ana_opts $'abcd\n<END>\n' --verbose 10 flipper rotator flipper logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[logger\]')"
+assert_eq "$EXPECTED" "$ACTUAL" "opt_flip_rotate_flip"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[optimizer\]')"
+assert_eq "[optimizer] 4 -> 2 stages: rotator(steps=-1) -> logger" "$ACTUAL" "opt_plan_flip_rotate_flip"
+
+# O6) side-effecting stages are barriers
+OUT_ALL="$(run_ana_checked "opt_logger_barrier(run)" $'hi\n<END>\n' 10 uppercaser logger uppercaser logger)"
+LINES="$(printf '%s\n' "$OUT_ALL" | grep -c '^\[logger\] HI$' || true)"
+assert_eq "2" "$LINES" "opt_logger_barrier"
+
+# O7) a chain that cancels completely is kept as written
+OUT_ALL="$(run_ana_opts $'hi\n<END>\n' --verbose 10 flipper flipper)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[optimizer\]')"
+assert_eq "[optimizer] 2 -> 2 stages: flipper -> flipper" "$ACTUAL" "opt_plan_never_empty"
+
+# O8) --no-optimize runs the chain as written
+OUT_ALL="$(run_ana_opts $'hello\n<END>\n' --verbose --no-optimize 10 rotator rotator logger)"
+if printf '%s\n' "$OUT_ALL" | grep -q '^\[optimizer\]'; then
+  print_error "opt_disabled: FAIL (optimizer ran)"
+else
+  assert_eq "[logger] lohel" "$(printf '%s\n' "$OUT_ALL" | grep_first '^\[logger\]')" "opt_disabled"
+fi
+
+# O10) virtual clock: typewriter delays are accounted, not slept (30 chars = 3 s of typing)
+T0=$(date +%s%N)
+OUT_ALL="$(run_ana_opts "$(printf 'abcdefghijklmnopqrstuvwxyz0123\n<END>\n')" --virtual-clock 10 typewriter)"
+T1=$(date +%s%N)
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep_first '^\[typewriter\]')"
+assert_eq "[typewriter] abcdefghijklmnopqrstuvwxyz0123" "$ACTUAL" "virtual_clock_output"
+if (( (T1 - T0) / 1000000 < 1500 )) && printf '%s\n' "$OUT_ALL" | grep -qE '^\[clock\] virtual clock skipped (29[0-9]{2}|3000) ms'; then
+  print_status "virtual_clock_accounted: PASS"
+else
+  print_error "virtual_clock_accounted: FAIL (took $(( (T1 - T0) / 1000000 )) ms)"
+fi
+
+# O11) batched logger keeps order with and without a latency bound
+INPUT="$( { seq 1 500; echo '<END>'; } )"
+EXPECTED="$(seq 1 500 | sed 's/^/[logger] /')"
+for us in 0 1000000; do
+  OUT_ALL="$(ANALYZER_LOGGER_FLUSH_US=$us run_ana_checked "logger_batch_flush_us_${us}(run)" "$INPUT" 7 logger)"
+  ACTUAL="$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]' || true)"
+  assert_eq "$EXPECTED" "$ACTUAL" "logger_batch_flush_us_${us}"
+done
+
+# O12) --input FILE (mapped) gives the same output as stdin, stops at <END>, keeps an unterminated last line
+INPUT_FILE="$(mktemp -t ana_input.XXXXXX)"
+{ seq 1 3000; printf '\n%s\n' "$(head -c 3000 </dev/zero | tr '\0' 'y')"; printf 'last'; } >"$INPUT_FILE"
+EXPECTED="$( { cat "$INPUT_FILE"; printf '\n<END>\n'; } | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" 10 rotator logger 2>&1)"
+printf '\n<END>\nafter-end\n' >>"$INPUT_FILE"
+ACTUAL="$(timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --input "$INPUT_FILE" 10 rotator logger </dev/null 2>&1)"
+assert_eq "$EXPECTED" "$ACTUAL" "input_file_matches_stdin"
+
+# O13) --input that cannot be mapped (a pipe) is streamed instead
+ACTUAL="$(printf 'piped\n<END>\n' | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --input /dev/stdin 10 logger 2>&1 | grep_first '^\[logger\]')"
+assert_eq "[logger] piped" "$ACTUAL" "input_pipe_streamed"
+rm -f "$INPUT_FILE"
+
+# O14) --input of a missing file - exit 1
+assert_cli_error "cli_input_missing" 1 "Usage:" "cannot open input" "${ANALYZER}" --input /nonexistent/input.txt 10 logger
+
+# O15) --listen: concurrent clients share one pipeline and each gets exactly its own results back,
+# one client's <END> only ends that client
+SOCK="$(mktemp -u -t ana_sock.XXXXXX)"
+SERVER_OUT="$(mktemp -t ana_srv.XXXXXX)"
+"$ANALYZER" --listen "$SOCK" 4 uppercaser rotator logger >"$SERVER_OUT" 2>&1 &
+SERVER_PID=$!
+for _ in $(seq 50); do [[ -S "$SOCK" ]] && break; sleep 0.1; done
+ACTUAL="$(timeout "${TIMEOUT_SECS:-10}" python3 - "$SOCK" <<'PY'
+import socket, sys, threading
+results = {}
+def client(name, count, end):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(sys.argv[1])
+    lines = ''.join('%s-%d\n' % (name, i) for i in range(count))
+    threading.Thread(target=lambda: (s.sendall(lines.encode()), s.sendall(b'<END>\n' if end else b''), s.shutdown(socket.SHUT_WR))).start()
+    data = b''
+    while chunk := s.recv(65536):
+        data += chunk
+    upper = ['%s-%d' % (name.upper(), i) for i in range(count)]
+    results[name] = data.decode().splitlines() == [u[-1] + u[:-1] for u in upper]
+threads = [threading.Thread(target=client, args=('c%d' % k, 2000, k % 2 == 0)) for k in range(6)]
+[t.start() for t in threads]
+[t.join() for t in threads]
+print('routed' if len(results) == 6 and all(results.values()) else 'misrouted %r' % results)
+PY
+)"
+assert_eq "routed" "$ACTUAL" "server_routes_results"
+
+# O16) SIGTERM drains the pipeline and exits cleanly, the socket file is removed
+kill -TERM "$SERVER_PID"
+RC=0
+wait "$SERVER_PID" || RC=$?
+LOGGED="$(grep -c '^\[logger\]' "$SERVER_OUT" || true)"
+LAST_LINE="$(tail -n 1 "$SERVER_OUT")"
+SOCK_STATE="$([[ -e "$SOCK" ]] && echo left || echo removed)"
+assert_eq "0 12000 removed Pipeline shutdown complete" "$RC $LOGGED $SOCK_STATE $LAST_LINE" "server_sigterm_shutdown"
+rm -f "$SERVER_OUT"
+
+# O16b) --listen with --max-line: a client's segments come back joined, cut between UTF-8 characters, and
+# only its whole <END> line ends it
+SOCK="$(mktemp -u -t ana_sock.XXXXXX)"
+"$ANALYZER" --listen "$SOCK" --max-line 3 4 uppercaser >/dev/null 2>&1 &
+SERVER_PID=$!
+for _ in $(seq 50); do [[ -S "$SOCK" ]] && break; sleep 0.1; done
+ACTUAL="$(timeout "${TIMEOUT_SECS:-10}" python3 - "$SOCK" <<'PY'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall('ab\u20ac\n12<END>\n<END>\n'.encode())
+data = b''
+while chunk := s.recv(65536):
+    data += chunk
+print('|'.join(data.decode().splitlines()))
+PY
+)"
+kill -TERM "$SERVER_PID"; wait "$SERVER_PID" || true
+assert_eq 'AB€|12<END>' "$ACTUAL" "server_segments"
+
+# O16c) --listen when a stage drops a line: no result goes to the wrong client, the clients that had
+# lines in flight are closed, and clients after that are served in full again
+SOCK="$(mktemp -u -t ana_sock.XXXXXX)"
+"$ANALYZER" --listen "$SOCK" 2 "${OUT}/tests/dropper.so" uppercaser >/dev/null 2>&1 &
+SERVER_PID=$!
+for _ in $(seq 50); do [[ -S "$SOCK" ]] && break; sleep 0.1; done
+ACTUAL="$(timeout "${TIMEOUT_SECS:-10}" python3 - "$SOCK" <<'PY'
+import socket, sys, threading
+def client(name, lines):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(sys.argv[1])
+    threading.Thread(target=lambda: (s.sendall(''.join(l + '\n' for l in lines).encode()), s.shutdown(socket.SHUT_WR))).start()
+    data = b''
+    while chunk := s.recv(65536):
+        data += chunk
+    got = data.decode().splitlines()
+    want = [l.upper() for l in lines if l != 'drop']
+    it = iter(want)
+    return all(g in it for g in got), len(got) == len(want)  # in order and its own / all of them
+ok = []
+def run(name, lines):
+    ok.append(client(name, lines))
+threads = [threading.Thread(target=run, args=('c%d' % k, ['c%d-%d' % (k, i) for i in range(500)])) for k in range(3)]
+threads.append(threading.Thread(target=run, args=('d', ['d-%d' % i for i in range(200)] + ['drop'] + ['d-x%d' % i for i in range(200)])))
+[t.start() for t in threads]
+[t.join() for t in threads]
+own = all(o[0] for o in ok)
+after = client('late', ['late-%d' % i for i in range(1000)])
+print('%s %s' % ('own' if own and len(ok) == 4 else 'misrouted', 'served' if after == (True, True) else 'lost %r' % (after,)))
+PY
+)" || true
+kill -TERM "$SERVER_PID"; wait "$SERVER_PID" || true
+assert_eq "own served" "$ACTUAL" "server_drop_no_misroute"
+
+# O16d) --listen backpressure: a client that sends a lot and reads nothing is not read further (its
+# results wait in the socket, not in the server), the others are served meanwhile, it gets everything later
+SOCK="$(mktemp -u -t ana_sock.XXXXXX)"
+"$ANALYZER" --listen "$SOCK" 4 uppercaser >/dev/null 2>&1 &
+SERVER_PID=$!
+for _ in $(seq 50); do [[ -S "$SOCK" ]] && break; sleep 0.1; done
+ACTUAL="$(timeout "${TIMEOUT_SECS:-10}" python3 - "$SOCK" "$SERVER_PID" <<'PY'
+import socket, sys, threading, time
+line = b'x' * 4095 + b'\n'
+count = 16384  # 64 MiB in, 64 MiB out
+slow = socket.socket(socket.AF_UNIX)
+slow.connect(sys.argv[1])
+threading.Thread(target=lambda: (slow.sendall(line * count), slow.shutdown(socket.SHUT_WR)), daemon=True).start()
+time.sleep(0.5)
+fast = socket.socket(socket.AF_UNIX)
+fast.connect(sys.argv[1])
+fast.sendall(b'a\nb\n<END>\n')
+data = b''
+while chunk := fast.recv(65536):
+    data += chunk
+served = data == b'A\nB\n'
+time.sleep(0.5)
+with open('/proc/%s/status' % sys.argv[2]) as f:
+    peak_kb = int(next(l for l in f if l.startswith('VmHWM')).split()[1])
+got = 0
+while chunk := slow.recv(1 << 20):
+    got += len(chunk)
+print('%s %s %s' % ('served' if served else 'stuck', 'bounded' if peak_kb < 32 * 1024 else 'grew to %d kB' % peak_kb,
+                    'complete' if got == len(line) * count else 'short %d' % got))
+PY
+)" || true
+kill -TERM "$SERVER_PID"; wait "$SERVER_PID" || true
+assert_eq "served bounded complete" "$ACTUAL" "server_backpressure"
+
+# O17) --binary: frames in, one frame per result out, END frame last; embedded newlines survive,
+# FLUSH is accepted, frames after END are ignored, stage text output moves to stderr
+ACTUAL="$(python3 - "$ANALYZER" <<'PY'
+import subprocess, sys
+def varint(v):
+    out = b''
+    while True:
+        out += bytes([(v & 0x7f) | (0x80 if v > 0x7f else 0)])
+        v >>= 7
+        if not v:
+            return out
+data = lambda p: varint(len(p) << 1) + p
+control = lambda code: varint((code << 1) | 1)
+frames = data(b'hello\nworld') + data(b'') + data(b'y' * 200) + control(1) + data(b'abc') + control(0) + data(b'late')
+run = subprocess.run([sys.argv[1], '--binary', '4', 'uppercaser', 'logger'], input=frames, capture_output=True, timeout=10)
+expected = data(b'HELLO\nWORLD') + data(b'') + data(b'Y' * 200) + data(b'ABC') + control(0)
+logged = run.stderr.decode().count('[logger]')
+print('ok' if run.returncode == 0 and run.stdout == expected and logged == 4 else 'bad rc=%d out=%r' % (run.returncode, run.stdout[:60]))
+PY
+)"
+assert_eq "ok" "$ACTUAL" "binary_frames_roundtrip"
+
+# O18) --binary input that ends inside a frame - exit 1
+RC=0
+OUT_ALL="$(printf '\x0aab' | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --binary 4 logger 2>&1)" || RC=$?
+assert_eq "1 yes" "$RC $(grep -q 'ends inside a frame' <<<"$OUT_ALL" && echo yes || echo no)" "binary_truncated_frame"
+
+# O19) --output raw: the last stage's results reach stdout as plain lines, no logger needed
+OUT_ALL="$(run_ana_checked "output_raw(run)" $'hello\nworld\n\n<END>\n' --output raw 4 uppercaser rotator)"
+assert_eq $'OHELL\nDWORL\n\nPipeline shutdown complete' "$OUT_ALL" "output_raw"
+
+# O20) --output framed with line input: one data frame per result, then an END frame
+ACTUAL="$(printf 'ab\n<END>\n' | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --output framed 4 flipper 2>/dev/null | od -An -tx1 | tr -s ' \n' ' ')"
+assert_eq " 04 62 61 01 " "$ACTUAL" "output_framed"
+
+# O21) unknown --output mode - exit 1 (usage)
+assert_cli_error "cli_bad_output_mode" 1 "Usage:" "invalid --output" "${ANALYZER}" --output json 10 logger
+
+# O22) --stats: one summary row per stage with its message and byte counts
+OUT_ALL="$(run_ana_checked "stats_summary(run)" $'hello\nab\n<END>\n' --stats --no-optimize 4 uppercaser logger)"
+ACTUAL="$(printf '%s\n' "$OUT_ALL" | awk '$1 == "[stats]" && $2 != "stage" { print $2, $3, $4, $5, $6 }')"
+assert_eq $'uppercaser 2 2 7 7\nlogger 2 2 7 7' "$ACTUAL" "stats_summary"
+
+# O23) --latency: a table on SIGUSR1 while running and one at shutdown, each with an end-to-end row
+FIFO="${OUT}/tests/latency.fifo"
+rm -f "$FIFO"; mkfifo "$FIFO"
+"$ANALYZER" --latency 4 uppercaser logger < "$FIFO" > "${OUT}/tests/latency.out" 2>&1 &  # no timeout wrapper, it would take the signal
+PID=$!
+exec 7> "$FIFO"
+printf 'hi\n' >&7
+sleep 0.3
+kill -USR1 "$PID"
+sleep 0.3
+printf 'there\n<END>\n' >&7
+exec 7>&-
+wait "$PID"
+RC=$?
+rm -f "$FIFO"
+ROWS="$(grep -c '^\[latency\] end-to-end' "${OUT}/tests/latency.out" || true)"
+FINAL="$(grep '^\[latency\] end-to-end' "${OUT}/tests/latency.out" | tail -n 1 | awk '{ print $3 }')"
+assert_eq "0 2 2" "$RC $ROWS $FINAL" "latency_report_signal_and_exit"
+
+# O24) --trace: Chrome trace-event JSON with an input track and one track per stage, a process span per line
+TRACE="${OUT}/tests/trace.json"
+rm -f "$TRACE"
+run_ana_checked "trace_timeline(run)" $'a\nbb\nccc\n<END>\n' --trace "$TRACE" --no-optimize 4 uppercaser flipper logger >/dev/null
+ACTUAL="$(python3 - "$TRACE" <<'PY'
+import json, sys
+events = json.load(open(sys.argv[1]))['traceEvents']
+names = {e['tid']: e['args']['name'] for e in events if e['ph'] == 'M' and e['name'] == 'thread_name'}
+count = lambda tid, name: sum(1 for e in events if e['ph'] == 'X' and e['tid'] == tid and e['name'] == name)
+print(' '.join(names[t] for t in sorted(names)), count(0, 'push'), count(1, 'process'), count(3, 'process'))
+PY
+)"
+assert_eq "input 1 uppercaser 2 flipper 3 logger 3 3 3" "$ACTUAL" "trace_timeline"
+
+# O25) --queue-csv: a header and a row per stage and sample, a queue row per stage and a verdict on stderr
+QUEUES="${OUT}/tests/queues_cli.csv"
+rm -f "$QUEUES"
+OUT_ALL="$(run_ana_checked "queue_csv(run)" $'a\nbb\n<END>\n' --queue-csv "$QUEUES" --queue-interval 1 --no-optimize 4 uppercaser flipper)"
+ACTUAL="$(head -n 1 "$QUEUES"; awk -F, 'NR > 1 { print NF, $2, $3, $5 }' "$QUEUES" | sort -u;
+  printf '%s\n' "$OUT_ALL" | grep -c -e '^\[queues\] uppercaser ' -e '^\[queues\] flipper ' -e '^\[bottleneck\] ')"
+assert_eq $'time_ms,stage,name,depth,capacity,full_waits,empty_waits\n7 0 uppercaser 4\n7 1 flipper 4\n3' "$ACTUAL" "queue_csv"
+
+# O26) --queue-interval out of range - exit 1 (usage)
+assert_cli_error "cli_bad_queue_interval" 1 "Usage:" "invalid --queue-interval" "${ANALYZER}" --queue-csv /dev/null --queue-interval 0 10 logger
+
+# O27) --metrics-socket: an HTTP/1.0 Prometheus response while running, the socket is removed at exit
+FIFO="${OUT}/tests/metrics.fifo"
+SOCK="${OUT}/tests/metrics.sock"
+rm -f "$FIFO" "$SOCK"; mkfifo "$FIFO"
+timeout "${TIMEOUT_SECS:-10}" "$ANALYZER" --metrics-socket "$SOCK" 4 uppercaser logger < "$FIFO" > "${OUT}/tests/metrics.out" 2>&1 &
+PID=$!
+exec 7> "$FIFO"
+printf 'hi\nthere\n' >&7
+sleep 0.3
+ACTUAL="$(python3 - "$SOCK" <<'PY'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(b'GET /metrics HTTP/1.1\r\nHost: analyzer\r\n\r\n')
+data = b''
+while True:
+    chunk = s.recv(65536)
+    if not chunk:
+        break
+    data += chunk
+head, body = data.decode().split('\r\n\r\n', 1)
+lines = body.splitlines()
+print(head.splitlines()[0], *[l for l in lines if l.startswith('pipeline_stage_messages_in_total{')])
+PY
+)"
+printf '<END>\n' >&7
+exec 7>&-
+wait "$PID"
+RC=$?
+rm -f "$FIFO"
+[[ -e "$SOCK" ]] && ACTUAL="$ACTUAL (socket left behind)"
+assert_eq "HTTP/1.0 200 OK pipeline_stage_messages_in_total{stage=\"0\",name=\"uppercaser\"} 2 pipeline_stage_messages_in_total{stage=\"1\",name=\"logger\"} 2 rc=0" "$ACTUAL rc=$RC" "metrics_socket"
+
+# O9) unknown option - exit 1 (usage)
+assert_cli_error "cli_unknown_option" 1 "Usage:" "unknown option" "${ANALYZER}" --bogus 10 logger
+
+set -e
+
+
+
+
+
+# --------------------------------------- Run static registry tests (3) ---------------------------------------
+print_info "Running 3 static registry tests"
+set +e
+ANALYZER_STATIC="${OUT}/analyzer_static"
+
+# S1) linked-in plugins give the same output as the shared objects (an explicit path still loads)
+INPUT="$( { seq 1 300 | sed 's/$/ab cd/'; echo '<END>'; } )"
+EXPECTED="$(printf '%s\n' "$INPUT" | "$ANALYZER" 8 uppercaser rotator "${OUT}/flipper.so" expander logger 2>&1)"
+ACTUAL="$(printf '%s\n' "$INPUT" | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER_STATIC" 8 uppercaser rotator "${OUT}/flipper.so" expander logger 2>&1)"
+assert_eq "$EXPECTED" "$ACTUAL" "static_matches_shared"
+
+# S2) no .so needed: run where ./output does not exist
+ACTUAL="$(cd "${OUT}/tests" && printf 'hello\n<END>\n' | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER_STATIC" --virtual-clock 4 rotator typewriter 2>&1 | grep_first '^\[typewriter\]')"
+assert_eq "[typewriter] ohell" "$ACTUAL" "static_without_shared_objects"
+
+# S3) a plugin listed twice: the second copy comes from its .so, each keeps its own state
+OUT_ALL="$(printf 'hello\n<END>\n' | timeout "${TIMEOUT_SECS:-10}" "$ANALYZER_STATIC" --no-optimize 4 rotator logger rotator logger 2>&1)"
+assert_eq $'[logger] ohell\n[logger] lohel' "$(printf '%s\n' "$OUT_ALL" | grep '^\[logger\]')" "static_duplicate_stage"
+
+set -e
+
+
+
+
+
+# --------------------------------------- Run benchmark smoke tests (7) ---------------------------------------
+print_info "Running 7 benchmark smoke tests"
+set +e
+
+# B1) queue_bench: every mix, capacity and item size plus ping_pong, unique ids, well-formed numbers
+QUEUE_JSON="${OUT}/tests/queue_bench.json"
+rm -f "$QUEUE_JSON"
+timeout "${TIMEOUT_SECS:-10}" "${OUT}/bench/queue_bench" --ops 200 --out "$QUEUE_JSON" 2>/dev/null
+ACTUAL="$(python3 - "$QUEUE_JSON" <<'PY'
+import json, sys
+try:
+    doc = json.load(open(sys.argv[1]))
+except Exception as e:
+    print("bad json: %s" % e); sys.exit(0)
+ids = [r["id"] for r in doc["results"]]
+ok = doc["suite"] == "queue" and len(ids) == 25 and len(set(ids)) == 25 and ids[-1] == "ping_pong"
+ok = ok and all(r["ops_per_sec"] > 0 for r in doc["results"])
+ok = ok and all(r["put_ns"]["p50"] <= r["put_ns"]["p99"] <= r["put_ns"]["max"] for r in doc["results"] if r["name"] == "put_get")
+print("ok" if ok else "unexpected results: %s" % ids)
+PY
+)"
+assert_eq "ok" "$ACTUAL" "queue_bench_json"
+
+# B2) a bad count is refused with the usage
+ERR="$("${OUT}/bench/queue_bench" --ops 0 2>&1 >/dev/null)"; RC=$?
+assert_eq "1 Usage" "$RC $(printf '%s\n' "$ERR" | grep_first '^Usage' | cut -d: -f1)" "queue_bench_bad_ops"
+
+# B3) transform_bench: every plugin, line length and charset straight through plugin_process
+TRANSFORM_JSON="${OUT}/tests/transform_bench.json"
+rm -f "$TRANSFORM_JSON"
+timeout "${TIMEOUT_SECS:-10}" "${OUT}/bench/transform_bench" --dir "$OUT" --bytes 65536 --rounds 1 --out "$TRANSFORM_JSON" 2>/dev/null
+ACTUAL="$(python3 - "$TRANSFORM_JSON" <<'PY'
+import json, sys
+try:
+    doc = json.load(open(sys.argv[1]))
+except Exception as e:
+    print("bad json: %s" % e); sys.exit(0)
+seen = {(r["plugin"], r["charset"], r["line_bytes"]) for r in doc["results"] if r["gb_per_sec"] > 0 and r["ns_per_line"] > 0}
+want = {(p, c, n) for p in ("uppercaser", "flipper", "rotator", "expander", "logger")
+        for c in ("ascii", "utf8") for n in (8, 64, 512, 4096, 65536)}
+print("ok" if doc["suite"] == "transform" and seen == want and len(doc["results"]) == len(want) else "missing: %s" % sorted(want - seen))
+PY
+)"
+assert_eq "ok" "$ACTUAL" "transform_bench_json"
+
+# B4) analyzer_bench: chain length x queue size sweep through libpipeline, every line comes out
+PIPELINE_JSON="${OUT}/tests/analyzer_bench.json"
+rm -f "$PIPELINE_JSON"
+timeout "${TIMEOUT_SECS:-10}" "${OUT}/bench/analyzer_bench" --dir "$OUT" --lines 2000 --utf8 20 --chain uppercaser,rotator,flipper \
+  --stages 1,3 --queue-sizes 1,8 --latency --out "$PIPELINE_JSON" 2>/dev/null
+ACTUAL="$(python3 - "$PIPELINE_JSON" <<'PY'
+import json, sys
+try:
+    doc = json.load(open(sys.argv[1]))
+except Exception as e:
+    print("bad json: %s" % e); sys.exit(0)
+runs = {(r["stages"], r["queue_size"]): r for r in doc["results"]}
+ok = sorted(runs) == [(1, 1), (1, 8), (3, 1), (3, 8)]
+ok = ok and all(r["lines"] == 2000 and r["bytes_out"] == doc["input_bytes"] and r["lines_per_sec"] > 0 and r["peak_rss_kb"] > 0
+                and r["first_line_ms"] > 0 and 0 < r["latency_ns"]["p50"] <= r["latency_ns"]["p99"] and len(r["stage_latency_ns"]) == r["stages"]
+                for r in runs.values())
+print("ok" if ok else "unexpected results: %s" % doc["results"])
+PY
+)"
+assert_eq "ok" "$ACTUAL" "analyzer_bench_json"
+
+# B5) compare.py: the same results pass against their own baseline, a 10x better baseline is a regression
+GATE_BASELINE="${OUT}/tests/baseline.json"
+rm -f "$GATE_BASELINE"
+python3 "${ROOT_DIR}/bench/compare.py" --baseline "$GATE_BASELINE" --update --results "$QUEUE_JSON" >/dev/null 2>&1
+python3 "${ROOT_DIR}/bench/compare.py" --baseline "$GATE_BASELINE" --results "$QUEUE_JSON" >/dev/null 2>&1; RC_SAME=$?
+python3 - "$GATE_BASELINE" <<'PY'
+import json, sys
+doc = json.load(open(sys.argv[1]))
+doc["results"]["queue"]["put_get/1p1c/cap1/16B"]["ops_per_sec"]["median"] *= 10
+json.dump(doc, open(sys.argv[1], "w"))
+PY
+REPORT="$(python3 "${ROOT_DIR}/bench/compare.py" --baseline "$GATE_BASELINE" --results "$QUEUE_JSON" 2>&1)"; RC_SLOW=$?
+assert_eq "0 1 REGRESSION put_get/1p1c/cap1/16B" "$RC_SAME $RC_SLOW $(printf '%s\n' "$REPORT" | grep_first '^REGRESSION' | awk '{print $1, $2}')" "compare_detects_regression"
+
+# B5b) a baseline recorded on another host is not compared against: exit 2, and 0 for the test.sh gate
+python3 - "$GATE_BASELINE" <<'PY'
+import json, sys
+doc = json.load(open(sys.argv[1]))
+doc["host"]["cpu"] = "some other CPU"
+json.dump(doc, open(sys.argv[1], "w"))
+PY
+python3 "${ROOT_DIR}/bench/compare.py" --baseline "$GATE_BASELINE" --results "$QUEUE_JSON" >/dev/null 2>&1; RC_OTHER=$?
+python3 "${ROOT_DIR}/bench/compare.py" --baseline "$GATE_BASELINE" --results "$QUEUE_JSON" --if-changed >/dev/null 2>&1; RC_GATE=$?
+python3 "${ROOT_DIR}/bench/compare.py" --baseline "$GATE_BASELINE" --results "$QUEUE_JSON" --any-host >/dev/null 2>&1; RC_ANY=$?
+assert_eq "2 0 1" "$RC_OTHER $RC_GATE $RC_ANY" "compare_skips_other_host"
+
+# B6) hot-path gate: runs the whole suite against bench/baseline.json when consumer_producer.c or
+# plugin_common.c changed since the baseline was recorded (refresh it with bench/compare.py --update)
+REPORT="$(python3 "${ROOT_DIR}/bench/compare.py" --if-changed 2>&1)"; RC=$?
+[[ $RC -ne 0 ]] && printf '%s\n' "$REPORT" >&2
+assert_eq "0" "$RC" "hot_path_regression_gate"
+
+set -e
+
+
+
+
+
 # --------------------------------------- Memory leak checks ---------------------------------------
 
 if have_cmd valgrind; then